@@ -1,13 +1,32 @@
 #pragma once
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <atomic>
+#include <mutex>
 #include "Typedefs.h"
 #include "Mesh.h"
+#include "Occlusion.h"
 
 // chunk sizes
 #define CHUNK_SX 16
 #define CHUNK_SZ 16
-#define CHUNK_SY 24
+#define CHUNK_SY 256
 #define CHUNK_SIZE (CHUNK_SX * CHUNK_SZ * CHUNK_SY)
 
+// чанк делится по высоте на секции, блоки каждой секции хранятся отдельно
+#define CHUNK_SECTION_SY 16
+#define CHUNK_SECTIONS (CHUNK_SY / CHUNK_SECTION_SY)
+#define CHUNK_SECTION_SIZE (CHUNK_SX * CHUNK_SZ * CHUNK_SECTION_SY)
+
+// размеры чанка для шейдеров, вставляются после #version (см. BuildShader)
+#define CHUNK_STRINGIFY_(x) #x
+#define CHUNK_STRINGIFY(x) CHUNK_STRINGIFY_(x)
+#define CHUNK_SHADER_DEFINES \
+	"#define CHUNK_SX " CHUNK_STRINGIFY(CHUNK_SX) "\n" \
+	"#define CHUNK_SY " CHUNK_STRINGIFY(CHUNK_SY) "\n" \
+	"#define CHUNK_SZ " CHUNK_STRINGIFY(CHUNK_SZ) "\n"
+
 enum BlockType : u16 {
 	btGround,
 	btStone,
@@ -16,7 +35,7 @@ enum BlockType : u16 {
 	texSun,
 	texMoon,
 	btAir,
-	btCOUNT //   .    
+	btCOUNT // должен быть последним. обозначает количество типов блоков
 };
 
 struct Block {
@@ -26,85 +45,872 @@ struct Block {
 	Block(BlockType t);
 };
 
+enum Biome : u8 {
+	biomeTemperate,
+	biomeSnow,
+	biomeRiver,
+	biomeCOUNT
+};
+
+// данные по столбцам (x, z) чанка, индекс [z * CHUNK_SX + x]
+struct ChunkColumns {
+	u16 heightmap[CHUNK_SX * CHUNK_SZ]; // высота поверхности: y самого верхнего непрозрачного блока + 1, 0 если столбец пуст
+	Biome biomes[CHUNK_SX * CHUNK_SZ];
+};
+
+// блоки секции чанка в сжатом виде: палитра типов блоков, встречающихся в секции, и индексы в палитре
+// по bitsPerIndex бит на блок. Ширина индекса растет вместе с палитрой: 0 (все блоки одного типа), 1, 2, 4, 8, 16.
+// Индексы не пересекают границы u64, индекс блока [y * CHUNK_SX * CHUNK_SZ + z * CHUNK_SX + x], y внутри секции
+struct BlockStorage {
+	BlockType palette[btCOUNT]; // каждый тип встречается в палитре не больше одного раза
+	u16 paletteSize;
+	u8 bitsPerIndex;
+	u64* indices; // NULL при bitsPerIndex == 0
+
+	void init(BlockType fill);
+	void release();
+	BlockType get(int index) const;
+	void set(int index, BlockType type);
+	void unpack(BlockType* out) const; // все блоки секции, CHUNK_SECTION_SIZE элементов
+	void pack(const Block* blocks); // заменить все блоки, палитра строится заново
+	size_t memoryUsage() const;
+	bool isUniform() const { return bitsPerIndex == 0; } // вся секция из блоков palette[0], массива индексов нет
+
+	void setBitsPerIndex(u8 bits);
+};
+
+// блоки чанка по секциям, индекс блока [y * CHUNK_SX * CHUNK_SZ + z * CHUNK_SX + x].
+// Секция из одного типа блоков (обычно воздух или камень) не хранит массив индексов
+struct ChunkBlocks {
+	BlockStorage sections[CHUNK_SECTIONS];
+
+	void init(BlockType fill);
+	void release();
+	BlockType get(int index) const {
+		return sections[index / CHUNK_SECTION_SIZE].get(index % CHUNK_SECTION_SIZE);
+	}
+	void set(int index, BlockType type) {
+		sections[index / CHUNK_SECTION_SIZE].set(index % CHUNK_SECTION_SIZE, type);
+	}
+	void unpack(BlockType* out) const; // все блоки чанка, CHUNK_SIZE элементов
+	void pack(const Block* blocks); // CHUNK_SIZE блоков
+	size_t memoryUsage() const;
+	// секция полностью из воздуха: в ней нет граней
+	bool isSectionEmpty(int section) const {
+		return sections[section].isUniform() && sections[section].palette[0] == btAir;
+	}
+};
+
+// стороны ячейки в графе связности, противоположная сторона - side ^ 1
+enum SectionSide : u8 {
+	sideXNeg,
+	sideXPos,
+	sideYNeg,
+	sideYPos,
+	sideZNeg,
+	sideZPos,
+	sideCOUNT
+};
+
+#define SECTION_ALL_CONNECTED 0x7FFF // связаны все 15 пар сторон
+
+// узел графа связности - ячейка секции. Рельеф ниже одной секции, и в секции 16x16x16 воздух пещер почти
+// всегда связан с открытым воздухом над рельефом, поэтому ячейки мельче. Ребро делит CHUNK_SX, CHUNK_SZ и CHUNK_SECTION_SY
+#define CONNECTIVITY_CELL 4
+#define CONNECTIVITY_CELLS_X (CHUNK_SX / CONNECTIVITY_CELL)
+#define CONNECTIVITY_CELLS_Y (CHUNK_SECTION_SY / CONNECTIVITY_CELL)
+#define CONNECTIVITY_CELLS_Z (CHUNK_SZ / CONNECTIVITY_CELL)
+#define SECTION_CELLS (CONNECTIVITY_CELLS_X * CONNECTIVITY_CELLS_Y * CONNECTIVITY_CELLS_Z) // ячейка [(y * CELLS_Z + z) * CELLS_X + x]
+
+// бит пары сторон (a != b) в маске связности ячейки
+inline u16 sectionSidePairBit(int a, int b) {
+	static const u8 pairIndex[sideCOUNT][sideCOUNT] = {
+		{ 0,  0,  1,  2,  3,  4 },
+		{ 0,  0,  5,  6,  7,  8 },
+		{ 1,  5,  0,  9, 10, 11 },
+		{ 2,  6,  9,  0, 12, 13 },
+		{ 3,  7, 10, 12,  0, 14 },
+		{ 4,  8, 11, 13, 14,  0 },
+	};
+	return 1 << pairIndex[a][b];
+}
+
+// измененный блок, координаты в чанке. x и z могут быть -1 или CHUNK_SX (CHUNK_SZ):
+// блок соседнего чанка на границе, он меняет только грани граничного слоя
+struct ChunkEdit {
+	s8 x;
+	u8 y;
+	s8 z;
+};
+#define CHUNK_MAX_PENDING_EDITS 16 // больше правок - меш перестраивается целиком
+
 struct Chunk {
 	int posx, posz;
-	Block* blocks;
+	ChunkBlocks blocks;
+	ChunkColumns columns;
 	BlockMesh mesh;
+	ChunkOccluders occluders; // пересчитываются в главном потоке при отправке меша на ГПУ
+	// пары сторон ячейки, между которыми можно пройти по воздуху внутри ячейки (sectionSidePairBit)
+	u16 cellConnectivity[CHUNK_SECTIONS][SECTION_CELLS];
+	u16 airSections; // бит на секцию из одного воздуха
+	u16 connectivityDirty; // бит на секцию: связность ее ячеек пересчитается при следующем мешинге
+	// основной поток: копия связности, снятая под lock при отправке меша на ГПУ, ее читает обход видимости.
+	// connectivityOpen - копии нет или блоки уже менялись, проход через чанк открыт
+	u16 drawnConnectivity[CHUNK_SECTIONS][SECTION_CELLS];
+	u16 drawnAirSections;
+	bool connectivityOpen;
 	bool generated;
+	bool prefetched; // сгенерирован заранее за радиусом загрузки (GameWorld::prefetchChunk): не в сетке и не рисуется
+	bool modified; // под lock: правки игрока, еще не сохраненные в файл региона (сохраняются при выгрузке)
+	bool needRemesh; // основной поток: сгенерировался соседний чанк, нужно заново отсечь грани на границе
+	bool remeshUrgent; // основной поток: перестроение после правки игрока, важнее генерации
+	bool remeshNeighbors; // под lock: чанк сгенерирован, соседи отмечаются для перестроения при отправке его меша
+	// задача перестроения меша ожидает выполнения: новые запросы не ставят еще одну, она прочитает все правки
+	std::atomic<bool> remeshQueued;
+	// под lock: правки, ожидающие перестроения меша. Без правок и без pendingFullRemesh задаче нечего делать
+	ChunkEdit pendingEdits[CHUNK_MAX_PENDING_EDITS];
+	u8 pendingEditCount;
+	bool pendingFullRemesh; // меш перестраивается целиком
+
+	// увеличивается при каждом переносе чанка на новую позицию: задачи со старой версией устарели
+	std::atomic<u32> version;
+	// защищает блоки, меш и позицию при публикации результатов генерации
+	std::mutex lock;
+};
+
+// соседние чанки по горизонтали
+enum ChunkNeighbor : u8 {
+	neighborXNeg,
+	neighborXPos,
+	neighborZNeg,
+	neighborZPos,
+	neighborCOUNT
 };
 
-void meshChunk(Chunk& chunk);
+// граничные слои блоков соседних чанков, прилегающие к чанку
+// слой соседа по X индексируется [y * CHUNK_SZ + z], по Z - [y * CHUNK_SX + x]
+struct ChunkBorders {
+	bool present[neighborCOUNT]; // false - сосед еще не сгенерирован, грани на этой границе не отсекаются
+	BlockType slabs[neighborCOUNT][CHUNK_SY * std::max(CHUNK_SX, CHUNK_SZ)];
+};
+
+enum MeshingMode : u8 {
+	meshingNaive,	// одна грань на каждую видимую сторону блока
+	meshingGreedy,	// соседние грани с одной текстурой объединяются в прямоугольники
+	meshingCOUNT
+};
+
+extern MeshingMode meshingMode;
+
+u16 columnSurfaceHeight(const Block* blocks, int columnIndex);
+u16 columnSurfaceHeight(const ChunkBlocks& blocks, int columnIndex);
+
+void meshChunk(Chunk& chunk, const ChunkBorders* borders = NULL);
+u32 meshChunkNaive(Chunk& chunk, const BlockType* blocks, const ChunkBorders* borders = NULL);
+u32 meshChunkGreedy(Chunk& chunk, const BlockType* blocks, const ChunkBorders* borders = NULL);
+// перестроить только грани слоев вокруг измененных блоков и заменить их в меше на месте.
+// Меш должен быть построен для блоков до этих правок
+void patchChunkMesh(Chunk& chunk, const ChunkEdit* edits, int editCount, const ChunkBorders* borders = NULL);
+// под lock: запомнить правку до перестроения меша. NULL или правок слишком много - меш перестраивается целиком
+void addPendingEdit(Chunk& chunk, const ChunkEdit* edit);
+// под lock: заменить блок, отметить секцию для пересчета связности и запомнить правку. Правка записывается
+// вместе с блоком: задача перестроения, начатая между ними, пересчитала бы связность без этой ячейки
+void setChunkBlock(Chunk& chunk, int x, int y, int z, BlockType type);
 
 #ifdef CHUNK_IMPL
+MeshingMode meshingMode = meshingGreedy;
+
 Block::Block() {}
 
 Block::Block(BlockType t) {
 	this->type = t;
 }
 
-void meshChunk(Chunk& chunk) {
+// высота поверхности столбца (для карты высот): y самого верхнего непрозрачного блока + 1
+u16 columnSurfaceHeight(const Block* blocks, int columnIndex) {
+	for (int y = CHUNK_SY - 1; y >= 0; y--) {
+		if (blocks[y * CHUNK_SX * CHUNK_SZ + columnIndex].type != btAir)
+			return y + 1;
+	}
+	return 0;
+}
+
+u16 columnSurfaceHeight(const ChunkBlocks& blocks, int columnIndex) {
+	for (int s = CHUNK_SECTIONS - 1; s >= 0; s--) {
+		if (blocks.isSectionEmpty(s))
+			continue;
+		for (int y = CHUNK_SECTION_SY - 1; y >= 0; y--) {
+			if (blocks.sections[s].get(y * CHUNK_SX * CHUNK_SZ + columnIndex) != btAir)
+				return s * CHUNK_SECTION_SY + y + 1;
+		}
+	}
+	return 0;
+}
+
+void addPendingEdit(Chunk& chunk, const ChunkEdit* edit) {
+	if (edit && chunk.pendingEditCount < CHUNK_MAX_PENDING_EDITS)
+		chunk.pendingEdits[chunk.pendingEditCount++] = *edit;
+	else
+		chunk.pendingFullRemesh = true;
+}
+
+void setChunkBlock(Chunk& chunk, int x, int y, int z, BlockType type) {
+	chunk.blocks.set(x + z * CHUNK_SX + y * CHUNK_SX * CHUNK_SZ, type);
+	chunk.connectivityDirty |= 1 << (y / CHUNK_SECTION_SY);
+	int column = x + z * CHUNK_SX;
+	chunk.columns.heightmap[column] = columnSurfaceHeight(chunk.blocks, column);
+	ChunkEdit edit = { (s8)x, (u8)y, (s8)z };
+	addPendingEdit(chunk, &edit);
+}
+
+#pragma region BlockStorage
+static_assert(CHUNK_SECTION_SIZE % 64 == 0, "индексы блоков должны целиком заполнять u64");
+static_assert(CHUNK_SY % CHUNK_SECTION_SY == 0, "чанк должен состоять из целого числа секций");
+
+void BlockStorage::init(BlockType fill) {
+	release();
+	palette[0] = fill;
+	paletteSize = 1;
+}
+
+void BlockStorage::release() {
+	free(indices);
+	indices = NULL;
+	bitsPerIndex = 0;
+	paletteSize = 0;
+}
+
+BlockType BlockStorage::get(int index) const {
+	if (bitsPerIndex == 0)
+		return palette[0];
+	u32 bit = (u32)index * bitsPerIndex;
+	u64 mask = ((u64)1 << bitsPerIndex) - 1;
+	return palette[(indices[bit >> 6] >> (bit & 63)) & mask];
+}
+
+void BlockStorage::set(int index, BlockType type) {
+	int paletteIndex = 0;
+	while (paletteIndex < paletteSize && palette[paletteIndex] != type)
+		paletteIndex++;
+	if (paletteIndex == paletteSize) {
+		// нового типа нет в палитре. Неиспользуемые записи палитры не удаляются до следующего pack
+		palette[paletteSize++] = type;
+		if (paletteSize > (1 << bitsPerIndex))
+			setBitsPerIndex(bitsPerIndex == 0 ? 1 : bitsPerIndex * 2);
+	}
+	if (bitsPerIndex == 0)
+		return;
+
+	u32 bit = (u32)index * bitsPerIndex;
+	u64 mask = ((u64)1 << bitsPerIndex) - 1;
+	u64& word = indices[bit >> 6];
+	word = (word & ~(mask << (bit & 63))) | ((u64)paletteIndex << (bit & 63));
+}
+
+// сменить ширину индекса, сохранив блоки
+void BlockStorage::setBitsPerIndex(u8 bits) {
+	u64* newIndices = NULL;
+	if (bits > 0) {
+		newIndices = (u64*)calloc(CHUNK_SECTION_SIZE * bits / 64, sizeof(u64));
+		if (bitsPerIndex > 0) {
+			u64 oldMask = ((u64)1 << bitsPerIndex) - 1;
+			for (u32 i = 0; i < CHUNK_SECTION_SIZE; i++) {
+				u32 oldBit = i * bitsPerIndex;
+				u64 paletteIndex = (indices[oldBit >> 6] >> (oldBit & 63)) & oldMask;
+				u32 bit = i * bits;
+				newIndices[bit >> 6] |= paletteIndex << (bit & 63);
+			}
+		}
+	}
+	free(indices);
+	indices = newIndices;
+	bitsPerIndex = bits;
+}
+
+void BlockStorage::unpack(BlockType* out) const {
+	if (bitsPerIndex == 0) {
+		for (int i = 0; i < CHUNK_SECTION_SIZE; i++)
+			out[i] = palette[0];
+		return;
+	}
+	int perWord = 64 / bitsPerIndex;
+	u64 mask = ((u64)1 << bitsPerIndex) - 1;
+	int wordCount = CHUNK_SECTION_SIZE / perWord;
+	for (int w = 0; w < wordCount; w++) {
+		u64 word = indices[w];
+		for (int i = 0; i < perWord; i++) {
+			*out++ = palette[word & mask];
+			word >>= bitsPerIndex;
+		}
+	}
+}
+
+void BlockStorage::pack(const Block* blocks) {
+	int paletteIndices[btCOUNT];
+	for (int t = 0; t < btCOUNT; t++)
+		paletteIndices[t] = -1;
+	paletteSize = 0;
+	for (int i = 0; i < CHUNK_SECTION_SIZE; i++) {
+		BlockType type = blocks[i].type;
+		if (paletteIndices[type] == -1) {
+			paletteIndices[type] = paletteSize;
+			palette[paletteSize++] = type;
+		}
+	}
+
+	u8 bits = 0;
+	while ((1 << bits) < paletteSize)
+		bits = bits == 0 ? 1 : bits * 2;
+	if (bits != bitsPerIndex) {
+		free(indices);
+		indices = bits > 0 ? (u64*)malloc(CHUNK_SECTION_SIZE * bits / 64 * sizeof(u64)) : NULL;
+		bitsPerIndex = bits;
+	}
+	if (bits == 0)
+		return;
+
+	int perWord = 64 / bits;
+	int wordCount = CHUNK_SECTION_SIZE / perWord;
+	for (int w = 0; w < wordCount; w++) {
+		u64 word = 0;
+		for (int i = perWord - 1; i >= 0; i--)
+			word = (word << bits) | (u64)paletteIndices[blocks[w * perWord + i].type];
+		indices[w] = word;
+	}
+}
+
+// память под блоки секции, байт
+size_t BlockStorage::memoryUsage() const {
+	return sizeof(BlockStorage) + (size_t)CHUNK_SECTION_SIZE * bitsPerIndex / 8;
+}
+#pragma endregion
+
+#pragma region ChunkBlocks
+void ChunkBlocks::init(BlockType fill) {
+	for (int s = 0; s < CHUNK_SECTIONS; s++)
+		sections[s].init(fill);
+}
+
+void ChunkBlocks::release() {
+	for (int s = 0; s < CHUNK_SECTIONS; s++)
+		sections[s].release();
+}
+
+void ChunkBlocks::unpack(BlockType* out) const {
+	for (int s = 0; s < CHUNK_SECTIONS; s++)
+		sections[s].unpack(out + s * CHUNK_SECTION_SIZE);
+}
+
+void ChunkBlocks::pack(const Block* blocks) {
+	for (int s = 0; s < CHUNK_SECTIONS; s++)
+		sections[s].pack(blocks + s * CHUNK_SECTION_SIZE);
+}
+
+// память под блоки чанка, байт
+size_t ChunkBlocks::memoryUsage() const {
+	size_t size = 0;
+	for (int s = 0; s < CHUNK_SECTIONS; s++)
+		size += sections[s].memoryUsage();
+	return size;
+}
+#pragma endregion
+
+static TextureID blockTextureID(BlockType blockType) {
+	switch (blockType)
+	{
+	case btGround:	return tidGround;
+	case btStone:	return tidStone;
+	case btSnow:	return tidSnow;
+	case btIronOre:	return tidIronOre;
+	default:		return tidGround;
+	}
+}
+
+// грань на границе чанка скрыта, если блок соседнего чанка напротив нее непрозрачный
+static bool borderFaceHidden(const ChunkBorders* borders, ChunkNeighbor neighbor, int x, int y, int z) {
+	if (!borders || !borders->present[neighbor])
+		return false;
+
+	int slabIndex;
+	if (neighbor == neighborXNeg || neighbor == neighborXPos)
+		slabIndex = y * CHUNK_SZ + z;
+	else
+		slabIndex = y * CHUNK_SX + x;
+
+	return borders->slabs[neighbor][slabIndex] != btAir;
+}
+
+// распакованные блоки строящегося меша, у каждого потока свои
+static thread_local BlockType meshBlocks[CHUNK_SIZE];
+
+// грани строятся во временный буфер потока, в меш чанка копируется результат точного размера
+static thread_local BlockFaceInstance* meshScratchFaces = NULL;
+static thread_local u32 meshScratchSize = 0;
+
+// во временном буфере должно быть место хотя бы под count граней
+static BlockFaceInstance* reserveScratchFaces(u32 count) {
+	if (count > meshScratchSize) {
+		meshScratchSize = std::max(count, meshScratchSize + meshScratchSize / 2);
+		meshScratchFaces = (BlockFaceInstance*)realloc(meshScratchFaces, meshScratchSize * sizeof(BlockFaceInstance));
+	}
+	return meshScratchFaces;
+}
+
+// верхняя оценка числа граней секции: каждая внутренняя грань разделяет непрозрачный блок и воздух,
+// остальные лежат на границе секции
+static u32 sectionFaceBound(const BlockType* sectionBlocks) {
+	u32 solid = 0;
+	for (int i = 0; i < CHUNK_SECTION_SIZE; i++)
+		solid += sectionBlocks[i] != btAir;
+	u32 air = CHUNK_SECTION_SIZE - solid;
+	u32 borderFaces = 2 * (CHUNK_SX * CHUNK_SZ + CHUNK_SX * CHUNK_SECTION_SY + CHUNK_SZ * CHUNK_SECTION_SY);
+	return 6 * std::min(solid, air) + borderFaces;
+}
+
+// заливка воздуха ячейки секции: для каждой связной области воздуха все пары сторон, которых она касается, связаны
+static u16 computeCellConnectivity(const BlockType* sectionBlocks, int cellX, int cellY, int cellZ) {
+	const int cellSize = CONNECTIVITY_CELL * CONNECTIVITY_CELL * CONNECTIVITY_CELL;
+	const int layerStride = CHUNK_SX * CHUNK_SZ;
+	// индексы внутри ячейки: (y * CELL + z) * CELL + x
+	bool visited[cellSize] = {};
+	u16 stack[cellSize];
+	int baseIndex = cellY * CONNECTIVITY_CELL * layerStride + cellZ * CONNECTIVITY_CELL * CHUNK_SX + cellX * CONNECTIVITY_CELL;
+	auto isAir = [&](int i) {
+		int x = i % CONNECTIVITY_CELL, z = i / CONNECTIVITY_CELL % CONNECTIVITY_CELL, y = i / (CONNECTIVITY_CELL * CONNECTIVITY_CELL);
+		return sectionBlocks[baseIndex + y * layerStride + z * CHUNK_SX + x] == btAir;
+	};
+
+	u16 connectivity = 0;
+	for (int start = 0; start < cellSize && connectivity != SECTION_ALL_CONNECTED; start++) {
+		if (visited[start] || !isAir(start))
+			continue;
+		u8 sides = 0;
+		int stackSize = 0;
+		stack[stackSize++] = start;
+		visited[start] = true;
+		while (stackSize > 0) {
+			int i = stack[--stackSize];
+			int x = i % CONNECTIVITY_CELL;
+			int z = i / CONNECTIVITY_CELL % CONNECTIVITY_CELL;
+			int y = i / (CONNECTIVITY_CELL * CONNECTIVITY_CELL);
+			const int layer = CONNECTIVITY_CELL * CONNECTIVITY_CELL;
+			int neighbors[sideCOUNT] = { -1, -1, -1, -1, -1, -1 };
+			if (x == 0) sides |= 1 << sideXNeg; else neighbors[sideXNeg] = i - 1;
+			if (x == CONNECTIVITY_CELL - 1) sides |= 1 << sideXPos; else neighbors[sideXPos] = i + 1;
+			if (y == 0) sides |= 1 << sideYNeg; else neighbors[sideYNeg] = i - layer;
+			if (y == CONNECTIVITY_CELL - 1) sides |= 1 << sideYPos; else neighbors[sideYPos] = i + layer;
+			if (z == 0) sides |= 1 << sideZNeg; else neighbors[sideZNeg] = i - CONNECTIVITY_CELL;
+			if (z == CONNECTIVITY_CELL - 1) sides |= 1 << sideZPos; else neighbors[sideZPos] = i + CONNECTIVITY_CELL;
+			for (int n : neighbors) {
+				if (n >= 0 && !visited[n] && isAir(n)) {
+					visited[n] = true;
+					stack[stackSize++] = (u16)n;
+				}
+			}
+		}
+		for (int a = 0; a < sideCOUNT; a++)
+			for (int b = a + 1; b < sideCOUNT; b++)
+				if ((sides & (1 << a)) && (sides & (1 << b)))
+					connectivity |= sectionSidePairBit(a, b);
+	}
+	return connectivity;
+}
+
+// пересчитать связность ячеек измененных секций. С правками пересчитываются только ячейки измененных блоков:
+// связность ячейки зависит только от ее блоков
+static void updateSectionConnectivity(Chunk& chunk, const BlockType* blocks, const ChunkEdit* edits = NULL, int editCount = 0) {
+	u16 airSections = chunk.airSections;
+	for (int s = 0; s < CHUNK_SECTIONS; s++) {
+		if (!(chunk.connectivityDirty & (1 << s)))
+			continue;
+		const BlockStorage& section = chunk.blocks.sections[s];
+		u16* cells = chunk.cellConnectivity[s];
+		if (section.isUniform()) {
+			bool air = section.palette[0] == btAir;
+			u16 connectivity = air ? SECTION_ALL_CONNECTED : 0;
+			if (air)
+				airSections |= 1 << s;
+			else
+				airSections &= ~(1 << s);
+			for (int c = 0; c < SECTION_CELLS; c++)
+				cells[c] = connectivity;
+			continue;
+		}
+		airSections &= ~(1 << s);
+		const BlockType* sectionBlocks = blocks + s * CHUNK_SECTION_SIZE;
+		bool cellsUpdated = false;
+		for (int e = 0; e < editCount; e++) {
+			const ChunkEdit& edit = edits[e];
+			if (edit.y / CHUNK_SECTION_SY != s || edit.x < 0 || edit.x >= CHUNK_SX || edit.z < 0 || edit.z >= CHUNK_SZ)
+				continue;
+			int x = edit.x / CONNECTIVITY_CELL, y = edit.y % CHUNK_SECTION_SY / CONNECTIVITY_CELL, z = edit.z / CONNECTIVITY_CELL;
+			cells[(y * CONNECTIVITY_CELLS_Z + z) * CONNECTIVITY_CELLS_X + x] = computeCellConnectivity(sectionBlocks, x, y, z);
+			cellsUpdated = true;
+		}
+		// ячейки однородной секции тоже заполнены, у остальных ячеек связность прежняя
+		if (cellsUpdated)
+			continue;
+		for (int y = 0; y < CONNECTIVITY_CELLS_Y; y++)
+			for (int z = 0; z < CONNECTIVITY_CELLS_Z; z++)
+				for (int x = 0; x < CONNECTIVITY_CELLS_X; x++)
+					cells[(y * CONNECTIVITY_CELLS_Z + z) * CONNECTIVITY_CELLS_X + x] = computeCellConnectivity(sectionBlocks, x, y, z);
+	}
+	chunk.airSections = airSections;
+	chunk.connectivityDirty = 0;
+}
+
+void meshChunk(Chunk& chunk, const ChunkBorders* borders) {
+	chunk.blocks.unpack(meshBlocks);
+	updateSectionConnectivity(chunk, meshBlocks);
+	u32 faceCount;
+	if (meshingMode == meshingGreedy)
+		faceCount = meshChunkGreedy(chunk, meshBlocks, borders);
+	else
+		faceCount = meshChunkNaive(chunk, meshBlocks, borders);
+
+	// в меше остается ровно faceCount граней
+	BlockMesh& mesh = chunk.mesh;
+	if (faceCount != mesh.faceSize) {
+		free(mesh.faces);
+		mesh.faces = faceCount > 0 ? (BlockFaceInstance*)malloc(faceCount * sizeof(BlockFaceInstance)) : NULL;
+		mesh.faceSize = faceCount;
+	}
+	if (faceCount > 0)
+		memcpy(mesh.faces, meshScratchFaces, faceCount * sizeof(BlockFaceInstance));
+	mesh.faceCount = faceCount;
+	mesh.dirtyAll = true;
+	// координаты чанка пишутся в каждую грань: все меши рисуются из общего буфера
+	s16 chunkX = chunk.posx / CHUNK_SX;
+	s16 chunkZ = chunk.posz / CHUNK_SZ;
+	for (u32 i = 0; i < faceCount; i++) {
+		mesh.faces[i].chunkX = chunkX;
+		mesh.faces[i].chunkZ = chunkZ;
+	}
+}
+
+// секции из одного воздуха пропускаются. Грани пишутся во временный буфер потока, возвращается их число
+u32 meshChunkNaive(Chunk& chunk, const BlockType* blocks, const ChunkBorders* borders) {
 	int layerStride = CHUNK_SX * CHUNK_SZ;
 	int stride = CHUNK_SX;
-	int faceCount = 0;
-
-	BlockFaceInstance* faces = chunk.mesh.faces;
-
-	memset(faces, 0, chunk.mesh.faceSize * sizeof(BlockFaceInstance));
-
-	int blockIndex = 0;
-	Block* blocks = chunk.blocks;
-	glm::vec3 color(1, 1, 1);
-	for (size_t y = 0; y < CHUNK_SY; y++) {
-		for (size_t z = 0; z < CHUNK_SZ; z++) {
-			for (size_t x = 0; x < CHUNK_SX; x++) {
-				BlockType blockType = blocks[blockIndex].type;
-				if (blockType != btAir) {
-					TextureID texID;
-					switch (blockType)
-					{
-					case btGround:	texID = tidGround;	break;
-					case btStone:	texID = tidStone;	break;
-					case btSnow:	texID = tidSnow;	break;
-					case btIronOre:	texID = tidIronOre;	break;
-					default:	texID = tidGround;	break;
-					}
+	u32 faceCount = 0;
 
+	for (int section = 0; section < CHUNK_SECTIONS; section++) {
+		if (chunk.blocks.isSectionEmpty(section))
+			continue;
 
-					// top
-					if (y == CHUNK_SY - 1 || blocks[blockIndex + layerStride].type == btAir) {
-						faces[faceCount++] = BlockFaceInstance(blockIndex, faceYPos, texID);
-					}
+		int blockIndex = section * CHUNK_SECTION_SIZE;
+		BlockFaceInstance* faces = reserveScratchFaces(faceCount + sectionFaceBound(blocks + blockIndex));
 
-					// bottom
-					if (y == 0 || blocks[blockIndex - layerStride].type == btAir) {
-						faces[faceCount++] = BlockFaceInstance(blockIndex, faceYNeg, texID);
-					}
+		for (int y = section * CHUNK_SECTION_SY; y < (section + 1) * CHUNK_SECTION_SY; y++) {
+			for (int z = 0; z < CHUNK_SZ; z++) {
+				for (int x = 0; x < CHUNK_SX; x++) {
+					BlockType blockType = blocks[blockIndex];
+					if (blockType != btAir) {
+						TextureID texID = blockTextureID(blockType);
 
-					// front
-					if (z == 0 || blocks[blockIndex - stride].type == btAir) {
-						faces[faceCount++] = BlockFaceInstance(blockIndex, faceZPos, texID);
-					}
+						// top
+						if (y == CHUNK_SY - 1 || blocks[blockIndex + layerStride] == btAir) {
+							faces[faceCount++] = BlockFaceInstance(blockIndex, faceYPos, texID);
+						}
 
-					// back
-					if (z == CHUNK_SZ - 1 || blocks[blockIndex + stride].type == btAir) {
-						faces[faceCount++] = BlockFaceInstance(blockIndex, faceZNeg, texID);
-					}
+						// bottom
+						if (y == 0 || blocks[blockIndex - layerStride] == btAir) {
+							faces[faceCount++] = BlockFaceInstance(blockIndex, faceYNeg, texID);
+						}
+
+						// front
+						if (z == 0 ? !borderFaceHidden(borders, neighborZNeg, x, y, z) : blocks[blockIndex - stride] == btAir) {
+							faces[faceCount++] = BlockFaceInstance(blockIndex, faceZPos, texID);
+						}
+
+						// back
+						if (z == CHUNK_SZ - 1 ? !borderFaceHidden(borders, neighborZPos, x, y, z) : blocks[blockIndex + stride] == btAir) {
+							faces[faceCount++] = BlockFaceInstance(blockIndex, faceZNeg, texID);
+						}
 
-					// left
-					if (x == 0 || blocks[blockIndex - 1].type == btAir) {
-						faces[faceCount++] = BlockFaceInstance(blockIndex, faceXPos, texID);
+						// left
+						if (x == 0 ? !borderFaceHidden(borders, neighborXNeg, x, y, z) : blocks[blockIndex - 1] == btAir) {
+							faces[faceCount++] = BlockFaceInstance(blockIndex, faceXPos, texID);
+						}
+
+						// right
+						if (x == CHUNK_SX - 1 ? !borderFaceHidden(borders, neighborXPos, x, y, z) : blocks[blockIndex + 1] == btAir) {
+							faces[faceCount++] = BlockFaceInstance(blockIndex, faceXNeg, texID);
+						}
 					}
+					blockIndex++;
+				}
+			}
+		}
+	}
+
+	return faceCount;
+}
+
+// грани по осям (x, y, z): [ось][0 - сосед в отрицательную сторону, 1 - в положительную]
+static const BlockFace axisFaces[3][2] = {
+	{ faceXPos, faceXNeg },
+	{ faceYNeg, faceYPos },
+	{ faceZPos, faceZNeg },
+};
+// соседние чанки по осям, по Y соседей нет
+static const ChunkNeighbor axisNeighbors[3][2] = {
+	{ neighborXNeg, neighborXPos },
+	{ neighborCOUNT, neighborCOUNT },
+	{ neighborZNeg, neighborZPos },
+};
+static const int axisDims[3] = { CHUNK_SX, CHUNK_SECTION_SY, CHUNK_SZ };
+static const int axisStrides[3] = { 1, CHUNK_SX * CHUNK_SZ, CHUNK_SX };
+
+// грани слоя s секции по оси d в направлении dir: строим маску видимых граней и (при merge)
+// жадно объединяем одинаковые грани в прямоугольники. Без merge каждая грань 1x1, как в meshChunkNaive
+static u32 meshLayer(const BlockType* blocks, const ChunkBorders* borders, int section, int d, int dir, int s, bool merge, BlockFaceInstance* faces, u32 faceCount) {
+	constexpr int maxSide = std::max(CHUNK_SX, std::max(CHUNK_SECTION_SY, CHUNK_SZ));
+	u16 mask[maxSide * maxSide]; // TextureID + 1, 0 - грани нет
 
-					// right
-					if (x == CHUNK_SX - 1 || blocks[blockIndex + 1].type == btAir) {
-						faces[faceCount++] = BlockFaceInstance(blockIndex, faceXNeg, texID);
+	int u = (d + 1) % 3;
+	int v = (d + 2) % 3;
+	int du = axisDims[u], dv = axisDims[v];
+	int sectionStart = section * CHUNK_SECTION_SIZE;
+	BlockFace face = axisFaces[d][dir];
+	int neighborShift = dir ? axisStrides[d] : -axisStrides[d];
+
+	bool onBorder = dir ? (s == axisDims[d] - 1) : (s == 0);
+	// по Y граница секции - граница чанка только у крайних секций
+	if (d == 1 && onBorder && (dir ? section < CHUNK_SECTIONS - 1 : section > 0))
+		onBorder = false;
+
+	// маска видимых граней в слое
+	for (int j = 0; j < dv; j++) {
+		for (int i = 0; i < du; i++) {
+			int blockIndex = sectionStart + s * axisStrides[d] + i * axisStrides[u] + j * axisStrides[v];
+			BlockType blockType = blocks[blockIndex];
+			u16 m = 0;
+			if (blockType != btAir) {
+				bool visible;
+				if (onBorder) {
+					ChunkNeighbor neighbor = axisNeighbors[d][dir];
+					visible = neighbor == neighborCOUNT || !borderFaceHidden(borders, neighbor,
+						blockIndex % CHUNK_SX, blockIndex / (CHUNK_SX * CHUNK_SZ), blockIndex / CHUNK_SX % CHUNK_SZ);
+				}
+				else
+					visible = blocks[blockIndex + neighborShift] == btAir;
+
+				if (visible)
+					m = blockTextureID(blockType) + 1;
+			}
+			mask[i + j * du] = m;
+		}
+	}
+
+	// объединение граней в прямоугольники
+	for (int j = 0; j < dv; j++) {
+		for (int i = 0; i < du;) {
+			u16 m = mask[i + j * du];
+			if (m == 0) {
+				i++;
+				continue;
+			}
+
+			int w = 1, h = 1;
+			if (merge) {
+				while (i + w < du && mask[i + w + j * du] == m)
+					w++;
+
+				for (; j + h < dv; h++) {
+					bool rowMatches = true;
+					for (int k = 0; k < w; k++) {
+						if (mask[i + k + (j + h) * du] != m) {
+							rowMatches = false;
+							break;
+						}
 					}
+					if (!rowMatches)
+						break;
 				}
-				blockIndex++;
+
+				for (int l = 0; l < h; l++)
+					for (int k = 0; k < w; k++)
+						mask[i + k + (j + l) * du] = 0;
 			}
+
+			int extent[3];
+			extent[d] = 1;
+			extent[u] = w;
+			extent[v] = h;
+
+			// размеры в локальных осях полигона (см. block.vert)
+			u8 sizeX, sizeY;
+			switch (face) {
+			case faceYPos:	sizeX = extent[2]; sizeY = extent[0]; break;
+			case faceYNeg:	sizeX = extent[0]; sizeY = extent[2]; break;
+			case faceXPos:	sizeX = extent[2]; sizeY = extent[1]; break;
+			case faceXNeg:	sizeX = extent[1]; sizeY = extent[2]; break;
+			case faceZPos:	sizeX = extent[1]; sizeY = extent[0]; break;
+			default:		sizeX = extent[0]; sizeY = extent[1]; break;
+			}
+
+			int blockIndex = sectionStart + s * axisStrides[d] + i * axisStrides[u] + j * axisStrides[v];
+			faces[faceCount++] = BlockFaceInstance(blockIndex, face, (TextureID)(m - 1), sizeX, sizeY);
+			i += w;
 		}
 	}
+	return faceCount;
+}
+
+// greedy meshing: для каждой секции и каждого направления грани проходим по слоям секции,
+// строим маску видимых граней и жадно объединяем одинаковые грани в прямоугольники.
+// Грани не объединяются через границу секций, секции из одного воздуха пропускаются
+u32 meshChunkGreedy(Chunk& chunk, const BlockType* blocks, const ChunkBorders* borders) {
+	u32 faceCount = 0;
+	for (int section = 0; section < CHUNK_SECTIONS; section++) {
+		if (chunk.blocks.isSectionEmpty(section))
+			continue;
+
+		BlockFaceInstance* faces = reserveScratchFaces(faceCount + sectionFaceBound(blocks + section * CHUNK_SECTION_SIZE));
+		for (int d = 0; d < 3; d++)
+			for (int dir = 0; dir < 2; dir++)
+				for (int s = 0; s < axisDims[d]; s++)
+					faceCount = meshLayer(blocks, borders, section, d, dir, s, true, faces, faceCount);
+	}
+	return faceCount;
+}
+
+// группа граней для частичного перестроения: слой s секции по оси d в направлении dir
+static int faceLayerGroup(int section, int d, int dir, int s) {
+	return ((section * 3 + d) * 2 + dir) * CHUNK_SECTION_SY + s;
+}
 
-	chunk.mesh.faceCount = faceCount;
+static int faceLayerGroup(const BlockFaceInstance& face) {
+	int x = face.pos % CHUNK_SX;
+	int z = face.pos / CHUNK_SX % CHUNK_SZ;
+	int y = face.pos / (CHUNK_SX * CHUNK_SZ);
+	int section = y / CHUNK_SECTION_SY;
+	int local[3] = { x, y % CHUNK_SECTION_SY, z };
+	int d = face.face == faceXPos || face.face == faceXNeg ? 0 : (face.face == faceYPos || face.face == faceYNeg ? 1 : 2);
+	int dir = face.face == axisFaces[d][1];
+	return faceLayerGroup(section, d, dir, local[d]);
+}
+
+#define FACE_LAYER_GROUPS (CHUNK_SECTIONS * 3 * 2 * CHUNK_SECTION_SY)
+static_assert(CHUNK_SX == CHUNK_SECTION_SY && CHUNK_SZ == CHUNK_SECTION_SY, "faceLayerGroup: слоев по каждой оси столько же, сколько в секции по Y");
+
+void patchChunkMesh(Chunk& chunk, const ChunkEdit* edits, int editCount, const ChunkBorders* borders) {
+	// слои, в которых могли измениться грани: слой блока по каждой оси в обе стороны
+	// и слои соседей по оси, смотрящие на блок. Блок соседнего чанка (x или z за границей)
+	// меняет только грани нашего граничного слоя
+	u64 groups[FACE_LAYER_GROUPS / 64] = {};
+	u16 sections = chunk.connectivityDirty; // нужные для перестроения секции, распаковываются только они
+	struct Layer { u8 section, d, dir, s; };
+	Layer layers[CHUNK_MAX_PENDING_EDITS * 12];
+	int layerCount = 0;
+	auto addLayer = [&](int section, int d, int dir, int s) {
+		int group = faceLayerGroup(section, d, dir, s);
+		if (groups[group / 64] & (1ull << (group % 64)))
+			return;
+		groups[group / 64] |= 1ull << (group % 64);
+		layers[layerCount++] = { (u8)section, (u8)d, (u8)dir, (u8)s };
+		for (int n = std::max(section - 1, 0); n <= std::min(section + 1, CHUNK_SECTIONS - 1); n++)
+			sections |= 1 << n;
+	};
+	const int chunkDims[3] = { CHUNK_SX, CHUNK_SY, CHUNK_SZ };
+	for (int e = 0; e < editCount; e++) {
+		int pos[3] = { edits[e].x, edits[e].y, edits[e].z };
+		for (int d = 0; d < 3; d++) {
+			bool inside = true;
+			for (int k = 0; k < 3; k++)
+				if (k != d && (pos[k] < 0 || pos[k] >= chunkDims[k]))
+					inside = false;
+			if (!inside)
+				continue;
+			// (смещение слоя, направление): грани самого блока и грани соседей, обращенные к нему
+			const int offsets[4][2] = { { 0, 0 }, { 0, 1 }, { -1, 1 }, { 1, 0 } };
+			for (auto& o : offsets) {
+				int layer = pos[d] + o[0];
+				if (layer < 0 || layer >= chunkDims[d])
+					continue;
+				int section = (d == 1 ? layer : pos[1]) / CHUNK_SECTION_SY;
+				int s = d == 1 ? layer % CHUNK_SECTION_SY : layer;
+				addLayer(section, d, o[1], s);
+			}
+		}
+	}
+
+	for (int n = 0; n < CHUNK_SECTIONS; n++)
+		if (sections & (1 << n))
+			chunk.blocks.sections[n].unpack(meshBlocks + n * CHUNK_SECTION_SIZE);
+	updateSectionConnectivity(chunk, meshBlocks, edits, editCount);
+
+	bool merge = meshingMode == meshingGreedy;
+	u32 newCount = 0;
+	for (int l = 0; l < layerCount; l++) {
+		const Layer& layer = layers[l];
+		BlockFaceInstance* faces = reserveScratchFaces(newCount + CHUNK_SECTION_SY * CHUNK_SECTION_SY);
+		newCount = meshLayer(meshBlocks, borders, layer.section, layer.d, layer.dir, layer.s, merge, faces, newCount);
+	}
+
+	// старые грани этих слоев заменяются новыми на тех же местах, лишние новые дописываются в конец,
+	// оставшиеся дыры закрываются гранями с конца. Меняются только отмеченные участки меша
+	BlockMesh& mesh = chunk.mesh;
+	s16 chunkX = chunk.posx / CHUNK_SX;
+	s16 chunkZ = chunk.posz / CHUNK_SZ;
+	for (u32 i = 0; i < newCount; i++) {
+		meshScratchFaces[i].chunkX = chunkX;
+		meshScratchFaces[i].chunkZ = chunkZ;
+	}
+
+	u32 next = 0;
+	u32 hole = 0;
+	u32 faceCount = mesh.faceCount;
+	for (; hole < faceCount; hole++) {
+		int group = faceLayerGroup(mesh.faces[hole]);
+		if (!(groups[group / 64] & (1ull << (group % 64))))
+			continue;
+		if (next == newCount)
+			break;
+		mesh.faces[hole] = meshScratchFaces[next++];
+		mesh.markDirty(hole, hole + 1);
+	}
+
+	if (next < newCount) {
+		// все старые грани заменены
+		u32 count = faceCount + newCount - next;
+		if (count > mesh.faceSize) {
+			mesh.faceSize = count;
+			mesh.faces = (BlockFaceInstance*)realloc(mesh.faces, count * sizeof(BlockFaceInstance));
+		}
+		memcpy(mesh.faces + faceCount, meshScratchFaces + next, (newCount - next) * sizeof(BlockFaceInstance));
+		mesh.markDirty(faceCount, count);
+		faceCount = count;
+	}
+	else {
+		// дыры с hole до конца: грань с конца переносится в дыру, если сама не из удаляемых
+		for (u32 i = hole; i < faceCount;) {
+			int group = faceLayerGroup(mesh.faces[i]);
+			if (!(groups[group / 64] & (1ull << (group % 64)))) {
+				i++;
+				continue;
+			}
+			faceCount--;
+			int lastGroup;
+			while (faceCount > i && (lastGroup = faceLayerGroup(mesh.faces[faceCount]), groups[lastGroup / 64] & (1ull << (lastGroup % 64))))
+				faceCount--;
+			if (faceCount > i) {
+				mesh.faces[i] = mesh.faces[faceCount];
+				mesh.markDirty(i, i + 1);
+				i++;
+			}
+		}
+		if (faceCount == 0) {
+			free(mesh.faces);
+			mesh.faces = NULL;
+			mesh.faceSize = 0;
+		}
+		else if (faceCount < mesh.faceSize / 2) {
+			mesh.faces = (BlockFaceInstance*)realloc(mesh.faces, faceCount * sizeof(BlockFaceInstance));
+			mesh.faceSize = faceCount;
+		}
+	}
+	mesh.faceCount = faceCount;
 }
 #endif // CHUNK_IMPL
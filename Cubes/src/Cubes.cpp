@@ -12,6 +12,7 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 #include <imgui_stdlib.h>
+#include <assert.h>
 #pragma endregion
 #pragma region internal dependencies
 #define CHUNK_IMPL
@@ -25,12 +26,17 @@
 #include "DataStructures.h"
 #include "Chunk.h"
 #include "World.h"
+#include "NoiseBatch.h"
+#include "Frustum.h"
+#include "Occlusion.h"
 #pragma endregion
 
-//  
+// количество слотов чанков. В круглом радиусе загрузки углов квадрата нет: чанков на ~20% меньше.
+// Слоты выделены на MAX_LOAD_RADIUS, радиус загрузки (renderDistance) меняется на ходу в этих пределах.
+// Сверх радиуса есть слоты для упреждающей генерации
 int renderDistance = 12;
-int chunksSide = renderDistance * 2 + 1;
-int chunksCount = chunksSide * chunksSide;
+bool circularLoadRadius = true;
+int chunksCount = getChunksCount(MAX_LOAD_RADIUS, circularLoadRadius) + CHUNK_PREFETCH_MAX;
 
 float near_plane = 1.0f, far_plane = 500.0f;
 float projDim = 64.0f;
@@ -40,9 +46,9 @@ GameWorld gameWorld;
 Display display;
 Player player;
 
-static float lastX = 400, lastY = 300; //  
+static float lastX = 400, lastY = 300; // позиция курсора
 static float yaw = 0, pitch = 0;
-static bool cursorMode = false; // TRUE    UI, FALSE   
+static bool cursorMode = false; // TRUE для взаимодействия с UI, FALSE для перемещения камеры
 
 static DynamicArray<Entity> entities;
 
@@ -169,11 +175,11 @@ Chunk* chunks = 0;
 
 #define ENABLE_LIGHTING 0
 void updateLighting(Chunk& chunk) {
-	static float brightnessDelta = 1.0f / 6.0f * 0.3; //   1  
+	static float brightnessDelta = 1.0f / 6.0f * 0.3; // затемнение за 1 блок поблизости
 	int layerStride = CHUNK_SX * CHUNK_SZ;
 	int stride = CHUNK_SX;
-	Block* blocks = chunk.blocks;
 #if ENABLE_LIGHTING
+	Block* blocks = chunk.blocks;
 
 	for (size_t i = 0; i < CHUNK_SIZE; i++) {
 		if (blocks[i].type != btAir) {
@@ -217,42 +223,1241 @@ struct ChunkGenTask {
 	int posx;
 	int posz;
 	int index;
+	bool onlyMesh; // только перестроить меш (например, после генерации соседнего чанка)
+	bool urgent; // перестроение после правки игрока: выполняется раньше генерации
+	bool prefetch; // чанк за радиусом загрузки, генерируется заранее: выполняется после всех остальных
+	u32 version; // версия чанка на момент отправки задачи
+	bool inView; // чанк был перед камерой при последнем пересчете приоритета
+	float priority; // больше - важнее
+	double submitTime;
+	u8 noise3DStep; // шаг решетки 3D шума на момент отправки
+	NoiseSimdLevel simdLevel; // версия пакетного шума на момент отправки
 };
-struct WorkingThread {
-	HANDLE handle;
-	int threadID;
+JobSystem jobSystem;
+RegionStorage regionStorage;
+
+// ожидающие задачи хранятся в куче по приоритету: задача берется не в момент отправки, а в момент выполнения,
+// поэтому рабочий поток всегда выполняет самую важную из оставшихся задач
+#define CHUNK_GEN_TASKS_MAX (1 << 14)
+ChunkGenTask chunkGenTasks[CHUNK_GEN_TASKS_MAX];
+int chunkGenTaskCount = 0;
+// задачи, не поместившиеся в кучу даже после удаления устаревших: отправляются в следующих кадрах
+static DynamicArray<ChunkGenTask> chunkGenDeferred = {};
+static int chunkGenPruned = 0, chunkGenDeferredTotal = 0;
+std::mutex chunkGenTasksMutex;
+std::atomic<int> chunkGenSubmitted(0);
+std::atomic<int> chunkGenCompleted(0);
+std::atomic<int> chunkGenSkipped(0); // устаревшие задачи, отброшенные до начала работы
+std::atomic<int> chunkGenWasted(0); // устаревшие задачи, результат которых был отброшен после генерации
+std::atomic<u64> chunkGenWastedUS(0);
+static int remeshCoalesced = 0; // запросы перестроения, слитые с уже ожидающей задачей
+// перестроение меша после правок на рабочих потоках: частичное (patchChunkMesh) и полное
+std::atomic<int> remeshPatchCount(0), remeshFullCount(0);
+std::atomic<u64> remeshPatchUS(0), remeshFullUS(0);
+std::atomic<u64> remeshPatchBytes(0), remeshFullBytes(0); // граней к отправке на ГПУ
+static thread_local Block* chunkGenScratch = NULL;
+static thread_local ChunkColumns chunkGenScratchColumns;
+
+// положение камеры на момент последнего пересчета приоритетов
+glm::vec3 chunkGenViewPos(0, 0, 0);
+glm::vec3 chunkGenViewFront(0, 0, -1);
+
+// чанки с опубликованным мешем: рабочий поток кладет индекс чанка, основной поток отправляет меши на ГПУ (uploadReadyMeshes)
+static BoundedQueue<int> meshReadyQueue;
+static std::atomic<bool> meshReadyOverflow(false); // очередь была заполнена: основной поток проверит флаги всех чанков
+
+// среднее время от отправки до готовности меша для чанков перед камерой (задержка появления)
+std::atomic<int> chunkGenInViewCount(0);
+std::atomic<u64> chunkGenInViewLatencyUS(0);
+
+static bool chunkGenTaskLess(const ChunkGenTask& a, const ChunkGenTask& b) {
+	return a.priority < b.priority;
+}
+
+static void setChunkGenPriority(ChunkGenTask& task) {
+	glm::vec2 toChunk(task.posx + CHUNK_SX * 0.5f - chunkGenViewPos.x, task.posz + CHUNK_SZ * 0.5f - chunkGenViewPos.z);
+	glm::vec2 front(chunkGenViewFront.x, chunkGenViewFront.z);
+	float dist = glm::length(toChunk);
+	float frontLen = glm::length(front);
+	// косинус угла между направлением взгляда и направлением на чанк (по горизонтали)
+	float cosAngle = (dist > 0.001f && frontLen > 0.001f) ? glm::dot(toChunk, front) / (dist * frontLen) : 1.0f;
+
+	task.inView = cosAngle > 0.5f || dist < CHUNK_SX;
+	// чанки позади камеры считаются втрое дальше; чанки без меша важнее перестроения уже видимых
+	float cost = dist * (2.0f - cosAngle);
+	if (task.onlyMesh)
+		cost += CHUNK_SX;
+	if (task.urgent)
+		cost -= 1e6f;
+	if (task.prefetch)
+		cost += 1e5f;
+	task.priority = -cost;
+}
+
+// пересчитать приоритеты ожидающих задач после перемещения или поворота камеры
+void updateChunkGenPriorities(glm::vec3 viewPos, glm::vec3 viewFront) {
+	std::lock_guard<std::mutex> lock(chunkGenTasksMutex);
+	if (viewPos == chunkGenViewPos && viewFront == chunkGenViewFront)
+		return;
+	chunkGenViewPos = viewPos;
+	chunkGenViewFront = viewFront;
+	for (int i = 0; i < chunkGenTaskCount; i++)
+		setChunkGenPriority(chunkGenTasks[i]);
+	std::make_heap(chunkGenTasks, chunkGenTasks + chunkGenTaskCount, chunkGenTaskLess);
+}
+
+void chunkGenJob(void* data) {
+	// на каждую отправленную задачу приходится одна работа, но устаревшие задачи могли быть удалены
+	// из переполненной кучи (submitChunkGenTask): тогда работе нечего делать
+	ChunkGenTask taskCopy;
+	{
+		std::lock_guard<std::mutex> lock(chunkGenTasksMutex);
+		if (chunkGenTaskCount == 0) {
+			chunkGenCompleted++;
+			return;
+		}
+		std::pop_heap(chunkGenTasks, chunkGenTasks + chunkGenTaskCount, chunkGenTaskLess);
+		taskCopy = chunkGenTasks[--chunkGenTaskCount];
+	}
+	ChunkGenTask* task = &taskCopy;
+	Chunk& chunk = gameWorld.chunks[task->index];
+
+	// чанк уже перенесен на другую позицию (игрок ушел дальше): задача устарела, отменяем не начиная
+	if (chunk.version.load(std::memory_order_acquire) != task->version) {
+		chunkGenSkipped++;
+		chunkGenCompleted++;
+		return;
+	}
+	// правки, сделанные после этого момента, поставят новую задачу; сделанные до - будут прочитаны под блокировкой ниже
+	if (task->onlyMesh)
+		chunk.remeshQueued.store(false);
+	dbgprint("chunk (%d, %d)\n", task->posx, task->posz);
+
+	// блоки генерируются во временный буфер потока без блокировки чанка. Сохраненный чанк читается из файла региона
+	double startTime = glfwGetTime();
+	if (!task->onlyMesh) {
+		if (!chunkGenScratch)
+			chunkGenScratch = new Block[CHUNK_SIZE];
+		if (!gameWorld.storage || !gameWorld.storage->loadChunk(task->posx, task->posz, chunkGenScratch, &chunkGenScratchColumns))
+			gameWorld.generateChunkBlocks(chunkGenScratch, &chunkGenScratchColumns, task->posx, task->posz, task->noise3DStep, task->simdLevel);
+	}
+
+	// границы соседей собираются до блокировки чанка: getChunkBorders блокирует соседние чанки
+	ChunkBorders borders;
+	gameWorld.getChunkBorders(task->index, &borders);
+
+	{
+		std::lock_guard<std::mutex> lock(chunk.lock);
+		// пока шла генерация, чанк могли перенести: результат устарел, не публикуем его
+		if (chunk.version.load(std::memory_order_relaxed) != task->version || (task->onlyMesh && !chunk.generated)) {
+			chunkGenWasted++;
+			chunkGenWastedUS += (u64)((glfwGetTime() - startTime) * 1000000.0);
+			chunkGenCompleted++;
+			return;
+		}
+
+		if (!task->onlyMesh) {
+			chunk.blocks.pack(chunkGenScratch);
+			chunk.connectivityDirty = (1 << CHUNK_SECTIONS) - 1;
+			chunk.columns = chunkGenScratchColumns;
+			chunk.generated = true;
+			chunk.modified = false;
+			chunk.pendingEditCount = 0;
+			chunk.pendingFullRemesh = false;
+			// соседи заранее сгенерированного чанка перестроятся, когда он войдет в радиус загрузки
+			chunk.remeshNeighbors = !chunk.prefetched;
+			meshChunk(chunk, &borders);
+		}
+		else {
+			// правки одиночных блоков меняют только слои вокруг них
+			bool full = chunk.pendingFullRemesh;
+			int editCount = chunk.pendingEditCount;
+			chunk.pendingFullRemesh = false;
+			chunk.pendingEditCount = 0;
+			if (!full && editCount == 0) {
+				// все запросы уже выполнила предыдущая задача
+				chunkGenCompleted++;
+				return;
+			}
+			double meshStart = glfwGetTime();
+			if (full) {
+				meshChunk(chunk, &borders);
+				remeshFullUS += (u64)((glfwGetTime() - meshStart) * 1000000.0);
+				remeshFullBytes += chunk.mesh.faceCount * sizeof(BlockFaceInstance);
+				remeshFullCount++;
+			}
+			else {
+				patchChunkMesh(chunk, chunk.pendingEdits, editCount, &borders);
+				remeshPatchUS += (u64)((glfwGetTime() - meshStart) * 1000000.0);
+				remeshPatchBytes += chunk.mesh.pendingUploadFaces() * sizeof(BlockFaceInstance);
+				remeshPatchCount++;
+			}
+		}
+		chunk.mesh.needUpdate = true; // необходимо отправить новый меш на ГПУ в основоном потоке
+	}
+	if (!meshReadyQueue.push(task->index))
+		meshReadyOverflow.store(true, std::memory_order_release);
+
+	if (task->inView && !task->onlyMesh) {
+		chunkGenInViewLatencyUS += (u64)((glfwGetTime() - task->submitTime) * 1000000.0);
+		chunkGenInViewCount++;
+	}
+	chunkGenCompleted++;
+}
+
+static bool isChunkGenTaskStale(const ChunkGenTask& task) {
+	return gameWorld.chunks[task.index].version.load(std::memory_order_relaxed) != task.version;
+}
+
+// под chunkGenTasksMutex: false - в куче нет места даже после удаления устаревших задач.
+// Работы удаленных задач остаются в очереди и завершатся, не найдя задачи
+static bool pushChunkGenTask(const ChunkGenTask& task) {
+	if (chunkGenTaskCount == CHUNK_GEN_TASKS_MAX) {
+		int kept = 0;
+		for (int i = 0; i < chunkGenTaskCount; i++)
+			if (!isChunkGenTaskStale(chunkGenTasks[i]))
+				chunkGenTasks[kept++] = chunkGenTasks[i];
+		chunkGenPruned += chunkGenTaskCount - kept;
+		chunkGenSkipped += chunkGenTaskCount - kept;
+		chunkGenTaskCount = kept;
+		std::make_heap(chunkGenTasks, chunkGenTasks + chunkGenTaskCount, chunkGenTaskLess);
+		if (chunkGenTaskCount == CHUNK_GEN_TASKS_MAX)
+			return false;
+	}
+	chunkGenTasks[chunkGenTaskCount++] = task;
+	std::push_heap(chunkGenTasks, chunkGenTasks + chunkGenTaskCount, chunkGenTaskLess);
+	return true;
+}
+
+void submitChunkGenTask(int chunkIndex, int posx, int posz, bool onlyMesh, JobCounter* counter = NULL, bool urgent = false, bool prefetch = false) {
+	ChunkGenTask task;
+	task.posx = posx;
+	task.posz = posz;
+	task.index = chunkIndex;
+	task.onlyMesh = onlyMesh;
+	task.urgent = urgent;
+	task.prefetch = prefetch;
+	task.version = gameWorld.chunks[chunkIndex].version.load(std::memory_order_relaxed);
+	task.submitTime = glfwGetTime();
+	task.noise3DStep = (u8)gameWorld.noise3DStep;
+	task.simdLevel = noiseSimdLevel;
+	setChunkGenPriority(task);
+	{
+		std::lock_guard<std::mutex> lock(chunkGenTasksMutex);
+		if (!pushChunkGenTask(task)) {
+			chunkGenDeferred.append(task);
+			chunkGenDeferredTotal++;
+			return;
+		}
+	}
+	chunkGenSubmitted++;
+	jobSystem.submit(chunkGenJob, NULL, counter);
+}
+
+// отложенные задачи отправляются, когда в куче освободится место; устаревшие за время ожидания отбрасываются
+static void submitDeferredChunkGenTasks() {
+	int submitted = 0;
+	{
+		std::lock_guard<std::mutex> lock(chunkGenTasksMutex);
+		int kept = 0;
+		for (int i = 0; i < chunkGenDeferred.count; i++) {
+			ChunkGenTask& task = chunkGenDeferred.items[i];
+			if (isChunkGenTaskStale(task))
+				continue;
+			if (pushChunkGenTask(task))
+				submitted++;
+			else
+				chunkGenDeferred.items[kept++] = task;
+		}
+		chunkGenDeferred.count = kept;
+	}
+	for (int i = 0; i < submitted; i++) {
+		chunkGenSubmitted++;
+		jobSystem.submit(chunkGenJob, NULL);
+	}
+}
+
+// отрисовка чанков: свои списки мешей для теней и основного прохода
+static BlockDrawList chunkDrawList, shadowDrawList;
+static int lastDrawCallsShadow = 0, lastDrawCallsMain = 0;
+static float lastSubmitShadowUS = 0, lastSubmitMainUS = 0; // время ЦП на отправку команд
+
+// отсечение чанков по пирамиде видимости
+static bool frustumCulling = true;
+static FrustumBoxes chunkBoxes;
+static u8* chunkVisible = NULL, * chunkShadowVisible = NULL;
+static int lastVisibleMain = 0, lastVisibleShadow = 0, lastCullCandidates = 0;
+static float lastCullUS = 0;
+
+// отсечение по графу связности ячеек: под землей не рисуются чанки, до которых не дойти по воздуху.
+// Обход повторяется, только когда камера переходит в другую ячейку или меняется связность чанков
+static bool connectivityCulling = true;
+static u8* chunkReached = NULL;
+static bool chunkReachedValid = false;
+static u32 connectivityVersion = 0, reachedVersion = 0; // меняется при отправке меша или перемещении чанка
+static glm::ivec3 reachedCameraCell;
+static int lastConnectivitySkipped = 0, maxConnectivitySkipped = 0;
+static float lastConnectivityUS = 0;
+
+// отсечение чанков, закрытых другими чанками. Буфер глубины растеризуется задачей, пока рисуются тени
+static bool occlusionCulling = true;
+static int maxOccluders = 512;
+static OcclusionBuffer occlusionBuffer;
+static const ChunkOccluders** occlusionChunks = NULL; // чанки в пирамиде, чьи грани растеризуются
+static int occlusionChunkCount = 0;
+static glm::mat4 occlusionViewProjection;
+static glm::vec3 occlusionCameraPos;
+enum OcclusionJobState {
+	occlusionIdle,
+	occlusionQueued,
+	occlusionRunning,
+	occlusionDone
 };
-WorkQueue chunkGenQueue(CHUNK_SIZE);
-ChunkGenTask chunkGenTasks[CHUNK_SIZE];
-WorkingThread* chunkGenThreads = 0;
+static std::atomic<int> occlusionJobState(occlusionIdle);
+static float lastOcclusionRasterUS = 0;
+static int lastOccludedMain = 0;
+static OcclusionSelfTest lastOcclusionSelfTest;
+static bool occlusionSelfTestDone = false;
+
+// меш на ГПУ рисуется и пока новый (после правки или генерации соседа) ждет отправки
+static bool isChunkDrawable(const Chunk& chunk) {
+	return chunk.generated && !chunk.prefetched && chunk.mesh.gpuFaceCount > 0;
+}
 
+// AABB чанков каждый кадр (позиции чанков меняются при перемещении). У готовых чанков - граница граней меша
+static void updateChunkBoxes() {
+	int oldCapacity = chunkBoxes.capacity;
+	chunkBoxes.resize(chunksCount);
+	if (chunkBoxes.capacity != oldCapacity) {
+		chunkVisible = (u8*)realloc(chunkVisible, chunkBoxes.capacity);
+		chunkShadowVisible = (u8*)realloc(chunkShadowVisible, chunkBoxes.capacity);
+		chunkReached = (u8*)realloc(chunkReached, chunkBoxes.capacity);
+		chunkReachedValid = false;
+		occlusionChunks = (const ChunkOccluders**)realloc(occlusionChunks, chunkBoxes.capacity * sizeof(ChunkOccluders*));
+	}
+	for (size_t c = 0; c < chunksCount; c++) {
+		if (isChunkDrawable(chunks[c])) {
+			chunkBoxes.set(c, chunks[c].occluders.bounds.min, chunks[c].occluders.bounds.max);
+		}
+		else {
+			glm::vec3 min(chunks[c].posx, 0, chunks[c].posz);
+			chunkBoxes.set(c, min, min + glm::vec3(CHUNK_SX, CHUNK_SY, CHUNK_SZ));
+		}
+	}
+}
 
-DWORD chunkGenThreadProc(WorkingThread* args) {
-	for (;;) {
-		QueueTaskItem queueItem = chunkGenQueue.getNextTask();
-		if (queueItem.valid) {
-			ChunkGenTask* task = &chunkGenTasks[queueItem.taskIndex];
-			dbgprint("chunk (%d, %d)\n", task->posx, task->posz);
-			
-			gameWorld.generateChunk(task->index, task->posx, task->posz);
-			meshChunk(gameWorld.chunks[task->index]);
-			gameWorld.chunks[task->index].mesh.needUpdate = true; //         
+static void cullChunks(const glm::mat4& viewProjection, u8* visible) {
+	double cullStart = glfwGetTime();
+	if (frustumCulling)
+		frustumCullBoxes(frustumFromMatrix(viewProjection), chunkBoxes, visible);
+	else
+		memset(visible, 1, chunksCount);
+	lastCullUS += (float)((glfwGetTime() - cullStart) * 1000000.0);
+}
 
-			chunkGenQueue.setTaskCompleted();
+// из видимых в пирамиде чанков убираются недостижимые от камеры по воздуху
+static void cullChunksByConnectivity(glm::vec3 cameraPos) {
+	double start = glfwGetTime();
+	lastConnectivitySkipped = 0;
+	glm::ivec3 cameraCell = glm::ivec3(glm::floor(cameraPos / (float)CONNECTIVITY_CELL));
+	if (!chunkReachedValid || cameraCell != reachedCameraCell || connectivityVersion != reachedVersion) {
+		chunkReachedValid = gameWorld.findReachableChunks(cameraPos, chunkReached);
+		reachedCameraCell = cameraCell;
+		reachedVersion = connectivityVersion;
+	}
+	if (chunkReachedValid) {
+		for (size_t c = 0; c < chunksCount; c++) {
+			if (chunkVisible[c] && !chunkReached[c]) {
+				chunkVisible[c] = 0;
+				lastConnectivitySkipped += isChunkDrawable(chunks[c]);
+			}
+		}
+	}
+	maxConnectivitySkipped = std::max(maxConnectivitySkipped, lastConnectivitySkipped);
+	lastConnectivityUS = (float)((glfwGetTime() - start) * 1000000.0);
+}
+
+// в список попадают готовые чанки, отмеченные в visible и не закрытые в occlusion (если задан). Возвращает число видимых
+static int buildChunkDrawList(BlockDrawList& list, const u8* visible, const OcclusionBuffer* occlusion, int* occludedCount) {
+	list.clear();
+	int visibleCount = 0;
+	int occluded = 0;
+	for (size_t c = 0; c < chunksCount; c++) {
+		Chunk& chunk = chunks[c];
+		if (!isChunkDrawable(chunk) || !visible[c])
+			continue;
+		if (occlusion && !occlusion->isVisible(chunk.occluders.bounds)) {
+			occluded++;
+			continue;
+		}
+		list.add(chunk.mesh);
+		visibleCount++;
+	}
+	if (occludedCount)
+		*occludedCount = occluded;
+	return visibleCount;
+}
+
+static void rasterizeOcclusion() {
+	double start = glfwGetTime();
+	occlusionBuffer.rasterize(occlusionViewProjection, occlusionCameraPos, occlusionChunks, occlusionChunkCount, maxOccluders);
+	lastOcclusionRasterUS = (float)((glfwGetTime() - start) * 1000000.0);
+}
+
+static void occlusionJob(void* data) {
+	int expected = occlusionQueued;
+	if (occlusionJobState.compare_exchange_strong(expected, occlusionRunning)) {
+		rasterizeOcclusion();
+		occlusionJobState = occlusionDone;
+	}
+}
+
+// окклюдеры берутся из видимых в пирамиде чанков. Меши чанков не меняются до finishOcclusion
+static void startOcclusion(const glm::mat4& viewProjection, glm::vec3 cameraPos) {
+	occlusionViewProjection = viewProjection;
+	occlusionCameraPos = cameraPos;
+	occlusionChunkCount = 0;
+	for (size_t c = 0; c < chunksCount; c++)
+		if (isChunkDrawable(chunks[c]) && chunkVisible[c])
+			occlusionChunks[occlusionChunkCount++] = &chunks[c].occluders;
+	occlusionJobState = occlusionQueued;
+	jobSystem.submit(occlusionJob, NULL);
+}
+
+// если рабочие потоки заняты и задачу еще никто не взял, буфер растеризуется здесь
+static void finishOcclusion() {
+	int expected = occlusionQueued;
+	if (occlusionJobState.compare_exchange_strong(expected, occlusionRunning)) {
+		rasterizeOcclusion();
+		occlusionJobState = occlusionDone;
+		return;
+	}
+	while (occlusionJobState.load() != occlusionDone)
+		std::this_thread::yield();
+}
+
+// сравнить отсечение по Hi-Z с трассировкой лучей для видимых в пирамиде чанков последнего кадра
+static void runOcclusionSelfTest() {
+	OcclusionBox* boxes = (OcclusionBox*)malloc(chunksCount * sizeof(OcclusionBox));
+	int count = 0;
+	for (size_t c = 0; c < chunksCount; c++)
+		if (isChunkDrawable(chunks[c]) && chunkVisible[c])
+			boxes[count++] = chunks[c].occluders.bounds;
+	lastOcclusionSelfTest = occlusionSelfTest(occlusionBuffer, boxes, count);
+	occlusionSelfTestDone = true;
+	free(boxes);
+}
+
+// отправить меш чанка на ГПУ, обновить окклюдеры и копию связности для обхода видимости. Вызывать в главном потоке под блокировкой чанка
+static u32 uploadChunkMesh(Chunk& chunk) {
+	u32 bytes = updateBlockMesh(chunk.mesh);
+	selectChunkOccluders(chunk.mesh.faces, chunk.mesh.faceCount, chunk.occluders);
+	memcpy(chunk.drawnConnectivity, chunk.cellConnectivity, sizeof(chunk.drawnConnectivity));
+	chunk.drawnAirSections = chunk.airSections;
+	chunk.connectivityOpen = !chunk.generated;
+	connectivityVersion++;
+	// сетку чанков меняет основной поток, поэтому соседи сгенерированного чанка отмечаются здесь, а не в задаче
+	if (chunk.remeshNeighbors) {
+		chunk.remeshNeighbors = false;
+		gameWorld.markNeighborsForRemesh(&chunk - chunks);
+	}
+	return bytes;
+}
+
+// отправка готовых мешей на ГПУ с бюджетом на кадр, ближние к камере - первыми
+enum UploadBudgetMode : int {
+	uploadBudgetTime,
+	uploadBudgetBytes
+};
+static int uploadBudgetMode = uploadBudgetTime;
+static float uploadBudgetMS = 2.0f;
+static int uploadBudgetKB = 1024;
+static DynamicArray<int> pendingUploads = {}; // ждут отправки, без повторов
+static u8* uploadPending = NULL; // чанк уже в pendingUploads
+static int lastUploadCount = 0, lastUploadQueueDepth = 0, maxUploadQueueDepth = 0;
+static float lastUploadUS = 0;
+static u32 lastUploadBytes = 0;
+
+static void addPendingUpload(int chunkIndex) {
+	if (!uploadPending[chunkIndex]) {
+		uploadPending[chunkIndex] = 1;
+		pendingUploads.append(chunkIndex);
+	}
+}
+
+// unlimited - отправить все готовые (начальная загрузка). Хотя бы один меш отправляется в любом случае
+static void uploadReadyMeshes(glm::vec3 cameraPos, bool unlimited) {
+	double start = glfwGetTime();
+	if (!uploadPending)
+		uploadPending = (u8*)calloc(chunksCount, 1);
+
+	int chunkIndex;
+	while (meshReadyQueue.pop(&chunkIndex))
+		addPendingUpload(chunkIndex);
+	if (meshReadyOverflow.exchange(false, std::memory_order_acquire)) {
+		for (size_t c = 0; c < chunksCount; c++)
+			if (chunks[c].mesh.needUpdate)
+				addPendingUpload(c);
+	}
+	maxUploadQueueDepth = std::max(maxUploadQueueDepth, pendingUploads.count);
+
+	auto distance2 = [&](int c) {
+		glm::vec2 toChunk(chunks[c].posx + CHUNK_SX * 0.5f - cameraPos.x, chunks[c].posz + CHUNK_SZ * 0.5f - cameraPos.z);
+		return glm::dot(toChunk, toChunk);
+	};
+	std::sort(pendingUploads.items, pendingUploads.items + pendingUploads.count,
+		[&](int a, int b) { return distance2(a) < distance2(b); });
+
+	int uploaded = 0, kept = 0;
+	u32 bytes = 0;
+	for (int i = 0; i < pendingUploads.count; i++) {
+		int c = pendingUploads.items[i];
+		Chunk& chunk = chunks[c];
+		bool budgetLeft = unlimited || uploaded == 0 || (uploadBudgetMode == uploadBudgetTime
+			? (glfwGetTime() - start) * 1000.0 < uploadBudgetMS
+			: bytes < (u32)uploadBudgetKB * 1024);
+		// чанк, который сейчас публикует рабочий поток, останется в очереди до следующего кадра.
+		// Слот без блоков уже отдан другой позиции: меш прежней не отправляется
+		if (budgetLeft && chunk.mesh.needUpdate && chunk.lock.try_lock()) {
+			if (chunk.mesh.needUpdate && chunk.generated) {
+				bytes += uploadChunkMesh(chunk);
+				uploaded++;
+			}
+			chunk.lock.unlock();
+			uploadPending[c] = 0;
+		}
+		else if (!chunk.mesh.needUpdate) {
+			uploadPending[c] = 0; // меш уже отправлен в другом месте
+		}
+		else {
+			pendingUploads.items[kept++] = c;
+		}
+	}
+	pendingUploads.count = kept;
+
+	lastUploadCount = uploaded;
+	lastUploadBytes = bytes;
+	lastUploadQueueDepth = kept;
+	lastUploadUS = (float)((glfwGetTime() - start) * 1000000.0);
+}
+
+// перестроить меши всех чанков (например, после смены способа мешинга)
+static float lastRemeshAllMS = 0;
+void remeshAllChunks() {
+	Timer timer;
+	timer.start();
+	for (size_t i = 0; i < chunksCount; i++) {
+		ChunkBorders borders;
+		gameWorld.getChunkBorders(i, &borders);
+		std::lock_guard<std::mutex> lock(chunks[i].lock);
+		if (chunks[i].generated) {
+			meshChunk(chunks[i], &borders);
+			uploadChunkMesh(chunks[i]);
 		}
-		else
-			WaitForSingleObject(chunkGenQueue.semaphore, INFINITE);
 	}
+	timer.stop();
+	lastRemeshAllMS = std::chrono::duration<float, std::milli>(timer.stopTime - timer.startTime).count();
+}
 
-	return 0;
+// нагрузочный тест системы задач: много мелких задач, порождаемых из других задач
+#define JOB_STRESS_BATCHES 4096
+#define JOB_STRESS_BATCH_SIZE 1024
+struct JobStressState {
+	JobCounter counter;
+	std::atomic<u64> sum;
+	u64 jobCount;
+	float ms;
+	bool passed;
+} jobStress;
+
+void jobStressLeaf(void* data) {
+	jobStress.sum.fetch_add((u64)(size_t)data, std::memory_order_relaxed);
 }
 
-void updateChunk(int chunkIndex, int posx, int posz) {
+void jobStressBatch(void* data) {
+	u64 first = (u64)(size_t)data * JOB_STRESS_BATCH_SIZE;
+	for (u64 i = 0; i < JOB_STRESS_BATCH_SIZE; i++)
+		jobSystem.submit(jobStressLeaf, (void*)(size_t)(first + i), &jobStress.counter);
+}
+
+void jobStressTest() {
+	jobStress.counter = 0;
+	jobStress.sum = 0;
+	jobStress.jobCount = (u64)JOB_STRESS_BATCHES * JOB_STRESS_BATCH_SIZE;
+
+	Timer timer;
+	timer.start();
+	for (u64 b = 0; b < JOB_STRESS_BATCHES; b++)
+		jobSystem.submit(jobStressBatch, (void*)(size_t)b, &jobStress.counter);
+	jobSystem.wait(&jobStress.counter);
+	timer.stop();
+
+	jobStress.ms = std::chrono::duration<float, std::milli>(timer.stopTime - timer.startTime).count();
+	jobStress.passed = jobStress.sum.load() == jobStress.jobCount * (jobStress.jobCount - 1) / 2;
+}
+
+// сравнение скорости генерации блоков: прежний вариант (скалярный шум для каждого блока)
+// и generateChunkBlocks (шум по столбцам и рядам) на каждом доступном уровне SIMD
+#define GEN_BENCHMARK_CHUNKS 64
+struct GenBenchmarkResult {
+	float perVoxelChunksPerSec;
+	float chunksPerSec[noiseSimdCOUNT]; // 0 - уровень не поддерживается процессором
+	bool identical[noiseSimdCOUNT]; // блоки совпадают с прежним вариантом
+	// грубый 3D шум с шагом решетки 2, 4, 8: скорость и совпадение масок пещер и руды с полным разрешением
+	// (пересечение / объединение множеств блоков)
+	float latticeChunksPerSec[3];
+	float caveIoU[3];
+	float oreIoU[3];
+	bool done;
+} genBenchmark;
+
+void generationBenchmark() {
+	Block* reference = new Block[CHUNK_SIZE * GEN_BENCHMARK_CHUNKS];
+	Block* blocks = new Block[CHUNK_SIZE];
+	ChunkColumns columns;
+
+	Timer timer;
+	timer.start();
+	for (int i = 0; i < GEN_BENCHMARK_CHUNKS; i++)
+		gameWorld.generateChunkBlocksPerVoxel(reference + i * CHUNK_SIZE, i * CHUNK_SX, 0);
+	timer.stop();
+	float perVoxelMS = std::chrono::duration<float, std::milli>(timer.stopTime - timer.startTime).count();
+	genBenchmark.perVoxelChunksPerSec = GEN_BENCHMARK_CHUNKS * 1000.0f / perVoxelMS;
+
+	NoiseSimdLevel maxLevel = detectNoiseSimdLevel();
+	for (int level = 0; level < noiseSimdCOUNT; level++) {
+		genBenchmark.chunksPerSec[level] = 0;
+		genBenchmark.identical[level] = true;
+		if (level > maxLevel)
+			continue;
+		float ms = 0;
+		for (int i = 0; i < GEN_BENCHMARK_CHUNKS; i++) {
+			timer.start();
+			gameWorld.generateChunkBlocks(blocks, &columns, i * CHUNK_SX, 0, 1, (NoiseSimdLevel)level);
+			timer.stop();
+			ms += std::chrono::duration<float, std::milli>(timer.stopTime - timer.startTime).count();
+
+			if (memcmp(blocks, reference + i * CHUNK_SIZE, sizeof(Block) * CHUNK_SIZE) != 0)
+				genBenchmark.identical[level] = false;
+		}
+		genBenchmark.chunksPerSec[level] = GEN_BENCHMARK_CHUNKS * 1000.0f / ms;
+	}
+
+	for (int s = 0; s < 3; s++) {
+		int step = NOISE_LATTICE_MIN_STEP << s;
+		u32 caveIntersection = 0, caveUnion = 0, oreIntersection = 0, oreUnion = 0;
+		float ms = 0;
+		for (int i = 0; i < GEN_BENCHMARK_CHUNKS; i++) {
+			timer.start();
+			gameWorld.generateChunkBlocks(blocks, &columns, i * CHUNK_SX, 0, step, noiseSimdLevel);
+			timer.stop();
+			ms += std::chrono::duration<float, std::milli>(timer.stopTime - timer.startTime).count();
+
+			// рельеф в обоих вариантах одинаковый, отличаться могут только пещеры и руда.
+			// Пещеры - воздух ниже поверхности столбца (в любом из вариантов)
+			Block* ref = reference + i * CHUNK_SIZE;
+			for (int columnIndex = 0; columnIndex < CHUNK_SX * CHUNK_SZ; columnIndex++) {
+				int surface = glm::max((int)columnSurfaceHeight(ref, columnIndex), (int)columns.heightmap[columnIndex]);
+				for (int y = 0; y < surface; y++) {
+					int b = y * CHUNK_SX * CHUNK_SZ + columnIndex;
+					bool refCave = ref[b].type == btAir, cave = blocks[b].type == btAir;
+					bool refOre = ref[b].type == btIronOre, ore = blocks[b].type == btIronOre;
+					caveIntersection += refCave && cave;
+					caveUnion += refCave || cave;
+					oreIntersection += refOre && ore;
+					oreUnion += refOre || ore;
+				}
+			}
+		}
+		genBenchmark.latticeChunksPerSec[s] = GEN_BENCHMARK_CHUNKS * 1000.0f / ms;
+		genBenchmark.caveIoU[s] = caveUnion ? (float)caveIntersection / caveUnion : 1.0f;
+		genBenchmark.oreIoU[s] = oreUnion ? (float)oreIntersection / oreUnion : 1.0f;
+	}
+	genBenchmark.done = true;
+	delete[] reference;
+	delete[] blocks;
+}
+
+// проверка детерминированности генерации: одни и те же чанки, сгенерированные в одном потоке
+// и параллельно во всех рабочих потоках, должны совпасть побитово
+#define DETERMINISM_TEST_CHUNKS 64
+struct DeterminismTest {
+	Block* serialBlocks;
+	Block* parallelBlocks;
+	ChunkColumns serialColumns[DETERMINISM_TEST_CHUNKS];
+	ChunkColumns parallelColumns[DETERMINISM_TEST_CHUNKS];
+	int noise3DStep; // одни настройки для обоих проходов
+	NoiseSimdLevel simdLevel;
+	int mismatchedChunks;
+	bool done;
+} determinismTest;
+
+static glm::ivec2 determinismTestChunkPos(int i) {
+	// чанки по обе стороны от нуля, с разрывами между ними
+	return glm::ivec2((i % 8 - 4) * 3 * CHUNK_SX, (i / 8 - 4) * 3 * CHUNK_SZ);
+}
+
+void determinismTestJob(void* data) {
+	int i = (int)(size_t)data;
+	glm::ivec2 pos = determinismTestChunkPos(i);
+	gameWorld.generateChunkBlocks(determinismTest.parallelBlocks + i * CHUNK_SIZE, &determinismTest.parallelColumns[i], pos.x, pos.y, determinismTest.noise3DStep, determinismTest.simdLevel);
+}
+
+void generationDeterminismTest() {
+	if (!determinismTest.serialBlocks) {
+		determinismTest.serialBlocks = new Block[CHUNK_SIZE * DETERMINISM_TEST_CHUNKS];
+		determinismTest.parallelBlocks = new Block[CHUNK_SIZE * DETERMINISM_TEST_CHUNKS];
+	}
+
+	determinismTest.noise3DStep = gameWorld.noise3DStep;
+	determinismTest.simdLevel = noiseSimdLevel;
+	for (int i = 0; i < DETERMINISM_TEST_CHUNKS; i++) {
+		glm::ivec2 pos = determinismTestChunkPos(i);
+		gameWorld.generateChunkBlocks(determinismTest.serialBlocks + i * CHUNK_SIZE, &determinismTest.serialColumns[i], pos.x, pos.y, determinismTest.noise3DStep, determinismTest.simdLevel);
+	}
+
+	JobCounter counter(0);
+	for (int i = 0; i < DETERMINISM_TEST_CHUNKS; i++)
+		jobSystem.submit(determinismTestJob, (void*)(size_t)i, &counter);
+	jobSystem.wait(&counter);
+
+	determinismTest.mismatchedChunks = 0;
+	for (int i = 0; i < DETERMINISM_TEST_CHUNKS; i++) {
+		if (memcmp(determinismTest.serialBlocks + i * CHUNK_SIZE, determinismTest.parallelBlocks + i * CHUNK_SIZE, sizeof(Block) * CHUNK_SIZE) != 0
+			|| memcmp(&determinismTest.serialColumns[i], &determinismTest.parallelColumns[i], sizeof(ChunkColumns)) != 0)
+			determinismTest.mismatchedChunks++;
+	}
+	determinismTest.done = true;
+}
+
+// сохранение и загрузка сгенерированных чанков через файлы регионов в отдельной папке (удаляется после теста).
+// Загрузка идет после закрытия файлов, то есть с нового отображения файла в память
+#define REGION_BENCHMARK_CHUNKS 256
+struct RegionBenchmark {
+	float saveChunksPerSec, loadChunksPerSec;
+	float saveMBPerSec, loadMBPerSec; // по несжатым блокам (CHUNK_SIZE * sizeof(BlockType) на чанк)
+	float payloadKB; // среднее сжатых данных на чанк
+	float fileKB; // среднее на чанк в файле, вместе с заголовком и выравниванием по секторам
+	int mismatches; // чанки, загруженные не такими, какими были сохранены. Должно быть 0
+	bool done;
+} regionBenchmark;
+
+void runRegionBenchmark() {
+	static RegionStorage storage;
+	storage.init(SAVE_FOLDER "benchmark/", &jobSystem);
+	BlockType* blocks = new BlockType[CHUNK_SIZE * REGION_BENCHMARK_CHUNKS];
+	Biome* biomes = new Biome[CHUNK_SX * CHUNK_SZ * REGION_BENCHMARK_CHUNKS];
+	Block* scratch = new Block[CHUNK_SIZE];
+	ChunkColumns columns;
+	auto chunkPos = [](int i) { return glm::ivec2(i % 16 * CHUNK_SX, i / 16 * CHUNK_SZ); };
+	for (int i = 0; i < REGION_BENCHMARK_CHUNKS; i++) {
+		glm::ivec2 pos = chunkPos(i);
+		gameWorld.generateChunkBlocks(scratch, &columns, pos.x, pos.y, gameWorld.noise3DStep, noiseSimdLevel);
+		for (int b = 0; b < CHUNK_SIZE; b++)
+			blocks[i * CHUNK_SIZE + b] = scratch[b].type;
+		memcpy(biomes + i * CHUNK_SX * CHUNK_SZ, columns.biomes, sizeof(columns.biomes));
+	}
+
+	Timer timer;
+	u64 payloadBytes = 0;
+	timer.start();
+	for (int i = 0; i < REGION_BENCHMARK_CHUNKS; i++) {
+		glm::ivec2 pos = chunkPos(i);
+		payloadBytes += storage.saveChunk(pos.x, pos.y, blocks + i * CHUNK_SIZE, biomes + i * CHUNK_SX * CHUNK_SZ);
+	}
+	timer.stop();
+	float saveSec = std::chrono::duration<float>(timer.stopTime - timer.startTime).count();
+	size_t fileBytes = 0;
+	for (int i = 0; i < REGION_CACHE; i++)
+		if (storage.files[i].exists)
+			fileBytes += storage.files[i].fileSize;
+	storage.shutdown();
+
+	regionBenchmark.mismatches = 0;
+	timer.start();
+	for (int i = 0; i < REGION_BENCHMARK_CHUNKS; i++) {
+		glm::ivec2 pos = chunkPos(i);
+		bool loaded = storage.loadChunk(pos.x, pos.y, scratch, &columns);
+		for (int b = 0; loaded && b < CHUNK_SIZE; b++)
+			loaded = scratch[b].type == blocks[i * CHUNK_SIZE + b];
+		if (!loaded || memcmp(columns.biomes, biomes + i * CHUNK_SX * CHUNK_SZ, sizeof(columns.biomes)) != 0)
+			regionBenchmark.mismatches++;
+	}
+	timer.stop();
+	float loadSec = std::chrono::duration<float>(timer.stopTime - timer.startTime).count();
+	storage.removeFiles();
+
+	float rawMB = (float)CHUNK_SIZE * sizeof(BlockType) * REGION_BENCHMARK_CHUNKS / (1024 * 1024);
+	regionBenchmark.saveChunksPerSec = REGION_BENCHMARK_CHUNKS / saveSec;
+	regionBenchmark.loadChunksPerSec = REGION_BENCHMARK_CHUNKS / loadSec;
+	regionBenchmark.saveMBPerSec = rawMB / saveSec;
+	regionBenchmark.loadMBPerSec = rawMB / loadSec;
+	regionBenchmark.payloadKB = payloadBytes / 1024.0f / REGION_BENCHMARK_CHUNKS;
+	regionBenchmark.fileKB = fileBytes / 1024.0f / REGION_BENCHMARK_CHUNKS;
+	regionBenchmark.done = true;
+	delete[] blocks;
+	delete[] biomes;
+	delete[] scratch;
+}
+
+// задержка правки блока: частичное перестроение меша (patchChunkMesh) против полного на чанке под игроком.
+// С поверхности по очереди убираются и ставятся блоки, после каждой правки меш строится обоими способами
+// и отправляется на ГПУ. Частичный меш сравнивается с полным как набор граней.
+// Потом пары правок через setChunkBlock с частичным перестроением после каждой: связность ячеек должна
+// совпасть с пересчитанной полным перестроением
+#define EDIT_LATENCY_TEST_EDITS 64
+struct EditLatencyTest {
+	float patchUS, patchUploadUS, fullUS, fullUploadUS; // среднее на правку
+	float patchKB, fullKB; // отправлено на ГПУ, среднее на правку
+	int edits;
+	int mismatches; // правки, после которых частичный меш не совпал с полным. Должно быть 0
+	int connectivityMismatches; // пары правок, после которых связность не совпала с полным пересчетом. Должно быть 0
+	bool done;
+} editLatencyTest;
+
+static bool sameFaceSet(BlockFaceInstance* a, BlockFaceInstance* b, u32 count) {
+	auto less = [](const BlockFaceInstance& x, const BlockFaceInstance& y) { return memcmp(&x, &y, sizeof(BlockFaceInstance)) < 0; };
+	std::sort(a, a + count, less);
+	std::sort(b, b + count, less);
+	return memcmp(a, b, count * sizeof(BlockFaceInstance)) == 0;
+}
+
+void runEditLatencyTest(glm::vec3 pos) {
+	EditLatencyTest& test = editLatencyTest;
+	test = {};
+	Chunk* chunk = gameWorld.getChunkFromPos(pos);
+	if (!chunk || !chunk->generated)
+		return;
+	ChunkBorders borders;
+	gameWorld.getChunkBorders(chunk - chunks, &borders);
+
+	std::lock_guard<std::mutex> lock(chunk->lock);
+	// меш на ГПУ должен совпадать с мешем чанка: частичная отправка меняет только измененные участки.
+	// Ожидающие правки уже есть в блоках, полное перестроение их учитывает
+	chunk->pendingEditCount = 0;
+	chunk->pendingFullRemesh = false;
+	meshChunk(*chunk, &borders);
+	uploadChunkMesh(*chunk);
+	BlockFaceInstance* patched = NULL;
+	double patchTime = 0, patchUploadTime = 0, fullTime = 0, fullUploadTime = 0;
+	u64 patchBytes = 0, fullBytes = 0;
+	for (int i = 0; i < EDIT_LATENCY_TEST_EDITS; i++) {
+		int column = (i * 37 + 11) % (CHUNK_SX * CHUNK_SZ);
+		int height = columnSurfaceHeight(chunk->blocks, column);
+		// четные правки убирают верхний блок, нечетные ставят блок над ним
+		int y = i % 2 == 0 ? height - 1 : height;
+		if (y < 0 || y >= CHUNK_SY)
+			continue;
+		int blockIndex = y * CHUNK_SX * CHUNK_SZ + column;
+		BlockType old = chunk->blocks.get(blockIndex);
+		chunk->blocks.set(blockIndex, i % 2 == 0 ? btAir : btStone);
+		chunk->connectivityDirty |= 1 << (y / CHUNK_SECTION_SY);
+		ChunkEdit edit = { (s8)(column % CHUNK_SX), (u8)y, (s8)(column / CHUNK_SX) };
+
+		double t0 = glfwGetTime();
+		patchChunkMesh(*chunk, &edit, 1, &borders);
+		double t1 = glfwGetTime();
+		patchBytes += uploadChunkMesh(*chunk);
+		double t2 = glfwGetTime();
+		u32 patchedCount = chunk->mesh.faceCount;
+		patched = (BlockFaceInstance*)realloc(patched, std::max(patchedCount, 1u) * sizeof(BlockFaceInstance));
+		memcpy(patched, chunk->mesh.faces, patchedCount * sizeof(BlockFaceInstance));
+
+		// полное перестроение после правки тоже пересчитывает связность секции
+		chunk->connectivityDirty |= 1 << (y / CHUNK_SECTION_SY);
+		double t3 = glfwGetTime();
+		meshChunk(*chunk, &borders);
+		double t4 = glfwGetTime();
+		fullBytes += uploadChunkMesh(*chunk);
+		double t5 = glfwGetTime();
+		patchTime += t1 - t0;
+		patchUploadTime += t2 - t1;
+		fullTime += t4 - t3;
+		fullUploadTime += t5 - t4;
+		if (patchedCount != chunk->mesh.faceCount || !sameFaceSet(patched, chunk->mesh.faces, patchedCount))
+			test.mismatches++;
+
+		// блок возвращается, меш (отсортированный при сравнении) строится заново
+		chunk->blocks.set(blockIndex, old);
+		chunk->connectivityDirty |= 1 << (y / CHUNK_SECTION_SY);
+		meshChunk(*chunk, &borders);
+		uploadChunkMesh(*chunk);
+		test.edits++;
+	}
+	free(patched);
+
+	// как у правок игрока: правка записывается вместе с блоком, задача перестроения забирает все записанные
+	auto patchPending = [&]() {
+		patchChunkMesh(*chunk, chunk->pendingEdits, chunk->pendingEditCount, &borders);
+		chunk->pendingEditCount = 0;
+	};
+	static u16 patchedConnectivity[CHUNK_SECTIONS][SECTION_CELLS];
+	for (int i = 0; i < EDIT_LATENCY_TEST_EDITS; i += 2) {
+		// соседние столбцы в разных ячейках связности: вторая правка меняет ячейку, которую первое перестроение не трогало
+		int columns[2] = { (i * 37 + 11) % (CHUNK_SX * CHUNK_SZ), 0 };
+		columns[1] = (columns[0] + CONNECTIVITY_CELL) % (CHUNK_SX * CHUNK_SZ);
+		int ys[2];
+		BlockType olds[2];
+		for (int k = 0; k < 2; k++) {
+			ys[k] = std::max((int)columnSurfaceHeight(chunk->blocks, columns[k]) - 1, 0);
+			int blockIndex = ys[k] * CHUNK_SX * CHUNK_SZ + columns[k];
+			olds[k] = chunk->blocks.get(blockIndex);
+			setChunkBlock(*chunk, columns[k] % CHUNK_SX, ys[k], columns[k] / CHUNK_SX, btAir);
+			patchPending();
+		}
+		memcpy(patchedConnectivity, chunk->cellConnectivity, sizeof(patchedConnectivity));
+		u16 patchedAirSections = chunk->airSections;
+
+		chunk->connectivityDirty = (1 << CHUNK_SECTIONS) - 1;
+		meshChunk(*chunk, &borders);
+		if (memcmp(patchedConnectivity, chunk->cellConnectivity, sizeof(patchedConnectivity)) != 0 || patchedAirSections != chunk->airSections)
+			test.connectivityMismatches++;
+
+		for (int k = 1; k >= 0; k--)
+			setChunkBlock(*chunk, columns[k] % CHUNK_SX, ys[k], columns[k] / CHUNK_SX, olds[k]);
+		chunk->pendingEditCount = 0;
+		meshChunk(*chunk, &borders);
+	}
+	uploadChunkMesh(*chunk);
+	if (test.edits > 0) {
+		test.patchUS = (float)(patchTime * 1000000.0 / test.edits);
+		test.patchUploadUS = (float)(patchUploadTime * 1000000.0 / test.edits);
+		test.fullUS = (float)(fullTime * 1000000.0 / test.edits);
+		test.fullUploadUS = (float)(fullUploadTime * 1000000.0 / test.edits);
+		test.patchKB = patchBytes / 1024.0f / test.edits;
+		test.fullKB = fullBytes / 1024.0f / test.edits;
+	}
+	test.done = true;
+}
+
+// чанки, получившие новую позицию при последнем streamChunks, и заранее сгенерированные, вошедшие в радиус
+static int* streamPlaced = NULL;
+static int* streamPromoted = NULL;
+static float lastStreamUS = 0;
+static int lastStreamPlaced = 0;
+
+void updateChunk(int chunkIndex, int posx, int posz, JobCounter* counter = NULL) {
 	//dbgprint("generating chunk %d: (%d,%d)\n", posx, posz);
-	chunkGenTasks[chunkGenQueue.taskCount].posx = posx;
-	chunkGenTasks[chunkGenQueue.taskCount].posz = posz;
-	chunkGenTasks[chunkGenQueue.taskCount].index = chunkIndex;
-	chunkGenQueue.addTask();
+	submitChunkGenTask(chunkIndex, posx, posz, false, counter);
+}
+
+// перестроить меш на рабочем потоке по уже записанным правкам, пока на ГПУ остается прежний. Запросы к чанку,
+// чья задача еще не начата, сливаются в нее; срочный запрос поднимает ее приоритет
+static void queueRemesh(int chunkIndex, bool urgent) {
+	Chunk& chunk = chunks[chunkIndex];
+	if (!chunk.remeshQueued.exchange(true)) {
+		submitChunkGenTask(chunkIndex, chunk.posx, chunk.posz, true, NULL, urgent);
+		return;
+	}
+	remeshCoalesced++;
+	if (!urgent)
+		return;
+	std::lock_guard<std::mutex> lock(chunkGenTasksMutex);
+	u32 version = chunk.version.load(std::memory_order_relaxed);
+	for (int i = 0; i < chunkGenTaskCount; i++) {
+		ChunkGenTask& task = chunkGenTasks[i];
+		if (task.index == chunkIndex && task.onlyMesh && task.version == version && !task.urgent) {
+			task.urgent = true;
+			setChunkGenPriority(task);
+			std::make_heap(chunkGenTasks, chunkGenTasks + chunkGenTaskCount, chunkGenTaskLess);
+			break;
+		}
+	}
+}
+
+// с edit перестраиваются только грани вокруг блока, без него - весь меш
+void remeshChunk(int chunkIndex, bool urgent = false, const ChunkEdit* edit = NULL) {
+	{
+		std::lock_guard<std::mutex> lock(chunks[chunkIndex].lock);
+		addPendingEdit(chunks[chunkIndex], edit);
+	}
+	queueRemesh(chunkIndex, urgent);
+}
+
+// задача заранее генерируемого чанка, еще не взятая рабочим потоком, получает обычный приоритет
+static void promoteChunkGenTask(int chunkIndex) {
+	std::lock_guard<std::mutex> lock(chunkGenTasksMutex);
+	u32 version = chunks[chunkIndex].version.load(std::memory_order_relaxed);
+	for (int i = 0; i < chunkGenTaskCount; i++) {
+		ChunkGenTask& task = chunkGenTasks[i];
+		if (task.index == chunkIndex && task.prefetch && task.version == version) {
+			task.prefetch = false;
+			setChunkGenPriority(task);
+			std::make_heap(chunkGenTasks, chunkGenTasks + chunkGenTaskCount, chunkGenTaskLess);
+			return;
+		}
+	}
+	for (int i = 0; i < chunkGenDeferred.count; i++) {
+		ChunkGenTask& task = chunkGenDeferred.items[i];
+		if (task.index == chunkIndex && task.prefetch && task.version == version) {
+			task.prefetch = false;
+			setChunkGenPriority(task);
+		}
+	}
+}
+
+// время от входа чанка в радиус загрузки до кадра, в котором его меш уже на ГПУ
+static double* chunkEnteredTime = NULL; // 0 - чанк не ждет первой отрисовки
+static u32* chunkEnteredVersion = NULL; // чанк, выгруженный до отрисовки, перестает ждать
+static DynamicArray<int> awaitingFirstDraw = {};
+static double firstDrawLatencyMS = 0;
+static int firstDrawCount = 0;
+static float firstDrawMaxMS = 0;
+
+static void chunkEnteredRadius(int chunkIndex) {
+	if (chunkEnteredTime[chunkIndex] == 0)
+		awaitingFirstDraw.append(chunkIndex);
+	chunkEnteredTime[chunkIndex] = glfwGetTime();
+	chunkEnteredVersion[chunkIndex] = chunks[chunkIndex].version.load(std::memory_order_relaxed);
+}
+
+static void updateFirstDrawLatency() {
+	double now = glfwGetTime();
+	int kept = 0;
+	for (int i = 0; i < awaitingFirstDraw.count; i++) {
+		int c = awaitingFirstDraw.items[i];
+		Chunk& chunk = chunks[c];
+		if (chunk.version.load(std::memory_order_relaxed) == chunkEnteredVersion[c] && !(chunk.generated && !chunk.mesh.needUpdate)) {
+			awaitingFirstDraw.items[kept++] = c;
+			continue;
+		}
+		if (chunk.version.load(std::memory_order_relaxed) == chunkEnteredVersion[c]) {
+			float ms = (float)((now - chunkEnteredTime[c]) * 1000.0);
+			firstDrawLatencyMS += ms;
+			firstDrawCount++;
+			firstDrawMaxMS = std::max(firstDrawMaxMS, ms);
+		}
+		chunkEnteredTime[c] = 0;
+	}
+	awaitingFirstDraw.count = kept;
+}
+
+// упреждающая генерация: положение камеры экстраполируется по сглаженной скорости на prefetchLookaheadSec вперед,
+// чанки, которые войдут в радиус загрузки на этом пути, генерируются заранее с низким приоритетом.
+// Они не рисуются и не попадают в сетку, пока не войдут в радиус (GameWorld::streamChunks)
+#define PREFETCH_SAMPLES 8
+static bool prefetchEnabled = true;
+static float prefetchLookaheadSec = 1.5f;
+static int prefetchBudget = 32; // чанков, не больше CHUNK_PREFETCH_MAX
+static glm::vec2 cameraVelocity(0, 0); // по горизонтали, блоков в секунду
+static glm::vec3 lastCameraPos(0, 0, 0);
+static glm::ivec2 lastPrefetchTarget(INT_MAX, INT_MAX), lastPrefetchCenter(INT_MAX, INT_MAX);
+static glm::ivec2* prefetchScratch = NULL;
+static int prefetchIssued = 0, prefetchPromoted = 0, prefetchReadyAtEntry = 0, prefetchEvicted = 0;
+
+static void updateCameraVelocity(glm::vec3 pos, float deltaTime) {
+	if (deltaTime <= 0)
+		return;
+	glm::vec2 velocity((pos.x - lastCameraPos.x) / deltaTime, (pos.z - lastCameraPos.z) / deltaTime);
+	lastCameraPos = pos;
+	// телепорт не считается движением
+	if (glm::length(velocity) > 1000.0f)
+		return;
+	float k = 1.0f - expf(-deltaTime / 0.25f);
+	cameraVelocity += (velocity - cameraVelocity) * k;
+}
+
+static glm::ivec2 chunkOfPos(glm::vec2 pos) {
+	return glm::ivec2((int)floorf(pos.x / CHUNK_SX), (int)floorf(pos.y / CHUNK_SZ));
+}
+
+// centerX, centerZ - позиция чанка камеры
+static void updatePrefetch(glm::vec3 cameraPos, int centerX, int centerZ) {
+	glm::ivec2 center(centerX / CHUNK_SX, centerZ / CHUNK_SZ);
+	glm::vec2 pos(cameraPos.x, cameraPos.z);
+	glm::vec2 lookahead = cameraVelocity * prefetchLookaheadSec;
+	bool moving = prefetchEnabled && prefetchBudget > 0 && glm::length(cameraVelocity) > 1.0f;
+	glm::ivec2 target = moving ? chunkOfPos(pos + lookahead) : center;
+	if (target == lastPrefetchTarget && center == lastPrefetchCenter)
+		return;
+	lastPrefetchTarget = target;
+	lastPrefetchCenter = center;
+
+	// позиции, входящие в радиус на пути камеры, в порядке прохождения
+	static glm::ivec2 wanted[CHUNK_PREFETCH_MAX];
+	int wantedCount = 0;
+	glm::ivec2 lastSample = center;
+	for (int s = 1; moving && s <= PREFETCH_SAMPLES && wantedCount < prefetchBudget; s++) {
+		glm::ivec2 sample = chunkOfPos(pos + lookahead * ((float)s / PREFETCH_SAMPLES));
+		if (sample == lastSample)
+			continue;
+		lastSample = sample;
+		int count = gameWorld.chunksEnteringRadius(center.x, center.y, sample.x, sample.y, prefetchScratch, chunksCount);
+		// ближние к камере раньше
+		std::sort(prefetchScratch, prefetchScratch + count, [&](glm::ivec2 a, glm::ivec2 b) {
+			glm::vec2 da = glm::vec2(a) + glm::vec2(CHUNK_SX, CHUNK_SZ) * 0.5f - pos;
+			glm::vec2 db = glm::vec2(b) + glm::vec2(CHUNK_SX, CHUNK_SZ) * 0.5f - pos;
+			return glm::dot(da, da) < glm::dot(db, db);
+		});
+		for (int i = 0; i < count && wantedCount < prefetchBudget; i++) {
+			if (std::find(wanted, wanted + wantedCount, prefetchScratch[i]) == wanted + wantedCount)
+				wanted[wantedCount++] = prefetchScratch[i];
+		}
+	}
+
+	// заранее сгенерированные чанки не на пути выгружаются
+	for (int i = gameWorld.prefetchedCount - 1; i >= 0; i--) {
+		int index = gameWorld.prefetchedChunks[i];
+		glm::ivec2 chunkPos(chunks[index].posx, chunks[index].posz);
+		if (std::find(wanted, wanted + wantedCount, chunkPos) == wanted + wantedCount) {
+			gameWorld.unloadChunk(index);
+			prefetchEvicted++;
+		}
+	}
+	for (int i = 0; i < wantedCount; i++) {
+		if (gameWorld.findPrefetchedChunk(wanted[i].x, wanted[i].y) != -1)
+			continue;
+		int index = gameWorld.prefetchChunk(wanted[i].x, wanted[i].y);
+		if (index == -1)
+			break;
+		submitChunkGenTask(index, wanted[i].x, wanted[i].y, false, NULL, false, true);
+		prefetchIssued++;
+	}
+}
+
+// чанки, вошедшие в радиус загрузки (streamChunks, setLoadRadius): новые позиции генерируются,
+// заранее сгенерированные уже готовы или генерируются, их задача получает обычный приоритет
+static void startEnteredChunks(int placedCount, int promotedCount) {
+	for (int i = 0; i < placedCount; i++) {
+		Chunk& chunk = chunks[streamPlaced[i]];
+		dbgprint("Chunk #%d moved to (%d, %d)\n", streamPlaced[i], chunk.posx, chunk.posz);
+		updateChunk(streamPlaced[i], chunk.posx, chunk.posz);
+		chunkEnteredRadius(streamPlaced[i]);
+	}
+	for (int i = 0; i < promotedCount; i++) {
+		Chunk& chunk = chunks[streamPromoted[i]];
+		if (chunk.generated && !chunk.mesh.needUpdate)
+			prefetchReadyAtEntry++;
+		else
+			promoteChunkGenTask(streamPromoted[i]);
+		chunkEnteredRadius(streamPromoted[i]);
+	}
+	prefetchPromoted += promotedCount;
+	if (placedCount + promotedCount > 0)
+		connectivityVersion++;
+}
+
+// смена радиуса загрузки без перезапуска
+static float lastRenderDistanceChangeUS = 0;
+static void applyRenderDistance(int radius) {
+	double start = glfwGetTime();
+	int oldRadius = gameWorld.loadRadius;
+	int promotedCount;
+	int placedCount = gameWorld.setLoadRadius(radius, streamPlaced, streamPromoted, &promotedCount);
+	renderDistance = gameWorld.loadRadius;
+	if (renderDistance == oldRadius)
+		return;
+	startEnteredChunks(placedCount, promotedCount);
+	// участки буфера граней у освободившихся слотов больше не нужны. Неотправленные меши этих слотов
+	// сброшены при выгрузке (dropPendingMesh), поэтому участки не будут выделены снова
+	if (renderDistance < oldRadius) {
+		for (int i = 0; i < gameWorld.freeChunkCount; i++)
+			releaseBlockMesh(chunks[gameWorld.freeChunks[i]].mesh);
+		connectivityVersion++;
+	}
+	// путь упреждающей генерации пересчитается под новый радиус
+	lastPrefetchCenter = glm::ivec2(INT_MAX, INT_MAX);
+	lastRenderDistanceChangeUS = (float)((glfwGetTime() - start) * 1000000.0);
+}
+
+// автоматический радиус загрузки: держит стоимость кадра около targetFrameMS.
+// Стоимость кадра - большее из времени работы кадра на ЦП (без ожидания SwapBuffers, не зависит от vsync)
+// и времени кадра на ГПУ по запросу GL_TIME_ELAPSED
+#define FRAME_HISTORY 240
+#define GPU_TIMER_QUERIES 3 // результат читается через кадр-два, без ожидания ГПУ
+static bool autoRenderDistance = false;
+static float targetFrameMS = 16.0f;
+static int minAutoRenderDistance = 4;
+static int maxAutoRenderDistance = MAX_LOAD_RADIUS;
+static float frameTimeHistory[FRAME_HISTORY], frameCostHistory[FRAME_HISTORY], renderDistanceHistory[FRAME_HISTORY];
+static int frameHistoryPos = 0;
+static GLuint gpuTimerQueries[GPU_TIMER_QUERIES];
+static int gpuTimerFrame = 0;
+static float lastCpuFrameMS = 0, lastGpuFrameMS = 0;
+// окно усреднения контроллера
+static double controllerWindowStart = 0, controllerCooldownUntil = 0;
+static float controllerCostSum = 0;
+static int controllerFrames = 0;
+static float lastControllerCostMS = 0;
+
+static void beginFrameTimer() {
+	if (gpuTimerQueries[0] == 0)
+		glGenQueries(GPU_TIMER_QUERIES, gpuTimerQueries);
+	// запрос, начатый GPU_TIMER_QUERIES кадров назад, почти всегда уже готов
+	GLuint query = gpuTimerQueries[gpuTimerFrame % GPU_TIMER_QUERIES];
+	if (gpuTimerFrame >= GPU_TIMER_QUERIES) {
+		GLint available = 0;
+		glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available) {
+			GLuint64 ns = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+			lastGpuFrameMS = ns / 1000000.0f;
+		}
+	}
+	glBeginQuery(GL_TIME_ELAPSED, query);
+}
+
+static void endFrameTimer(float cpuFrameMS, float frameMS) {
+	glEndQuery(GL_TIME_ELAPSED);
+	gpuTimerFrame++;
+	lastCpuFrameMS = cpuFrameMS;
+	float cost = std::max(cpuFrameMS, lastGpuFrameMS);
+	frameTimeHistory[frameHistoryPos] = frameMS;
+	frameCostHistory[frameHistoryPos] = cost;
+	renderDistanceHistory[frameHistoryPos] = (float)renderDistance;
+	frameHistoryPos = (frameHistoryPos + 1) % FRAME_HISTORY;
+	controllerCostSum += cost;
+	controllerFrames++;
+}
+
+// раз в полсекунды: дорогой кадр - радиус уменьшается сразу, дешевый - увеличивается,
+// когда догружены чанки предыдущего увеличения (иначе в стоимость не попала их отрисовка)
+static void updateRenderDistanceController() {
+	double now = glfwGetTime();
+	if (now - controllerWindowStart < 0.5)
+		return;
+	lastControllerCostMS = controllerFrames > 0 ? controllerCostSum / controllerFrames : 0;
+	controllerWindowStart = now;
+	controllerCostSum = 0;
+	controllerFrames = 0;
+	if (!autoRenderDistance || now < controllerCooldownUntil || lastControllerCostMS == 0)
+		return;
+
+	int radius = renderDistance;
+	if (lastControllerCostMS > targetFrameMS * 1.05f && radius > minAutoRenderDistance) {
+		radius--;
+		controllerCooldownUntil = now + 1.0;
+	}
+	else if (lastControllerCostMS < targetFrameMS * 0.8f && radius < maxAutoRenderDistance
+		&& chunkGenTaskCount == 0 && pendingUploads.count == 0) {
+		radius++;
+		controllerCooldownUntil = now + 2.0;
+	}
+	if (radius != renderDistance)
+		applyRenderDistance(radius);
+}
+
+// блок на границе чанка мог открыть или закрыть грани граничного слоя соседнего чанка
+// правку в самом чанке уже записал setBlockFromPos, соседям передается блок за их границей
+void remeshEditedBlock(int chunkIndex, glm::ivec3 local) {
+	queueRemesh(chunkIndex, true);
+
+	Chunk& chunk = chunks[chunkIndex];
+	auto remeshNeighbor = [&](int offsetX, int offsetZ, int x, int z) {
+		int neighborIndex = gameWorld.findChunkIndex(chunk.posx + offsetX * CHUNK_SX, chunk.posz + offsetZ * CHUNK_SZ);
+		if (neighborIndex == -1 || !chunks[neighborIndex].generated)
+			return;
+		ChunkEdit neighborEdit = { (s8)x, (u8)local.y, (s8)z };
+		remeshChunk(neighborIndex, true, &neighborEdit);
+	};
+	if (local.x == 0)
+		remeshNeighbor(-1, 0, CHUNK_SX, local.z);
+	if (local.x == CHUNK_SX - 1)
+		remeshNeighbor(1, 0, -1, local.z);
+	if (local.z == 0)
+		remeshNeighbor(0, -1, local.x, CHUNK_SZ);
+	if (local.z == CHUNK_SZ - 1)
+		remeshNeighbor(0, 1, local.x, -1);
 }
 
 enum CubeSide : u8 {
@@ -325,20 +1530,15 @@ void CubesMainGameLoop(GLFWwindow* window) {
 		testChunk.mesh.faceSize = CHUNK_SIZE * 6;
 		testChunk.mesh.faces = (BlockFaceInstance*)calloc(CHUNK_SIZE * 6, sizeof(BlockFaceInstance));
 
-		testChunk.blocks = (Block*)calloc(CHUNK_SIZE, sizeof(Block));
-
-		for (size_t i = 0; i < CHUNK_SIZE; i++)
-		{
-			testChunk.blocks[i] = Block(btAir);
-		}
+		testChunk.blocks.init(btAir);
 
 		for (size_t i = 0; i < CHUNK_SX * CHUNK_SZ; i++)
 		{
-			testChunk.blocks[i] = Block(btGround);
+			testChunk.blocks.set(i, btGround);
 		}
 
-		testChunk.blocks[70 + (CHUNK_SX * CHUNK_SZ) * 3] = Block(btGround);
-		testChunk.blocks[70 + (CHUNK_SX * CHUNK_SZ) * 4] = Block(btGround);
+		testChunk.blocks.set(70 + (CHUNK_SX * CHUNK_SZ) * 3, btGround);
+		testChunk.blocks.set(70 + (CHUNK_SX * CHUNK_SZ) * 4, btGround);
 
 		meshChunk(testChunk);
 		setupBlockMesh(testChunk.mesh);
@@ -353,29 +1553,32 @@ void CubesMainGameLoop(GLFWwindow* window) {
 	bool debugView_cb = true;
 	int chunksUpdated = 0;
 
-	gameWorld.init(0, chunksCount);
+	gameWorld.init(0, renderDistance, circularLoadRadius);
 	chunks = gameWorld.chunks;
+	streamPlaced = (int*)malloc(sizeof(int) * chunksCount);
+	streamPromoted = (int*)malloc(sizeof(int) * chunksCount);
+	prefetchScratch = (glm::ivec2*)malloc(sizeof(glm::ivec2) * chunksCount);
+	chunkEnteredTime = (double*)calloc(chunksCount, sizeof(double));
+	chunkEnteredVersion = (u32*)calloc(chunksCount, sizeof(u32));
 
 	player.camera.pos = glm::vec3(8, 30, 8);
 	player.camera.front = glm::vec3(0, 0, -1);
 	player.camera.up = glm::vec3(0, 1, 0);
 	player.speed = 20;
 	
-	//  
+	// компиляция шейдеров
 	initShaders();
+	initFrameUniforms();
 	uiInit();
-	//    
-	{
-		int threadCount = 16;
-		chunkGenThreads = (WorkingThread*)malloc(sizeof(WorkingThread) * threadCount);
-		for (size_t i = 0; i < threadCount; i++) {
-			chunkGenThreads[i].threadID = i;
-			chunkGenThreads[i].handle = CreateThread(0, 0, (LPTHREAD_START_ROUTINE)chunkGenThreadProc, &chunkGenThreads[i], 0, 0);
-		}
-	}
+	// потоки для создания чанков (по количеству ядер)
+	jobSystem.init();
+	meshReadyQueue.init(CHUNK_GEN_TASKS_MAX);
+	// измененные чанки сохраняются при выгрузке и читаются вместо генерации
+	regionStorage.init(SAVE_FOLDER, &jobSystem);
+	gameWorld.storage = &regionStorage;
 	
 
-	//  
+	// загрузка текстур
 	Texture testTexture = LoadTexture(TEX_FOLDER "uv.png", textureRGBA);
 	Texture textureAtlas = LoadTexture(TEX_FOLDER "TextureAtlas.png", textureRGBA);
 	{
@@ -390,7 +1593,7 @@ void CubesMainGameLoop(GLFWwindow* window) {
 		blocksUV[texMoon].offset = { texUSize * 3, 0 };
 		blocksUV[texMoon].scale = { texUSize, texVSize };
 	}
-	// TODO:    ui ,   
+	// TODO: добавить координаты для ui элементов, отрендерить на экран
 	Texture uiAtlas = LoadTexture(TEX_FOLDER "UiAtlas.png", textureRGBA);
 	{
 		glm::vec2 tileSize(16.0f / (float)uiAtlas.width, 16.0f / (float)uiAtlas.height);
@@ -405,28 +1608,26 @@ void CubesMainGameLoop(GLFWwindow* window) {
 
 	for (size_t i = 0; i < chunksCount; i++)
 	{
-		chunks[i].blocks = new Block[CHUNK_SX * CHUNK_SY * CHUNK_SZ]; // TODO:   
-		chunks[i].mesh.faceSize = CHUNK_SIZE * 6;
-		chunks[i].mesh.faces = (BlockFaceInstance*)calloc(chunks[i].mesh.faceSize, sizeof(BlockFaceInstance)); // 6   4 
-		setupBlockMesh(chunks[i].mesh, false, true);
+		chunks[i].blocks.init(btAir);
+		// буфер граней выделяется при мешинге точно по числу граней
+		chunks[i].mesh.faceSize = 0;
+		chunks[i].mesh.faces = NULL;
 	}
-	//   
+	// все меши чанков в одном буфере, в среднем ~1000 граней на чанк, при нехватке буфер растет
+	initBlockMeshBuffer(gameWorld.loadedChunksCount * 1024);
+	initBlockMultiDraw();
+	occlusionBuffer.init();
+	// генерация начальных чанков
 	{
-		int chunkNum = 0;
-		for (int z = -renderDistance; z <= renderDistance; z++) {
-			for (int x = -renderDistance; x <= renderDistance; x++) {
-				updateChunk(chunkNum, x * CHUNK_SX, z * CHUNK_SZ);
-				chunkNum++;
-			}
-		}
-		chunkGenQueue.waitAndClear();
-
-		for (size_t i = 0; i < chunksCount; i++) {
-			if (gameWorld.chunks[i].mesh.needUpdate) {
-				updateBlockMesh(gameWorld.chunks[i].mesh);
-				//gameWorld.chunks[i].ready = true;
-			}
-		}
+		updateChunkGenPriorities(player.camera.pos, player.camera.front);
+		JobCounter initialChunks(0);
+		int promotedCount;
+		int placedCount = gameWorld.streamChunks((int)floorf(player.camera.pos.x), (int)floorf(player.camera.pos.z), streamPlaced, streamPromoted, &promotedCount);
+		for (int i = 0; i < placedCount; i++)
+			updateChunk(streamPlaced[i], chunks[streamPlaced[i]].posx, chunks[streamPlaced[i]].posz, &initialChunks);
+		jobSystem.wait(&initialChunks);
+		uploadReadyMeshes(player.camera.pos, true);
+		lastCameraPos = player.camera.pos;
 	}
 
 	PolyMesh box;
@@ -478,7 +1679,7 @@ void CubesMainGameLoop(GLFWwindow* window) {
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
 	glEnable(GL_DEPTH_TEST);
-	// TODO: 
+	// TODO: включить
 	glEnable(GL_CULL_FACE);
 
 	{
@@ -495,7 +1696,6 @@ void CubesMainGameLoop(GLFWwindow* window) {
 	}
 
 	// shadow framebuffer
-	GLuint shadowShader, polyMeshShadowShader;
 	GLuint depthMapFBO, depthMap;
 	u32 SHADOW_WIDTH = 1024 * 2, SHADOW_HEIGHT = 1024 * 2;
 	{
@@ -517,9 +1717,6 @@ void CubesMainGameLoop(GLFWwindow* window) {
 		glDrawBuffer(GL_NONE);
 		glReadBuffer(GL_NONE);
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-		shadowShader = BuildShader(SHADER_FOLDER "blockDepthShader.vert", SHADER_FOLDER "depthShader.frag");
-		polyMeshShadowShader = BuildShader(SHADER_FOLDER "polyMeshDepthShader.vert", SHADER_FOLDER "depthShader.frag");
 	}
 
 	// MAIN GAME LOOP
@@ -531,12 +1728,14 @@ void CubesMainGameLoop(GLFWwindow* window) {
 		float currentFrame = glfwGetTime();
 		deltaTime = currentFrame - lastFrame;
 		lastFrame = currentFrame;
+		double frameStart = glfwGetTime();
+		beginFrameTimer();
 
 		gameInputs.clear();
 
 		glfwPollEvents();
 		
-		//   
+		// обновление направления солнца
 #if 1
 		sunDir.x = cos(currentFrame * sunSpeed);
 		sunDir.y = sin(currentFrame * sunSpeed);
@@ -552,84 +1751,43 @@ void CubesMainGameLoop(GLFWwindow* window) {
 		if (player.camera.pos.z < 0)
 			currentChunkPosZ -= CHUNK_SZ;
 
-		//   
+		// ожидающие задачи генерации пересчитываются под новое положение камеры
+		updateChunkGenPriorities(player.camera.pos, player.camera.front);
+		submitDeferredChunkGenTasks();
+
+		// генерация новых чанков
 #if 1
 		if (lastChunkPosX != currentChunkPosX || lastChunkPosZ != currentChunkPosZ) {
-			chunkGenQueue.clearTasks();
-			int chunkNum = 0;
-			for (int z = -renderDistance; z <= renderDistance; z++) {
-				for (int x = -renderDistance; x <= renderDistance; x++) {
-					glm::ivec2 newChunkPos(currentChunkPosX + x * CHUNK_SX, currentChunkPosZ + z * CHUNK_SZ);
-					
-					bool alreadyGenerated = false;
-					for (size_t i = 0; i < chunksCount; i++) {
-						//      ,  
-						if (chunks[i].posx == newChunkPos.x && chunks[i].posz == newChunkPos.y) {
-							alreadyGenerated = true;
-							break;
-						}
-					}
-					if (alreadyGenerated)
-						continue;
-
-					int chunkToReplaceIndex = -1;
-					for (size_t i = 0; i < chunksCount; i++) {
-						//     
-						if (abs(chunks[i].posx - currentChunkPosX) > renderDistance * CHUNK_SX ||
-							abs(chunks[i].posz - currentChunkPosZ) > renderDistance * CHUNK_SZ) {
-							chunkToReplaceIndex = i;
-							//dbgprint("chunkToReplaceIndex %d\n", chunkToReplaceIndex);
-							break;
-						}
-					}
-
-					if (chunkToReplaceIndex == -1)
-						continue;
-
-					dbgprint("Replacing chunk #%d (%d, %d) with (%d, %d)\n", 
-						chunkToReplaceIndex, chunks[chunkToReplaceIndex].posx, chunks[chunkToReplaceIndex].posx,
-						newChunkPos.x, newChunkPos.y);
-
-					chunks[chunkToReplaceIndex].posx = newChunkPos.x;
-					chunks[chunkToReplaceIndex].posz = newChunkPos.y;
-					updateChunk(chunkToReplaceIndex, newChunkPos.x, newChunkPos.y);
-					chunkNum++;
-				}
-			}
-
+			// обходятся только вошедшие в радиус и вышедшие из него участки строк.
+			// Задачи для чанков, ушедших за предел видимости, отбросятся сами при выполнении
+			double streamStart = glfwGetTime();
+			int promotedCount;
+			int placedCount = gameWorld.streamChunks(currentChunkPosX, currentChunkPosZ, streamPlaced, streamPromoted, &promotedCount);
+			startEnteredChunks(placedCount, promotedCount);
+			lastStreamUS = (float)((glfwGetTime() - streamStart) * 1000000.0);
+			lastStreamPlaced = placedCount;
 		}
+		updateRenderDistanceController();
+		updateCameraVelocity(player.camera.pos, deltaTime);
+		updatePrefetch(player.camera.pos, currentChunkPosX, currentChunkPosZ);
 #endif
 
-		//        (    )
-		{
-			static int i = 0;
-			if (i < chunksCount) {
-				if (gameWorld.chunks[i].mesh.needUpdate) {
-					updateBlockMesh(gameWorld.chunks[i].mesh);
-					//gameWorld.chunks[i].generated = true;
-				}
-				i++;
+		// перестраиваем меши чанков, у которых сгенерировались соседи
+		for (size_t i = 0; i < chunksCount; i++) {
+			if (chunks[i].needRemesh && chunks[i].generated) {
+				chunks[i].needRemesh = false;
+				remeshChunk(i, chunks[i].remeshUrgent);
+				chunks[i].remeshUrgent = false;
 			}
-			else
-				i = 0;
 		}
 
+		// отправляем на ГПУ меши, готовые на рабочих потоках, в пределах бюджета кадра
+		uploadReadyMeshes(player.camera.pos, false);
+		updateFirstDrawLatency();
+
 		lastChunkPosX = currentChunkPosX;
 		lastChunkPosZ = currentChunkPosZ;
 
-		// find current chunk
-		Chunk* chunk = &chunks[0];
-		BlockMesh* chunkMesh = &chunk->mesh;
-		for (size_t i = 0; i < chunksCount; i++)
-		{
-			if (player.camera.pos.x >= chunks[i].posx && player.camera.pos.x <= chunks[i].posx + CHUNK_SX
-				&& player.camera.pos.z >= chunks[i].posz && player.camera.pos.z <= chunks[i].posz + CHUNK_SZ) {
-				chunk = &chunks[i];
-				chunkMesh = &chunk->mesh;
-				break;
-			}
-		}
-
 		// update entities
 		for (size_t i = 0; i < entities.count; i++)
 		{
@@ -642,14 +1800,9 @@ void CubesMainGameLoop(GLFWwindow* window) {
 			entity.pos.y -= 5 * deltaTime;
 			entity.pos += entity.speed * deltaTime;
 			entity.speed *= 0.1;
-			Block* belowBlock;
-			do {
-				belowBlock = gameWorld.peekBlockFromPos(glm::vec3(entity.pos.x, entity.pos.y - 1, entity.pos.z));
-				if (belowBlock && belowBlock->type != btAir)
-					entity.pos.y = (int)entity.pos.y + 1;
-				else
-					break;
-			} while (belowBlock);
+			BlockType belowBlock;
+			while (gameWorld.peekBlockFromPos(glm::vec3(entity.pos.x, entity.pos.y - 1, entity.pos.z), &belowBlock) && belowBlock != btAir)
+				entity.pos.y = (int)entity.pos.y + 1;
 			
 			if (glm::distance(entity.pos, player.camera.pos) < 16) {
 				entity.state = entityStateChasing;
@@ -673,11 +1826,11 @@ void CubesMainGameLoop(GLFWwindow* window) {
 		int display_w, display_h;
 		glfwGetFramebufferSize(window, &display_w, &display_h);
 
-#pragma region 
-#pragma region 
-		float cameraSpeedAdj = player.speed * deltaTime; //      FPS
+#pragma region Отрисовка
+#pragma region трансформации
+		float cameraSpeedAdj = player.speed * deltaTime; // делаем скорость камеры независимой от FPS
 
-		//   ()
+		// трансформация вида (камера)
 		glm::vec3 direction;
 		glm::mat4 view, projection;
 		{
@@ -697,12 +1850,24 @@ void CubesMainGameLoop(GLFWwindow* window) {
 
 			view = glm::lookAt(player.camera.pos, player.camera.pos + player.camera.front, player.camera.up);
 
-			//   (/ )
+			// матрица проекции (перспективная/ортогональная проекция)
 			projection = glm::mat4(1.0);
 			projection = glm::perspective(glm::radians(fov_slider), (float)display_w / (float)display_h, 0.1f, 1000.0f);
 		}
 #pragma endregion
 
+		// отсечение чанков
+		updateChunkBoxes();
+		lastCullUS = 0;
+		lastCullCandidates = 0;
+		for (size_t c = 0; c < chunksCount; c++)
+			lastCullCandidates += isChunkDrawable(chunks[c]);
+		cullChunks(projection * view, chunkVisible);
+		if (connectivityCulling)
+			cullChunksByConnectivity(player.camera.pos);
+		if (occlusionCulling)
+			startOcclusion(projection * view, player.camera.pos);
+
 		// rendering shadow maps
 		glm::mat4 lightSpaceMatrix;
 		{
@@ -717,48 +1882,21 @@ void CubesMainGameLoop(GLFWwindow* window) {
 			
 
 			lightSpaceMatrix = lightProjection * lightView;
+			updateFrameUniforms(sunDir, sunColor, moonColor, ambientColor, projection, view, lightSpaceMatrix);
+			cullChunks(lightSpaceMatrix, chunkShadowVisible);
+			lastVisibleShadow = buildChunkDrawList(shadowDrawList, chunkShadowVisible, NULL, NULL);
 
 			glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
 			glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
 			glClear(GL_DEPTH_BUFFER_BIT);
 			
-			glUseProgram(shadowShader);
-			//     
-			glUniformMatrix4fv(glGetUniformLocation(shadowShader, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-
-			// rendering scene to depth map
-			//glm::mat4 model = glm::mat4(1.0f); //   (1  )
-			//model = glm::translate(model, glm::vec3(testChunk.posx, 0, testChunk.posz));
-			//model = glm::rotate(model, 0.0f, glm::vec3(1.0, 0.0, 0.0));
-			//model = glm::rotate(model, 0.0f, glm::vec3(0.0, 1.0, 0.0));
-			//model = glm::rotate(model, 0.0f, glm::vec3(0.0, 0.0, 1.0));
-			//model = glm::scale(model, glm::vec3(1,1,1));
-			//glUniformMatrix4fv(glGetUniformLocation(shadowShader, "model"), 1, GL_FALSE, glm::value_ptr(model));
+			// матрица света - в FrameData, других uniform-переменных у шейдера нет
+			useBlockShadowShader();
 
-			for (size_t c = 0; c < chunksCount; c++)
-			{
-				Chunk& chunk = chunks[c];
-				if (chunk.generated && !chunk.mesh.needUpdate) {
-					glm::mat4 model = glm::mat4(1.0f); //   (1  )
-					model = glm::translate(model, glm::vec3(0, 0, 0));
-					model = glm::rotate(model, 0.0f, glm::vec3(1.0, 0.0, 0.0));
-					model = glm::rotate(model, 0.0f, glm::vec3(0.0, 1.0, 0.0));
-					model = glm::rotate(model, 0.0f, glm::vec3(0.0, 0.0, 1.0));
-					model = glm::scale(model, glm::vec3(1,1,1));
-					glUniformMatrix4fv(glGetUniformLocation(shadowShader, "model"), 1, GL_FALSE, glm::value_ptr(model));
-
-					// render 1 chunk
-					//glBindTexture(GL_TEXTURE_2D, textureAtlas);
-					glUniform2i(glGetUniformLocation(shadowShader, "chunkPos"), chunk.posx, chunk.posz);
-					glUniform2i(glGetUniformLocation(shadowShader, "atlasSize"), textureAtlas.width, textureAtlas.height);
-
-
-					glBindVertexArray(chunk.mesh.VAO);
-					glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, chunk.mesh.faceCount);
-
-					glBindVertexArray(0);
-				}
-			}
+			// все чанки одним вызовом, смещение чанка берется из граней
+			double submitStart = glfwGetTime();
+			lastDrawCallsShadow = drawBlockDrawList(shadowDrawList);
+			lastSubmitShadowUS = (float)((glfwGetTime() - submitStart) * 1000000.0);
 
 			glBindFramebuffer(GL_FRAMEBUFFER, 0);
 			//glCullFace(GL_BACK);
@@ -773,24 +1911,24 @@ void CubesMainGameLoop(GLFWwindow* window) {
 		else glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
 		// TEST
-		//polyMeshUseShader(projection, view, lightSpaceMatrix);
+		//polyMeshUseShader();
 		//for (size_t i = 0; i < ArraySize(testObjects); i++)
 		//{
 		//	TestPolyObject* o = &testObjects[i];
 		//	polyMeshApplyTransform(o->pos, o->rot, o->scale);
-		//	polyMeshDraw(*o->mesh, testTexture, depthMap, sunDir, sunColor, ambientColor);
+		//	polyMeshDraw(*o->mesh, testTexture, depthMap);
 
 		//}
 		// TEST
 
 		// draw sun and moon
 		glDepthMask(GL_FALSE); // render on background
-		useSpriteShader(projection, view);
+		useSpriteShader();
 		spriteApplyTransform(player.camera.pos + sunDir, 0.3, true);
 		drawSprite(sunSprite, textureAtlas.ID);
 		spriteApplyTransform(player.camera.pos + (sunDir * -1.0f), 0.3, true);
 		drawSprite(moonSprite, textureAtlas.ID);
-		glDepthMask(TRUE);
+		glDepthMask(GL_TRUE);
 
 #define DEBUG_BLOCK 0
 #define RENDER_CHUNKS 1
@@ -800,27 +1938,24 @@ void CubesMainGameLoop(GLFWwindow* window) {
 		//drawMesh(box, textureAtlas, { 0,0 }, { atlasWidth, atlasHeight });
 
 		{
-			useCubeShader(sunDir, sunColor, moonColor, ambientColor, projection, view, lightSpaceMatrix);
+			useCubeShader();
 			cubeApplyTransform(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), glm::vec3(1, 1, 1));
 			drawBlockMesh(testChunk.mesh, textureAtlas, depthMap, { 0,0 }, { atlasWidth, atlasHeight });
 		}
 
 #elif RENDER_CHUNKS
-		//  
+		// можно отрисовывать
 		// draw chunks
-		useCubeShader(sunDir, sunColor, moonColor, ambientColor, projection, view, lightSpaceMatrix);
-		for (size_t c = 0; c < chunksCount; c++)
+		useCubeShader();
+		cubeApplyTransform(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), glm::vec3(1, 1, 1));
+		bindCubeTextures(textureAtlas, depthMap);
+		if (occlusionCulling)
+			finishOcclusion();
+		lastVisibleMain = buildChunkDrawList(chunkDrawList, chunkVisible, occlusionCulling ? &occlusionBuffer : NULL, &lastOccludedMain);
 		{
-			Chunk& chunk = chunks[c];
-			if (chunk.generated && !chunk.mesh.needUpdate) {
-				Block* blocks = chunk.blocks;
-				cubeApplyTransform(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), glm::vec3(1, 1, 1));
-
-				// render 1 chunk
-				drawBlockMesh(
-					chunks[c].mesh, textureAtlas, depthMap,
-					glm::ivec2(chunks[c].posx, chunks[c].posz));
-			}
+			double submitStart = glfwGetTime();
+			lastDrawCallsMain = drawBlockDrawList(chunkDrawList);
+			lastSubmitMainUS = (float)((glfwGetTime() - submitStart) * 1000000.0);
 		}
 #endif	
 
@@ -834,7 +1969,7 @@ void CubesMainGameLoop(GLFWwindow* window) {
 		}
 #endif
 		// draw debug geometry
-		useFlatShader(projection, view);
+		useFlatShader();
 		// chunk borders
 		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 		if (debugView_cb) {
@@ -846,7 +1981,7 @@ void CubesMainGameLoop(GLFWwindow* window) {
 			}
 		}
 
-		Block* lookAtBlock;
+		bool lookAtBlock;
 		glm::vec3 lookAtBlockPos;
 		static int maxDist = 10;
 
@@ -856,59 +1991,55 @@ void CubesMainGameLoop(GLFWwindow* window) {
 #if GRAVITY
 		// gravity, ground collision
 		player.camera.pos.y -= 20 * deltaTime;
-		Block* belowBlock;
-		do {
-			belowBlock = gameWorld.peekBlockFromPos(glm::vec3(player.camera.pos.x - chunk.posx, player.camera.pos.y - 2, player.camera.pos.z - chunk.posz));
-			if (belowBlock && belowBlock->type != btAir)
-				player.camera.pos.y = (int)player.camera.pos.y + 1;
-			else
-				break;
-		} while (belowBlock);
+		BlockType belowBlock;
+		while (gameWorld.peekBlockFromPos(glm::vec3(player.camera.pos.x, player.camera.pos.y - 2, player.camera.pos.z), &belowBlock) && belowBlock != btAir)
+			player.camera.pos.y = (int)player.camera.pos.y + 1;
 #endif
 
 		// destroying / building blocks
 		lookAtBlock = gameWorld.peekBlockFromRay(player.camera.pos, player.camera.front, maxDist, &lookAtBlockPos);
 		if (lookAtBlock) {
+			Chunk* editedChunk = NULL;
+
 			flatApplyTransform(lookAtBlockPos, glm::vec3(0, 0, 0), glm::vec3(1.01, 1.01, 1.01));
 			drawFlat(box, glm::vec3(0, 0, 0));
 
+			glm::vec3 editedBlockPos = lookAtBlockPos;
 			if (gameInputs.attack) {
-				lookAtBlock->type = btAir; //  
-				updateLighting(*chunk);
-				
-				meshChunk(*chunk);
-				updateBlockMesh(*chunkMesh);
+				editedChunk = gameWorld.setBlockFromPos(lookAtBlockPos, btAir); // уничтожение блока
 			}
 
 			if (gameInputs.placeBlock) {
 				CubeSide side = BlockSideCastRay(player.camera.pos, player.camera.front, lookAtBlockPos);
-				Block* placeBlock = 0;
-				// TODO:     
+				glm::vec3 placeOffset(0, 0, 0);
 				switch (side) {
-				case cubeTop:		placeBlock = lookAtBlock + CHUNK_SX * CHUNK_SZ; dbgprint("top\n"); break;
-				case cubeBottom:	placeBlock = lookAtBlock - CHUNK_SX * CHUNK_SZ; dbgprint("bottom\n"); break;
-				case cubeFront:		placeBlock = lookAtBlock - CHUNK_SX;  dbgprint("front\n"); break;
-				case cubeBack:		placeBlock = lookAtBlock + CHUNK_SX;  dbgprint("back\n"); break;
-				case cubeRight:		placeBlock = lookAtBlock + 1;  dbgprint("right\n"); break;
-				case cubeLeft:		placeBlock = lookAtBlock - 1;  dbgprint("left\n"); break;
+				case cubeTop:		placeOffset = glm::vec3(0, 1, 0); dbgprint("top\n"); break;
+				case cubeBottom:	placeOffset = glm::vec3(0, -1, 0); dbgprint("bottom\n"); break;
+				case cubeFront:		placeOffset = glm::vec3(0, 0, -1);  dbgprint("front\n"); break;
+				case cubeBack:		placeOffset = glm::vec3(0, 0, 1);  dbgprint("back\n"); break;
+				case cubeRight:		placeOffset = glm::vec3(1, 0, 0);  dbgprint("right\n"); break;
+				case cubeLeft:		placeOffset = glm::vec3(-1, 0, 0);  dbgprint("left\n"); break;
 				}
 
-				if (placeBlock)
-					placeBlock->type = btStone;
-
-				
-				// TODO:       ,       
-				updateLighting(*chunk);
+				// блок ставится по мировой позиции, поэтому может попасть и в соседний чанк
+				if (side != cubeNone) {
+					editedBlockPos = lookAtBlockPos + placeOffset;
+					editedChunk = gameWorld.setBlockFromPos(editedBlockPos, btStone);
+				}
+			}
 
-				meshChunk(*chunk);
-				updateBlockMesh(*chunkMesh);
+			// меш перестраивается на рабочем потоке, до отправки нового рисуется прежний
+			if (editedChunk) {
+				updateLighting(*editedChunk);
+				glm::ivec3 blockPos = glm::floor(editedBlockPos);
+				remeshEditedBlock(editedChunk - chunks, blockPos - glm::ivec3(editedChunk->posx, 0, editedChunk->posz));
 			}
 		}
 
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
 		// axis
-		useFlatShader(projection, view); // TODO: uniform         ?    uniform buffer
+		useFlatShader();
 		flatApplyTransform(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), glm::vec3(1.5, 0.2, 0.2));
 		drawFlat(box, glm::vec3(1, 0, 0));		
 		flatApplyTransform(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), glm::vec3(0.2, 1.5, 0.2));
@@ -917,7 +2048,7 @@ void CubesMainGameLoop(GLFWwindow* window) {
 		drawFlat(box, glm::vec3(0, 0, 1));
 		
 		// draw ui
-		// TODO:   uv  
+		// TODO: верно устанавливать uv элементов интерфейса
 		uiStart(window);
 		uiDrawElement(uiAtlas.ID, glm::vec3(0, 0, 0), glm::vec3(64, 64, 1), uiUV[uiCross].scale, uiUV[uiCross].offset); // cursor
 		
@@ -958,8 +2089,32 @@ void CubesMainGameLoop(GLFWwindow* window) {
 		guiArgs.currentChunkPos = glm::vec2(currentChunkPosX, currentChunkPosZ);
 		cubes_gui(guiArgs);
 
+		endFrameTimer((float)((glfwGetTime() - frameStart) * 1000.0), deltaTime * 1000.0f);
 		glfwSwapBuffers(window);
 	}
+
+	// ожидающие задачи генерации отменяются: их работы в очередях завершатся, ничего не делая
+	{
+		std::lock_guard<std::mutex> lock(chunkGenTasksMutex);
+		chunkGenTaskCount = 0;
+	}
+	chunkGenDeferred.count = 0;
+
+	// правки в загруженных чанках сохраняются при выходе так же, как при выгрузке
+	for (size_t i = 0; i < chunksCount; i++) {
+		std::lock_guard<std::mutex> lock(chunks[i].lock);
+		if (chunks[i].modified && chunks[i].generated) {
+			regionStorage.queueSave(chunks[i]);
+			chunks[i].modified = false;
+		}
+	}
+	while (regionStorage.pendingSaveCount() > 0)
+		if (!jobSystem.runPendingJob())
+			std::this_thread::yield();
+	// файлы регионов закрываются после остановки рабочих потоков: начатая задача генерации
+	// может еще читать чанк и заново открыть файл
+	jobSystem.shutdown();
+	regionStorage.shutdown();
 }
 
 static void cubes_gui(GuiArgs& args)
@@ -970,6 +2125,7 @@ static void cubes_gui(GuiArgs& args)
 
 	if (ImGui::Button("Rebuild shaders")) {
 		initShaders();
+		uiRebuildShader();
 	}
 	ImGui::Separator();
 
@@ -993,10 +2149,238 @@ static void cubes_gui(GuiArgs& args)
 	ImGui::SliderFloat("Shadow light dist", &shadowLightDist, 0, 50);
 
 	ImGui::Separator();
-	int taskCount = chunkGenQueue.taskCount;
-	int completedCount = chunkGenQueue.taskCompletionCount;
-	ImGui::InputInt("Chunk gen task count", &taskCount);
-	ImGui::InputInt("Chunk gen task completed", &completedCount);
+	ImGui::Text("Frame time: %.2f ms (%.0f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+	static const char* meshingModeNames[meshingCOUNT] = { "Naive", "Greedy" };
+	int meshingModeIndex = meshingMode;
+	if (ImGui::Combo("Meshing", &meshingModeIndex, meshingModeNames, meshingCOUNT)) {
+		meshingMode = (MeshingMode)meshingModeIndex;
+		remeshAllChunks();
+	}
+	u64 totalFaces = 0;
+	for (size_t i = 0; i < chunksCount; i++)
+		totalFaces += chunks[i].mesh.faceCount;
+	ImGui::Text("Block faces: %llu", totalFaces);
+	{
+		// память под грани против прежнего выделения CHUNK_SIZE * 6 граней на чанк на ЦП и на ГПУ
+		size_t cpuFaceMemory = 0, gpuFaceMemory = 0;
+		for (size_t i = 0; i < chunksCount; i++) {
+			cpuFaceMemory += chunks[i].mesh.faceSize * sizeof(BlockFaceInstance);
+			gpuFaceMemory += chunks[i].mesh.gpuFaceSize * sizeof(BlockFaceInstance);
+		}
+		float preallocatedMB = (float)CHUNK_SIZE * 6 * sizeof(BlockFaceInstance) * gameWorld.loadedChunksCount / (1024 * 1024);
+		ImGui::Text("Face buffers: CPU %.2f MB, GPU %.2f MB (preallocated: %.1f MB each)",
+			cpuFaceMemory / (1024.0f * 1024.0f), gpuFaceMemory / (1024.0f * 1024.0f), preallocatedMB);
+
+		// объем отправки граней на ГПУ за последнюю секунду
+		static double uploadRateTime = 0;
+		static u64 uploadRateBytes = 0;
+		static float uploadKBPerSec = 0;
+		double now = glfwGetTime();
+		if (now - uploadRateTime >= 1.0) {
+			uploadKBPerSec = (blockMeshUploadedBytes - uploadRateBytes) / 1024.0f / (float)(now - uploadRateTime);
+			uploadRateBytes = blockMeshUploadedBytes;
+			uploadRateTime = now;
+		}
+		ImGui::Text("Face uploads: %.1f KB/s", uploadKBPerSec);
+
+		RangeAllocator& allocator = blockMeshBuffer.allocator;
+		ImGui::Text("Face buffer: %u / %u faces used, %d free ranges (largest %u)",
+			allocator.used, allocator.capacity, allocator.freeCount, allocator.largestFree());
+		ImGui::Text("Chunk draws (%s): main %d calls, %.0f us; shadow %d calls, %.0f us",
+			blockMultiDrawIndirect ? "multi-draw indirect" : "GL 3.3 fallback",
+			lastDrawCallsMain, lastSubmitMainUS, lastDrawCallsShadow, lastSubmitShadowUS);
+
+		int culledMain = lastCullCandidates - lastVisibleMain, culledShadow = lastCullCandidates - lastVisibleShadow;
+		ImGui::Checkbox("Frustum culling", &frustumCulling);
+		int cullSimdIndex = cullSimdLevel;
+		if (ImGui::Combo("Culling SIMD", &cullSimdIndex, cullSimdLevelNames, cullSimdCOUNT))
+			cullSimdLevel = (CullSimdLevel)cullSimdIndex;
+		ImGui::Text("Chunks: main %d visible / %d culled, shadow %d visible / %d culled (%.1f us)",
+			lastVisibleMain, culledMain, lastVisibleShadow, culledShadow, lastCullUS);
+
+		ImGui::Checkbox("Connectivity culling", &connectivityCulling);
+		if (connectivityCulling) {
+			ImGui::Text("Unreachable chunks skipped: %d (max %d), BFS %.0f us",
+				lastConnectivitySkipped, maxConnectivitySkipped, lastConnectivityUS);
+			ImGui::SameLine();
+			if (ImGui::Button("Reset max"))
+				maxConnectivitySkipped = 0;
+		}
+
+		ImGui::Checkbox("Occlusion culling", &occlusionCulling);
+		ImGui::SliderInt("Max occluders", &maxOccluders, 0, 2048);
+		if (occlusionCulling) {
+			ImGui::Text("Occluded chunks: %d, occluder faces: %d, depth raster %.0f us (worker)",
+				lastOccludedMain, occlusionBuffer.occluderCount, lastOcclusionRasterUS);
+			if (ImGui::Button("Occlusion self-test"))
+				runOcclusionSelfTest();
+			if (occlusionSelfTestDone) {
+				const OcclusionSelfTest& test = lastOcclusionSelfTest;
+				ImGui::Text("Self-test: %d chunks, Hi-Z culled %d, reference %d, false culls %d",
+					test.tested, test.culled, test.referenceCulled, test.falseCulls);
+			}
+		}
+	}
+	{
+		// память под блоки: палитра и упакованные индексы против массива Block на каждый блок
+		size_t blockMemory = 0;
+		int sectionsByIndexBits[17] = {};
+		int emptySections = 0;
+		for (size_t i = 0; i < chunksCount; i++) {
+			blockMemory += chunks[i].blocks.memoryUsage();
+			for (int s = 0; s < CHUNK_SECTIONS; s++) {
+				sectionsByIndexBits[chunks[i].blocks.sections[s].bitsPerIndex]++;
+				emptySections += chunks[i].blocks.isSectionEmpty(s);
+			}
+		}
+		ImGui::Text("Block storage: %.2f KB per chunk (unpacked %.2f KB), total %.1f KB", blockMemory / 1024.0f / gameWorld.loadedChunksCount,
+			sizeof(Block) * CHUNK_SIZE / 1024.0f, blockMemory / 1024.0f);
+		ImGui::Text("Sections by index bits: 0: %d (air: %d), 1: %d, 2: %d, 4: %d, 8: %d", sectionsByIndexBits[0], emptySections,
+			sectionsByIndexBits[1], sectionsByIndexBits[2], sectionsByIndexBits[4], sectionsByIndexBits[8]);
+	}
+	ImGui::Text("Remesh all chunks: %.2f ms", lastRemeshAllMS);
+
+	ImGui::Separator();
+	if (ImGui::Button("Generation benchmark"))
+		generationBenchmark();
+	if (genBenchmark.done) {
+		ImGui::Text("Per-voxel scalar noise: %.1f chunks/s", genBenchmark.perVoxelChunksPerSec);
+		for (int level = 0; level < noiseSimdCOUNT; level++) {
+			if (genBenchmark.chunksPerSec[level] == 0)
+				continue;
+			ImGui::Text("Batched noise, %s: %.1f chunks/s (x%.2f), %s", noiseSimdLevelNames[level], genBenchmark.chunksPerSec[level],
+				genBenchmark.chunksPerSec[level] / genBenchmark.perVoxelChunksPerSec, genBenchmark.identical[level] ? "identical" : "MISMATCH");
+		}
+	}
+	if (genBenchmark.done) {
+		for (int s = 0; s < 3; s++)
+			ImGui::Text("Cave/ore noise lattice %d: %.1f chunks/s (x%.2f), cave IoU %.3f, ore IoU %.3f", NOISE_LATTICE_MIN_STEP << s,
+				genBenchmark.latticeChunksPerSec[s], genBenchmark.latticeChunksPerSec[s] / genBenchmark.chunksPerSec[noiseSimdLevel],
+				genBenchmark.caveIoU[s], genBenchmark.oreIoU[s]);
+	}
+	int simdLevel = noiseSimdLevel;
+	if (ImGui::Combo("Noise SIMD", &simdLevel, noiseSimdLevelNames, detectNoiseSimdLevel() + 1))
+		noiseSimdLevel = (NoiseSimdLevel)simdLevel;
+	{
+		// шаг решетки 3D шума применяется к задачам генерации, отправленным после изменения
+		static const char* latticeStepNames[] = { "1 (full)", "2", "4", "8" };
+		int stepIndex = 0;
+		while ((1 << stepIndex) < gameWorld.noise3DStep)
+			stepIndex++;
+		if (ImGui::Combo("Cave/ore noise step", &stepIndex, latticeStepNames, 4))
+			gameWorld.noise3DStep = 1 << stepIndex;
+	}
+	if (ImGui::Button("Generation determinism test"))
+		generationDeterminismTest();
+	if (determinismTest.done) {
+		ImGui::SameLine();
+		if (determinismTest.mismatchedChunks == 0)
+			ImGui::Text("1 vs %d threads: identical (%d chunks)", jobSystem.workerCount, DETERMINISM_TEST_CHUNKS);
+		else
+			ImGui::Text("1 vs %d threads: %d of %d chunks differ", jobSystem.workerCount, determinismTest.mismatchedChunks, DETERMINISM_TEST_CHUNKS);
+	}
+	{
+		int surface = gameWorld.getSurfaceHeight((int)floorf(player.camera.pos.x), (int)floorf(player.camera.pos.z));
+		ImGui::Text("Surface height under player: %d", surface);
+	}
+
+	{
+		int radius = renderDistance;
+		ImGui::SetNextItemWidth(200);
+		if (ImGui::SliderInt("Render distance", &radius, 1, MAX_LOAD_RADIUS))
+			applyRenderDistance(radius);
+		ImGui::SameLine();
+		ImGui::Checkbox("Auto", &autoRenderDistance);
+		ImGui::SetNextItemWidth(200);
+		ImGui::SliderFloat("Target frame, ms", &targetFrameMS, 4.0f, 50.0f);
+		ImGui::SetNextItemWidth(200);
+		ImGui::DragIntRange2("Auto range", &minAutoRenderDistance, &maxAutoRenderDistance, 0.2f, 1, MAX_LOAD_RADIUS);
+		ImGui::Text("Load radius: %d chunks, %s, %d of %d slots, last change %.1f us", renderDistance, circularLoadRadius ? "circle" : "square",
+			gameWorld.loadedChunksCount, chunksCount, lastRenderDistanceChangeUS);
+		ImGui::Text("Frame: CPU %.2f ms, GPU %.2f ms, controller avg %.2f ms", lastCpuFrameMS, lastGpuFrameMS, lastControllerCostMS);
+		char overlay[32];
+		snprintf(overlay, sizeof(overlay), "%.1f ms", frameTimeHistory[(frameHistoryPos + FRAME_HISTORY - 1) % FRAME_HISTORY]);
+		ImGui::PlotLines("Frame time", frameTimeHistory, FRAME_HISTORY, frameHistoryPos, overlay, 0.0f, targetFrameMS * 2, ImVec2(0, 50));
+		snprintf(overlay, sizeof(overlay), "target %.1f ms", targetFrameMS);
+		ImGui::PlotLines("Frame cost", frameCostHistory, FRAME_HISTORY, frameHistoryPos, overlay, 0.0f, targetFrameMS * 2, ImVec2(0, 50));
+		snprintf(overlay, sizeof(overlay), "%d", renderDistance);
+		ImGui::PlotLines("Render distance", renderDistanceHistory, FRAME_HISTORY, frameHistoryPos, overlay, 0.0f, (float)MAX_LOAD_RADIUS, ImVec2(0, 50));
+	}
+	ImGui::Text("Chunk streaming: last step %d chunks, %.1f us", lastStreamPlaced, lastStreamUS);
+	ImGui::Text("Worker threads: %d", jobSystem.workerCount);
+	ImGui::Text("Chunk gen tasks: %d submitted, %d completed, %d pending",
+		chunkGenSubmitted.load(), chunkGenCompleted.load(), chunkGenTaskCount);
+	ImGui::Text("Stale tasks: %d cancelled before start, %d discarded after work (%.1f ms wasted)",
+		chunkGenSkipped.load(), chunkGenWasted.load(), chunkGenWastedUS.load() / 1000.0f);
+	ImGui::Text("Remesh requests merged into waiting tasks: %d", remeshCoalesced);
+	ImGui::Text("Task heap overflow: %d stale tasks pruned, %d tasks deferred (%d waiting)",
+		chunkGenPruned, chunkGenDeferredTotal, chunkGenDeferred.count);
+	{
+		int patches = remeshPatchCount.load(), fulls = remeshFullCount.load();
+		ImGui::Text("Edit remesh, patch: %d, %.1f us, %.2f KB avg; full: %d, %.1f us, %.2f KB avg", patches,
+			patches > 0 ? remeshPatchUS.load() / (float)patches : 0.0f, patches > 0 ? remeshPatchBytes.load() / 1024.0f / patches : 0.0f, fulls,
+			fulls > 0 ? remeshFullUS.load() / (float)fulls : 0.0f, fulls > 0 ? remeshFullBytes.load() / 1024.0f / fulls : 0.0f);
+	}
+	if (ImGui::Button("Edit latency test"))
+		runEditLatencyTest(player.camera.pos);
+	if (editLatencyTest.done) {
+		EditLatencyTest& test = editLatencyTest;
+		ImGui::Text("Patch: %.1f us + upload %.1f us (%.2f KB); full: %.1f us + upload %.1f us (%.2f KB); %d edits, %d mismatches, %d connectivity mismatches",
+			test.patchUS, test.patchUploadUS, test.patchKB, test.fullUS, test.fullUploadUS, test.fullKB, test.edits, test.mismatches, test.connectivityMismatches);
+	}
+	{
+		RegionStorage& storage = regionStorage;
+		int saved = storage.savedChunks.load(), loaded = storage.loadedChunks.load();
+		ImGui::Text("Region files: %d saved (%.1f us, %.2f KB avg), %d loaded (%.1f us avg), %d saves pending", saved,
+			saved > 0 ? storage.saveUS.load() / (float)saved : 0.0f, saved > 0 ? storage.savedBytes.load() / 1024.0f / saved : 0.0f,
+			loaded, loaded > 0 ? storage.loadUS.load() / (float)loaded : 0.0f, storage.pendingSaveCount());
+	}
+	if (ImGui::Button("Region file benchmark"))
+		runRegionBenchmark();
+	if (regionBenchmark.done) {
+		RegionBenchmark& test = regionBenchmark;
+		ImGui::Text("Save: %.0f chunks/s (%.1f MB/s), load: %.0f chunks/s (%.1f MB/s), %.2f KB/chunk (%.2f KB in file), %d mismatches",
+			test.saveChunksPerSec, test.saveMBPerSec, test.loadChunksPerSec, test.loadMBPerSec, test.payloadKB, test.fileKB, test.mismatches);
+	}
+	int inViewCount = chunkGenInViewCount.load();
+	ImGui::Text("In-view chunk latency: %.2f ms avg (%d chunks)",
+		inViewCount > 0 ? chunkGenInViewLatencyUS.load() / (inViewCount * 1000.0f) : 0.0f, inViewCount);
+	if (ImGui::Button("Reset latency")) {
+		chunkGenInViewCount = 0;
+		chunkGenInViewLatencyUS = 0;
+	}
+	ImGui::Checkbox("Prefetch", &prefetchEnabled);
+	ImGui::SameLine();
+	ImGui::SetNextItemWidth(120);
+	ImGui::SliderFloat("Look-ahead, s", &prefetchLookaheadSec, 0.25f, 4.0f);
+	ImGui::SameLine();
+	ImGui::SetNextItemWidth(120);
+	ImGui::SliderInt("Budget", &prefetchBudget, 0, CHUNK_PREFETCH_MAX);
+	ImGui::Text("Camera velocity: %.1f blocks/s, prefetched: %d cached", glm::length(cameraVelocity), gameWorld.prefetchedCount);
+	ImGui::Text("Prefetch: %d issued, %d promoted (%d ready at entry), %d evicted",
+		prefetchIssued, prefetchPromoted, prefetchReadyAtEntry, prefetchEvicted);
+	ImGui::Text("Enter radius to first draw: %.2f ms avg, %.2f ms max (%d chunks)",
+		firstDrawCount > 0 ? (float)(firstDrawLatencyMS / firstDrawCount) : 0.0f, firstDrawMaxMS, firstDrawCount);
+	if (ImGui::Button("Reset first draw")) {
+		firstDrawLatencyMS = 0;
+		firstDrawCount = 0;
+		firstDrawMaxMS = 0;
+		prefetchIssued = prefetchPromoted = prefetchReadyAtEntry = prefetchEvicted = 0;
+	}
+	ImGui::Combo("Upload budget", &uploadBudgetMode, "Time\0Bytes\0");
+	if (uploadBudgetMode == uploadBudgetTime)
+		ImGui::SliderFloat("Upload budget, ms", &uploadBudgetMS, 0.1f, 16.0f);
+	else
+		ImGui::SliderInt("Upload budget, KB", &uploadBudgetKB, 16, 16384);
+	ImGui::Text("Mesh uploads: %d this frame (%.1f KB, %.0f us), %d waiting (max %d)",
+		lastUploadCount, lastUploadBytes / 1024.0f, lastUploadUS, lastUploadQueueDepth, maxUploadQueueDepth);
+	if (ImGui::Button("Reset max queue depth"))
+		maxUploadQueueDepth = 0;
+	if (ImGui::Button("Job system stress test"))
+		jobStressTest();
+	ImGui::Text("Stress test: %llu jobs, %.2f ms, %.1f M jobs/s, %s",
+		jobStress.jobCount, jobStress.ms, jobStress.ms > 0 ? jobStress.jobCount / (jobStress.ms * 1000.0f) : 0.0f,
+		jobStress.passed ? "OK" : "FAILED");
 
 
 
@@ -1006,17 +2390,7 @@ static void cubes_gui(GuiArgs& args)
 
 	if (ImGui::Button("VSync")) {
 		vsyncOn = !vsyncOn;
-		typedef BOOL(APIENTRY* PFNWGLSWAPINTERVALPROC)(int);
-		PFNWGLSWAPINTERVALPROC wglSwapIntervalEXT = 0;
-
-		const char* extensions = (char*)glGetString(GL_EXTENSIONS);
-
-		wglSwapIntervalEXT = (PFNWGLSWAPINTERVALPROC)wglGetProcAddress("wglSwapIntervalEXT");
-
-		if (wglSwapIntervalEXT) {
-			if (vsyncOn) wglSwapIntervalEXT(1);
-			else wglSwapIntervalEXT(0);
-		}
+		glfwSwapInterval(vsyncOn ? 1 : 0);
 	}
 	ImGui::Separator();
 	if (ImGui::TreeNodeEx("Chunks")) {
@@ -1,6 +1,5 @@
 #include <stdlib.h>
 #include <assert.h>
-#include <intrin.h>
 #include "DataStructures.h"
 
 void MemoryArena::init(u32 capacity) {
@@ -14,48 +13,282 @@ void* MemoryArena::alloc(u32 allocSize) {
 	return (u8*)memory + size;
 }
 
-WorkQueue::WorkQueue(int maxSemaphore) {
-	this->semaphore = CreateSemaphore(0, 0, maxSemaphore, 0);
-	this->taskCompletionCount = 0;
-	this->taskCount = 0;
-	this->nextTask = 0;
+#pragma region RangeAllocator
+void RangeAllocator::init(u32 capacity) {
+	this->capacity = 0;
+	used = 0;
+	freeRanges = NULL;
+	freeCount = freeCapacity = 0;
+	grow(capacity);
 }
 
-void WorkQueue::addTask() {
-	// TODO: ?
-	_WriteBarrier();
-	_mm_sfence();
-	taskCount++;
-	ReleaseSemaphore(semaphore, 1, 0);
+bool RangeAllocator::alloc(u32 size, u32* outOffset) {
+	assert(size > 0);
+	for (int i = 0; i < freeCount; i++) {
+		Range& range = freeRanges[i];
+		if (range.size < size)
+			continue;
+
+		*outOffset = range.offset;
+		range.offset += size;
+		range.size -= size;
+		if (range.size == 0) {
+			freeCount--;
+			for (int j = i; j < freeCount; j++)
+				freeRanges[j] = freeRanges[j + 1];
+		}
+		used += size;
+		return true;
+	}
+	return false;
+}
+
+void RangeAllocator::release(u32 offset, u32 size) {
+	assert(size > 0 && offset + size <= capacity);
+	used -= size;
+
+	// первый свободный диапазон правее освобождаемого
+	int i = 0;
+	while (i < freeCount && freeRanges[i].offset < offset)
+		i++;
+	assert(i == freeCount || offset + size <= freeRanges[i].offset);
+	assert(i == 0 || freeRanges[i - 1].offset + freeRanges[i - 1].size <= offset);
+
+	bool mergeLeft = i > 0 && freeRanges[i - 1].offset + freeRanges[i - 1].size == offset;
+	bool mergeRight = i < freeCount && offset + size == freeRanges[i].offset;
+	if (mergeLeft && mergeRight) {
+		freeRanges[i - 1].size += size + freeRanges[i].size;
+		freeCount--;
+		for (int j = i; j < freeCount; j++)
+			freeRanges[j] = freeRanges[j + 1];
+	}
+	else if (mergeLeft)
+		freeRanges[i - 1].size += size;
+	else if (mergeRight) {
+		freeRanges[i].offset = offset;
+		freeRanges[i].size += size;
+	}
+	else {
+		if (freeCount == freeCapacity) {
+			freeCapacity = freeCapacity ? freeCapacity * 2 : 64;
+			freeRanges = (Range*)realloc(freeRanges, freeCapacity * sizeof(Range));
+		}
+		for (int j = freeCount; j > i; j--)
+			freeRanges[j] = freeRanges[j - 1];
+		freeRanges[i] = { offset, size };
+		freeCount++;
+	}
+}
+
+void RangeAllocator::grow(u32 newCapacity) {
+	assert(newCapacity >= capacity);
+	u32 oldCapacity = capacity;
+	capacity = newCapacity;
+	if (newCapacity > oldCapacity) {
+		used += newCapacity - oldCapacity; // release вычтет
+		release(oldCapacity, newCapacity - oldCapacity);
+	}
+}
+
+u32 RangeAllocator::largestFree() {
+	u32 largest = 0;
+	for (int i = 0; i < freeCount; i++)
+		largest = freeRanges[i].size > largest ? freeRanges[i].size : largest;
+	return largest;
+}
+#pragma endregion
+
+#pragma region WorkStealingDeque
+void WorkStealingDeque::init(s64 capacity) {
+	assert((capacity & (capacity - 1)) == 0);
+	this->capacity = capacity;
+	slots = new Slot[capacity];
+	top.store(0, std::memory_order_relaxed);
+	bottom.store(0, std::memory_order_relaxed);
+}
+
+bool WorkStealingDeque::push(const Job& job) {
+	s64 b = bottom.load(std::memory_order_relaxed);
+	s64 t = top.load(std::memory_order_acquire);
+	if (b - t >= capacity)
+		return false;
+
+	Slot& slot = slots[b & (capacity - 1)];
+	slot.proc.store(job.proc, std::memory_order_relaxed);
+	slot.data.store(job.data, std::memory_order_relaxed);
+	slot.counter.store(job.counter, std::memory_order_relaxed);
+	// задача должна быть записана до того, как ее увидят другие потоки
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+	return true;
+}
+
+bool WorkStealingDeque::pop(Job* job) {
+	s64 b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	s64 t = top.load(std::memory_order_relaxed);
+
+	if (t > b) { // очередь пуста
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return false;
+	}
+
+	Slot& slot = slots[b & (capacity - 1)];
+	job->proc = slot.proc.load(std::memory_order_relaxed);
+	job->data = slot.data.load(std::memory_order_relaxed);
+	job->counter = slot.counter.load(std::memory_order_relaxed);
+
+	if (t == b) {
+		// последняя задача, за нее могут соревноваться другие потоки
+		bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return won;
+	}
+	return true;
+}
+
+bool WorkStealingDeque::steal(Job* job) {
+	s64 t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	s64 b = bottom.load(std::memory_order_acquire);
+	if (t >= b)
+		return false;
+
+	Slot& slot = slots[t & (capacity - 1)];
+	job->proc = slot.proc.load(std::memory_order_relaxed);
+	job->data = slot.data.load(std::memory_order_relaxed);
+	job->counter = slot.counter.load(std::memory_order_relaxed);
+
+	// задачу мог забрать владелец или другой поток
+	return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+#pragma endregion
+
+#pragma region JobSystem
+static thread_local int currentWorkerIndex = -1; // -1 для потоков, не являющихся рабочими
+
+static u32 randomNext() {
+	static thread_local u32 state = 0x9E3779B9u ^ (u32)(size_t)&state;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+void JobSystem::init(int workerCount) {
+	if (workerCount <= 0) {
+		// один поток оставляем основному циклу
+		workerCount = (int)std::thread::hardware_concurrency() - 1;
+		if (workerCount < 1)
+			workerCount = 1;
+	}
+	this->workerCount = workerCount;
+
+	queuedJobs.store(0);
+	sleepingWorkers.store(0);
+	quit.store(false);
+
+	sharedQueue.init(1 << 14);
+	deques = new WorkStealingDeque[workerCount];
+	for (int i = 0; i < workerCount; i++)
+		deques[i].init(1 << 12);
+
+	threads = new std::thread[workerCount];
+	for (int i = 0; i < workerCount; i++)
+		threads[i] = std::thread(&JobSystem::workerProc, this, i);
 }
 
-void WorkQueue::clearTasks() {
-	taskCount = nextTask = taskCompletionCount = 0;
+void JobSystem::shutdown() {
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		quit.store(true);
+	}
+	wakeCondition.notify_all();
+	for (int i = 0; i < workerCount; i++)
+		threads[i].join();
 }
 
-QueueTaskItem WorkQueue::getNextTask() {
-	QueueTaskItem res;
-	res.valid = false;
+void JobSystem::submit(JobProc proc, void* data, JobCounter* counter) {
+	Job job = { proc, data, counter };
+	if (counter)
+		counter->fetch_add(1, std::memory_order_relaxed);
+
+	// рабочий поток кладет задачу в свою очередь, остальные - в общую
+	bool queued = false;
+	if (currentWorkerIndex != -1)
+		queued = deques[currentWorkerIndex].push(job);
+	while (!queued) {
+		queued = sharedQueue.push(job);
+		if (!queued && !runPendingJob()) // очередь заполнена: помогаем ее разобрать
+			std::this_thread::yield();
+	}
+
+	queuedJobs.fetch_add(1, std::memory_order_seq_cst);
+	if (sleepingWorkers.load(std::memory_order_seq_cst) > 0) {
+		// захват мьютекса гарантирует, что поток не пропустит сигнал между проверкой и засыпанием
+		{ std::lock_guard<std::mutex> lock(sleepMutex); }
+		wakeCondition.notify_one();
+	}
+}
 
-	if (nextTask < taskCount) {
-		res.taskIndex = InterlockedIncrement((LONG volatile*)&nextTask) - 1;
-		res.valid = true;
-		// TODO: ?
-		_ReadBarrier();
+bool JobSystem::getJob(int workerIndex, Job* job) {
+	bool found = false;
+	if (workerIndex != -1)
+		found = deques[workerIndex].pop(job);
+	if (!found)
+		found = sharedQueue.pop(job);
+	if (!found) {
+		// пробуем украсть задачу у других потоков, начиная со случайного
+		int start = randomNext() % workerCount;
+		for (int i = 0; i < workerCount && !found; i++) {
+			int victim = (start + i) % workerCount;
+			if (victim != workerIndex)
+				found = deques[victim].steal(job);
+		}
 	}
 
-	return res;
+	if (found)
+		queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+	return found;
 }
 
-void WorkQueue::setTaskCompleted() {
-	InterlockedIncrement((LONG volatile*)&taskCompletionCount);
+static void runJob(Job& job) {
+	job.proc(job.data);
+	if (job.counter)
+		job.counter->fetch_sub(1, std::memory_order_release);
 }
 
-bool WorkQueue::workStillInProgress() {
-	return taskCount != taskCompletionCount;
+bool JobSystem::runPendingJob() {
+	Job job;
+	if (!getJob(currentWorkerIndex, &job))
+		return false;
+	runJob(job);
+	return true;
 }
 
-void WorkQueue::waitAndClear() {
-	while (taskCount != taskCompletionCount) {}
-	taskCount = nextTask = taskCompletionCount = 0;
-}
\ No newline at end of file
+void JobSystem::wait(JobCounter* counter) {
+	while (counter->load(std::memory_order_acquire) > 0) {
+		if (!runPendingJob())
+			std::this_thread::yield();
+	}
+}
+
+void JobSystem::workerProc(int workerIndex) {
+	currentWorkerIndex = workerIndex;
+	while (!quit.load(std::memory_order_relaxed)) {
+		Job job;
+		if (getJob(workerIndex, &job)) {
+			runJob(job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		sleepingWorkers.fetch_add(1, std::memory_order_seq_cst);
+		wakeCondition.wait(lock, [this] {
+			return queuedJobs.load(std::memory_order_seq_cst) > 0 || quit.load(std::memory_order_relaxed);
+		});
+		sleepingWorkers.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+#pragma endregion
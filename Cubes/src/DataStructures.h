@@ -1,5 +1,10 @@
 #pragma once
-#include <windows.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "Typedefs.h"
 
 template<typename Type>
@@ -31,27 +36,157 @@ struct MemoryArena {
 	void* alloc(u32 allocSize);
 };
 
-struct QueueTaskItem {
-	int taskIndex;
-	bool valid;
+// выделение диапазонов [offset, offset + size) внутри буфера емкостью capacity (например, буфера на ГПУ).
+// Свободные диапазоны хранятся по возрастанию смещения, выделение - первый подходящий,
+// при освобождении соседние свободные диапазоны сливаются
+struct RangeAllocator {
+	struct Range {
+		u32 offset;
+		u32 size;
+	};
+	Range* freeRanges;
+	int freeCount;
+	int freeCapacity;
+	u32 capacity;
+	u32 used;
+
+	void init(u32 capacity);
+	bool alloc(u32 size, u32* outOffset); // false - нет свободного диапазона такого размера
+	void release(u32 offset, u32 size);
+	void grow(u32 newCapacity); // [capacity, newCapacity) становится свободным
+	u32 largestFree();
 };
 
-struct WorkQueue {
-	int volatile taskCount;
-	int volatile nextTask;
-	int volatile taskCompletionCount;
-	HANDLE semaphore;
+typedef void (*JobProc)(void* data);
 
-	WorkQueue(int maxSemaphore);
+// счетчик незавершенных задач: увеличивается при отправке задачи, уменьшается после ее выполнения
+typedef std::atomic<int> JobCounter;
 
-	void addTask(); //  
-	void clearTasks();
+struct Job {
+	JobProc proc;
+	void* data;
+	JobCounter* counter; // может быть NULL
+};
 
-	QueueTaskItem getNextTask(); 	//   ,   
-	void setTaskCompleted(); //   
+// очередь задач одного рабочего потока (Chase-Lev deque):
+// push/pop вызывает только поток-владелец (с конца), steal - любые другие потоки (с начала)
+struct WorkStealingDeque {
+	struct Slot {
+		std::atomic<JobProc> proc;
+		std::atomic<void*> data;
+		std::atomic<JobCounter*> counter;
+	};
 
+	alignas(64) std::atomic<s64> top;
+	alignas(64) std::atomic<s64> bottom;
+	Slot* slots;
+	s64 capacity; // степень двойки
 
-	void waitAndClear(); //    
-	bool workStillInProgress();
+	void init(s64 capacity);
+	bool push(const Job& job); // false если очередь заполнена
+	bool pop(Job* job);
+	bool steal(Job* job);
+};
+
+// ограниченная очередь без блокировок с несколькими писателями и читателями (Vyukov MPMC)
+template<typename Type>
+struct BoundedQueue {
+	struct Cell {
+		std::atomic<u64> sequence;
+		Type item;
+	};
+
+	Cell* cells;
+	u64 mask;
+	alignas(64) std::atomic<u64> enqueuePos;
+	alignas(64) std::atomic<u64> dequeuePos;
+
+	void init(u64 capacity) {
+		assert((capacity & (capacity - 1)) == 0);
+		cells = new Cell[capacity];
+		mask = capacity - 1;
+		for (u64 i = 0; i < capacity; i++)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		enqueuePos.store(0, std::memory_order_relaxed);
+		dequeuePos.store(0, std::memory_order_relaxed);
+	}
+
+	// false если очередь заполнена
+	bool push(const Type& item) {
+		u64 pos = enqueuePos.load(std::memory_order_relaxed);
+		for (;;) {
+			Cell& cell = cells[pos & mask];
+			u64 seq = cell.sequence.load(std::memory_order_acquire);
+			s64 diff = (s64)seq - (s64)pos;
+			if (diff == 0) {
+				if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					cell.item = item;
+					cell.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0) {
+				return false; // очередь заполнена
+			}
+			else {
+				pos = enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+	}
 
-};
\ No newline at end of file
+	// false если очередь пуста
+	bool pop(Type* item) {
+		u64 pos = dequeuePos.load(std::memory_order_relaxed);
+		for (;;) {
+			Cell& cell = cells[pos & mask];
+			u64 seq = cell.sequence.load(std::memory_order_acquire);
+			s64 diff = (s64)seq - (s64)(pos + 1);
+			if (diff == 0) {
+				if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					*item = cell.item;
+					cell.sequence.store(pos + mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0) {
+				return false; // очередь пуста
+			}
+			else {
+				pos = dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// приблизительно: писатели и читатели могут работать одновременно
+	int size() const {
+		s64 size = (s64)enqueuePos.load(std::memory_order_relaxed) - (s64)dequeuePos.load(std::memory_order_relaxed);
+		return size > 0 ? (int)size : 0;
+	}
+};
+
+// в общую очередь отправляются задачи из потоков, не являющихся рабочими (например, из основного)
+typedef BoundedQueue<Job> JobQueue;
+
+// пул рабочих потоков с очередями задач на каждый поток и "кражей" задач у соседей
+struct JobSystem {
+	int workerCount;
+	WorkStealingDeque* deques; // по одной на рабочий поток
+	JobQueue sharedQueue;
+	std::thread* threads;
+
+	std::atomic<int> queuedJobs; // задачи, лежащие в очередях (еще не взятые потоками)
+	std::atomic<int> sleepingWorkers;
+	std::atomic<bool> quit;
+	std::mutex sleepMutex;
+	std::condition_variable wakeCondition;
+
+	void init(int workerCount = 0); // 0 - по количеству ядер процессора
+	void shutdown();
+
+	void submit(JobProc proc, void* data, JobCounter* counter = NULL);
+	bool runPendingJob(); // выполнить одну задачу из очередей в текущем потоке, false если задач нет
+	void wait(JobCounter* counter); // дождаться выполнения задач, помогая их выполнять
+
+	bool getJob(int workerIndex, Job* job);
+	void workerProc(int workerIndex);
+};
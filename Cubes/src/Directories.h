@@ -5,4 +5,8 @@
 
 #ifndef SHADER_FOLDER
 	#define SHADER_FOLDER "res/shaders/"
-#endif // !SHADER_FOLDER
\ No newline at end of file
+#endif // !SHADER_FOLDER
+
+#ifndef SAVE_FOLDER
+	#define SAVE_FOLDER "saves/world/"
+#endif // !SAVE_FOLDER
\ No newline at end of file
@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include "Frustum.h"
+#include "NoiseBatch.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CULL_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define CULL_TARGET_AVX
+#else
+#define CULL_TARGET_AVX __attribute__((target("avx")))
+#endif
+#else
+#define CULL_X86 0
+#endif
+
+const char* cullSimdLevelNames[cullSimdCOUNT] = { "Scalar", "SSE", "AVX" };
+
+static CullSimdLevel detectCullSimdLevel() {
+#if CULL_X86
+	// SSE2 есть на любом x64, AVX есть на всех процессорах с AVX2
+	if (detectNoiseSimdLevel() == noiseSimdAVX2) return cullSimdAVX;
+	return cullSimdSSE;
+#else
+	return cullSimdScalar;
+#endif
+}
+CullSimdLevel cullSimdLevel = detectCullSimdLevel();
+
+Frustum frustumFromMatrix(const glm::mat4& m) {
+	// Gribb, Hartmann: плоскости - суммы и разности четвертой строки матрицы с остальными
+	glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+	Frustum frustum;
+	frustum.planes[0] = row3 + row0; // left
+	frustum.planes[1] = row3 - row0; // right
+	frustum.planes[2] = row3 + row1; // bottom
+	frustum.planes[3] = row3 - row1; // top
+	frustum.planes[4] = row3 + row2; // near
+	frustum.planes[5] = row3 - row2; // far
+	return frustum;
+}
+
+void FrustumBoxes::resize(int count) {
+	if (count > capacity) {
+		// с запасом до кратного 8, чтобы хватало на целый регистр AVX
+		capacity = (count + 7) & ~7;
+		float** arrays[] = { &minX, &minY, &minZ, &maxX, &maxY, &maxZ };
+		for (float** a : arrays)
+			*a = (float*)realloc(*a, capacity * sizeof(float));
+	}
+	this->count = count;
+}
+
+void FrustumBoxes::set(int i, glm::vec3 min, glm::vec3 max) {
+	minX[i] = min.x; minY[i] = min.y; minZ[i] = min.z;
+	maxX[i] = max.x; maxY[i] = max.y; maxZ[i] = max.z;
+}
+
+// для каждой плоскости проверяется только самая дальняя по нормали вершина бокса (p-vertex):
+// если и она снаружи, то снаружи весь бокс. Вершина выбирается по знакам нормали, одна на все боксы
+struct CullPlane {
+	float nx, ny, nz, d;
+	const float* px, * py, * pz;
+};
+
+static void cullPlanes(const Frustum& frustum, const FrustumBoxes& boxes, CullPlane* out) {
+	for (int p = 0; p < 6; p++) {
+		glm::vec4 plane = frustum.planes[p];
+		out[p].nx = plane.x; out[p].ny = plane.y; out[p].nz = plane.z; out[p].d = plane.w;
+		out[p].px = plane.x >= 0 ? boxes.maxX : boxes.minX;
+		out[p].py = plane.y >= 0 ? boxes.maxY : boxes.minY;
+		out[p].pz = plane.z >= 0 ? boxes.maxZ : boxes.minZ;
+	}
+}
+
+static int cullBoxesScalar(const CullPlane* planes, int start, int count, u8* visible) {
+	int visibleCount = 0;
+	for (int i = start; i < count; i++) {
+		bool inside = true;
+		for (int p = 0; p < 6; p++) {
+			const CullPlane& plane = planes[p];
+			if (plane.nx * plane.px[i] + plane.ny * plane.py[i] + plane.nz * plane.pz[i] + plane.d < 0) {
+				inside = false;
+				break;
+			}
+		}
+		visible[i] = inside;
+		visibleCount += inside;
+	}
+	return visibleCount;
+}
+
+#if CULL_X86
+static const u8 maskBits[16][4] = {
+	{0,0,0,0}, {1,0,0,0}, {0,1,0,0}, {1,1,0,0}, {0,0,1,0}, {1,0,1,0}, {0,1,1,0}, {1,1,1,0},
+	{0,0,0,1}, {1,0,0,1}, {0,1,0,1}, {1,1,0,1}, {0,0,1,1}, {1,0,1,1}, {0,1,1,1}, {1,1,1,1},
+};
+static const int maskPopcount[16] = { 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4 };
+
+// возвращает число обработанных боксов (кратно 4)
+static int cullBoxesSSE(const CullPlane* planes, int count, u8* visible, int* visibleCount) {
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 outside = _mm_setzero_ps();
+		for (int p = 0; p < 6; p++) {
+			const CullPlane& plane = planes[p];
+			__m128 dist = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.nx), _mm_loadu_ps(plane.px + i)),
+					_mm_mul_ps(_mm_set1_ps(plane.ny), _mm_loadu_ps(plane.py + i))),
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.nz), _mm_loadu_ps(plane.pz + i)), _mm_set1_ps(plane.d)));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(dist, _mm_setzero_ps()));
+		}
+		int mask = ~_mm_movemask_ps(outside) & 0xF;
+		for (int k = 0; k < 4; k++)
+			visible[i + k] = maskBits[mask][k];
+		*visibleCount += maskPopcount[mask];
+	}
+	return i;
+}
+
+CULL_TARGET_AVX static int cullBoxesAVX(const CullPlane* planes, int count, u8* visible, int* visibleCount) {
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 outside = _mm256_setzero_ps();
+		for (int p = 0; p < 6; p++) {
+			const CullPlane& plane = planes[p];
+			__m256 dist = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.nx), _mm256_loadu_ps(plane.px + i)),
+					_mm256_mul_ps(_mm256_set1_ps(plane.ny), _mm256_loadu_ps(plane.py + i))),
+				_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.nz), _mm256_loadu_ps(plane.pz + i)), _mm256_set1_ps(plane.d)));
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(dist, _mm256_setzero_ps(), _CMP_LT_OQ));
+		}
+		int mask = ~_mm256_movemask_ps(outside) & 0xFF;
+		for (int k = 0; k < 4; k++) {
+			visible[i + k] = maskBits[mask & 0xF][k];
+			visible[i + 4 + k] = maskBits[mask >> 4][k];
+		}
+		*visibleCount += maskPopcount[mask & 0xF] + maskPopcount[mask >> 4];
+	}
+	return i;
+}
+#endif // CULL_X86
+
+int frustumCullBoxes(const Frustum& frustum, const FrustumBoxes& boxes, u8* visible) {
+	CullPlane planes[6];
+	cullPlanes(frustum, boxes, planes);
+
+	int visibleCount = 0;
+	int done = 0;
+#if CULL_X86
+	if (cullSimdLevel == cullSimdAVX)
+		done = cullBoxesAVX(planes, boxes.count, visible, &visibleCount);
+	else if (cullSimdLevel == cullSimdSSE)
+		done = cullBoxesSSE(planes, boxes.count, visible, &visibleCount);
+#endif
+	// остаток, не кратный ширине регистра
+	return visibleCount + cullBoxesScalar(planes, done, boxes.count, visible);
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <glm.hpp>
+#include "Typedefs.h"
+
+// отсечение AABB по пирамиде видимости. Проверка идет пачками по 4 (SSE) или 8 (AVX) боксов
+
+enum CullSimdLevel : u8 {
+	cullSimdScalar,
+	cullSimdSSE,
+	cullSimdAVX,
+	cullSimdCOUNT
+};
+
+extern const char* cullSimdLevelNames[cullSimdCOUNT];
+// по умолчанию - лучший доступный, можно понизить для сравнения
+extern CullSimdLevel cullSimdLevel;
+
+// плоскости в виде (nx, ny, nz, d), точка внутри, если dot(n, p) + d >= 0 для всех плоскостей
+struct Frustum {
+	glm::vec4 planes[6];
+};
+
+// плоскости из матрицы projection * view (подходит и для ортогональной проекции теней)
+Frustum frustumFromMatrix(const glm::mat4& viewProjection);
+
+// боксы в виде структуры массивов
+struct FrustumBoxes {
+	float* minX, * minY, * minZ;
+	float* maxX, * maxY, * maxZ;
+	int count;
+	int capacity;
+
+	void resize(int count);
+	void set(int i, glm::vec3 min, glm::vec3 max);
+};
+
+// visible[i] = 1, если бокс i пересекает пирамиду (консервативно). Возвращает число видимых
+int frustumCullBoxes(const Frustum& frustum, const FrustumBoxes& boxes, u8* visible);
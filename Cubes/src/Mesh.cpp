@@ -1,23 +1,34 @@
 #include <glad/glad.h>
+#include <GLFW/glfw3.h>
 #include <glm.hpp>
 #include <gtc/matrix_transform.hpp>
 #include <gtc/type_ptr.hpp>
 #include "Mesh.h"
+#include "Chunk.h"
 #include "ResourceLoader.h"
 #include "Directories.h"
 
 
-static GLuint 
-	cubeInstancedShader = NULL,
-	polyMeshShader = NULL,
-	flatShader = NULL, 
-	spriteShader = NULL;
-
-static GLuint* shaders[] = {
-	&cubeInstancedShader,
-	&polyMeshShader,
-	&flatShader,
-	&spriteShader
+static Shader
+	cubeInstancedShader,
+	blockShadowShader,
+	polyMeshShader,
+	polyMeshShadowShader,
+	flatShader,
+	spriteShader;
+
+static struct {
+	Shader* shader;
+	const char* vertexFilename;
+	const char* fragmentFilename;
+	const char* defines;
+} shaders[] = {
+	{ &cubeInstancedShader, SHADER_FOLDER "block.vert", SHADER_FOLDER "block.frag", CHUNK_SHADER_DEFINES },
+	{ &blockShadowShader, SHADER_FOLDER "blockDepthShader.vert", SHADER_FOLDER "depthShader.frag", CHUNK_SHADER_DEFINES },
+	{ &polyMeshShader, SHADER_FOLDER "polyMesh.vert", SHADER_FOLDER "polyMesh.frag", NULL },
+	{ &polyMeshShadowShader, SHADER_FOLDER "polyMeshDepthShader.vert", SHADER_FOLDER "depthShader.frag", NULL },
+	{ &flatShader, SHADER_FOLDER "polyMesh.vert", SHADER_FOLDER "flat.frag", NULL },
+	{ &spriteShader, SHADER_FOLDER "sprite.vert", SHADER_FOLDER "sprite.frag", NULL },
 };
 
 Vertex::Vertex() {}
@@ -52,34 +63,123 @@ Triangle::Triangle(int a, int b, int c) {
 	indices[2] = c;
 }
 
-BlockFaceInstance::BlockFaceInstance(int pos, BlockFace face, TextureID textureID) {
+BlockFaceInstance::BlockFaceInstance(int pos, BlockFace face, TextureID textureID, u8 sizeX, u8 sizeY) {
 	this->pos = pos;
 	this->face = face;
 	this->textureID = textureID;
+	this->sizeX = sizeX;
+	this->sizeY = sizeY;
+	chunkX = chunkZ = 0;
 }
 
 BlockMesh::BlockMesh() {
 	faces = 0;
-	faceCount = faceSize = 0;
-	VAO = VBO = 0;
+	faceCount = faceSize = gpuOffset = gpuFaceSize = gpuFaceCount = 0;
+	needUpdate = false;
+	dirtyRangeCount = 0;
+	dirtyAll = false;
+}
 
+// пересекающиеся и смежные участки сливаются. Если участков больше BLOCK_MESH_DIRTY_RANGES,
+// сливаются два ближайших: лишние грани между ними отправятся повторно
+void BlockMesh::markDirty(u32 begin, u32 end) {
+	if (dirtyAll || begin >= end)
+		return;
+	for (int i = 0; i < dirtyRangeCount; i++) {
+		FaceRange& r = dirtyRanges[i];
+		if (begin <= r.end && r.begin <= end) {
+			begin = std::min(begin, r.begin);
+			end = std::max(end, r.end);
+			dirtyRanges[i--] = dirtyRanges[--dirtyRangeCount];
+		}
+	}
+	if (dirtyRangeCount == BLOCK_MESH_DIRTY_RANGES) {
+		int best = 0;
+		u32 bestGap = UINT32_MAX;
+		for (int i = 0; i < dirtyRangeCount; i++) {
+			FaceRange& r = dirtyRanges[i];
+			u32 gap = r.end < begin ? begin - r.end : r.begin - end;
+			if (gap < bestGap) {
+				bestGap = gap;
+				best = i;
+			}
+		}
+		begin = std::min(begin, dirtyRanges[best].begin);
+		end = std::max(end, dirtyRanges[best].end);
+		dirtyRanges[best] = dirtyRanges[--dirtyRangeCount];
+	}
+	dirtyRanges[dirtyRangeCount++] = { begin, end };
 }
 
+// при повторном вызове шейдеры пересобираются, старые программы удаляются
 void initShaders() {
-	//for(GLuint* shader : shaders)
-	//{
-	//	if (*shader != NULL)
-	//		glDeleteProgram(*shader);
-	//}
-	
-	cubeInstancedShader = BuildShader(SHADER_FOLDER "block.vert", SHADER_FOLDER "block.frag");
-	polyMeshShader = BuildShader(SHADER_FOLDER "polyMesh.vert", SHADER_FOLDER "polyMesh.frag");
-	flatShader = BuildShader(SHADER_FOLDER "polyMesh.vert", SHADER_FOLDER "flat.frag");
-	spriteShader = BuildShader(SHADER_FOLDER "sprite.vert", SHADER_FOLDER "sprite.frag");
+	for (auto& s : shaders) {
+		if (s.shader->ID != 0)
+			s.shader->rebuild();
+		else
+			s.shader->build(s.vertexFilename, s.fragmentFilename, s.defines);
+	}
+}
+
+#pragma region Frame
+static GLuint frameUniformBuffer = 0;
+
+void initFrameUniforms() {
+	glGenBuffers(1, &frameUniformBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, frameUniformBuffer);
+}
+
+void updateFrameUniforms(glm::vec3 sunDir, glm::vec3 sunColor, glm::vec3 moonColor, glm::vec3 ambientColor,
+	const glm::mat4& projection, const glm::mat4& view, const glm::mat4& lightSpaceMatrix
+)
+{
+	FrameUniforms frame;
+	frame.projection = projection;
+	frame.view = view;
+	frame.lightSpaceMatrix = lightSpaceMatrix;
+
+	// день
+	if (sunDir.y > 0) {
+		float sunIntencity = glm::max(sunDir.y, 0.0f);
+		frame.sunDir = glm::vec4(sunDir, 0);
+		frame.sunColor = glm::vec4(sunColor * sunIntencity, 0);
+		frame.ambientColor = glm::vec4(ambientColor * glm::max(sunIntencity, 0.2f), 0);
+	}
+	// ночь
+	else {
+		float sunIntencity = glm::max(-sunDir.y, 0.0f) * 0.3;
+		frame.sunDir = glm::vec4(-sunDir, 0);
+		frame.sunColor = glm::vec4(moonColor * sunIntencity, 0);
+		frame.ambientColor = glm::vec4(ambientColor * glm::max(sunIntencity, 0.2f), 0);
+	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &frame);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
+#pragma endregion
 
 #pragma region Block
-void setupBlockMesh(BlockMesh& mesh, bool onlyAllocBuffer, bool staticMesh) {
+BlockMeshBuffer blockMeshBuffer;
+
+// атрибуты инстансов читаются с baseOffset байт буфера instanceVBO. VAO и instanceVBO должны быть выбраны
+static void pointBlockInstanceAttribs(size_t baseOffset) {
+	// pos
+	glVertexAttribIPointer(1, 1, GL_UNSIGNED_SHORT, sizeof(BlockFaceInstance), (void*)(baseOffset + offsetof(BlockFaceInstance, pos)));
+	// face direction
+	glVertexAttribIPointer(2, 1, GL_BYTE, sizeof(BlockFaceInstance), (void*)(baseOffset + offsetof(BlockFaceInstance, face)));
+	// texture id
+	glVertexAttribIPointer(3, 1, GL_UNSIGNED_SHORT, sizeof(BlockFaceInstance), (void*)(baseOffset + offsetof(BlockFaceInstance, textureID)));
+	// face size (sizeX, sizeY)
+	glVertexAttribIPointer(4, 2, GL_UNSIGNED_BYTE, sizeof(BlockFaceInstance), (void*)(baseOffset + offsetof(BlockFaceInstance, sizeX)));
+	// chunk (chunkX, chunkZ)
+	glVertexAttribIPointer(5, 2, GL_SHORT, sizeof(BlockFaceInstance), (void*)(baseOffset + offsetof(BlockFaceInstance, chunkX)));
+}
+
+void initBlockMeshBuffer(u32 faceCapacity) {
 	const glm::vec3 faceVerts[] = {
 	glm::vec3(0,0,0),
 	glm::vec3(1,0,0),
@@ -91,129 +191,221 @@ void setupBlockMesh(BlockMesh& mesh, bool onlyAllocBuffer, bool staticMesh) {
 		0, 1, 2, 2, 3, 0
 	};
 
-	GLuint VAO, VBO, instanceVBO, EBO;
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &instanceVBO);
-	glGenBuffers(1, &EBO);
+	BlockMeshBuffer& buffer = blockMeshBuffer;
+	glGenVertexArrays(1, &buffer.VAO);
+	glGenBuffers(1, &buffer.VBO);
+	glGenBuffers(1, &buffer.instanceVBO);
+	glGenBuffers(1, &buffer.EBO);
+	glGenBuffers(1, &buffer.indirectBuffer);
+	buffer.allocator.init(faceCapacity);
 
-	mesh.VAO = VAO;
-	mesh.VBO = VBO;
-	mesh.EBO = EBO;
-	mesh.instanceVBO = instanceVBO;
-
-	int bufferMode;
-	if (staticMesh) bufferMode = GL_STATIC_DRAW;
-	else			bufferMode = GL_DYNAMIC_DRAW;
-
-	//    
-	glBindVertexArray(VAO);
+	// выбираем буфер как текущий
+	glBindVertexArray(buffer.VAO);
 
 	// instanced face
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer.VBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.EBO);
 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(faceVerts), faceVerts, GL_STATIC_DRAW); //     
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faceIndices), faceIndices, GL_STATIC_DRAW); //  
+	glBufferData(GL_ARRAY_BUFFER, sizeof(faceVerts), faceVerts, GL_STATIC_DRAW); // отправка вершин в память видеокарты
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faceIndices), faceIndices, GL_STATIC_DRAW); // загружаем индексы
 
-	// ""      
+	// "объясняем" как необходимо прочитать массив с вершинами
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0); // pos
 	glEnableVertexAttribArray(0);
 
-
 	// instances
-	glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(BlockFaceInstance) * mesh.faceSize, mesh.faces, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer.instanceVBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(BlockFaceInstance) * faceCapacity, NULL, GL_STATIC_DRAW);
 
-	// pos
-	glEnableVertexAttribArray(1);
-	glVertexAttribIPointer(1, 1, GL_UNSIGNED_SHORT, sizeof(BlockFaceInstance), (void*)offsetof(BlockFaceInstance, pos));
-	glVertexAttribDivisor(1, 1); //   - location   
-	// face direction
-	glEnableVertexAttribArray(2);
-	glVertexAttribIPointer(2, 1, GL_BYTE, sizeof(BlockFaceInstance), (void*)offsetof(BlockFaceInstance, face));
-	glVertexAttribDivisor(2, 1); //   - location   
-	// texture id
-	glEnableVertexAttribArray(3);
-	glVertexAttribIPointer(3, 1, GL_UNSIGNED_SHORT, sizeof(BlockFaceInstance), (void*)offsetof(BlockFaceInstance, textureID));
-	glVertexAttribDivisor(3, 1); //   - location   
+	for (int i = 1; i <= 5; i++) {
+		glEnableVertexAttribArray(i);
+		glVertexAttribDivisor(i, 1); // первая переменная - location атрибута в шейдере
+	}
+	pointBlockInstanceAttribs(0);
 
 	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-//    
-void updateBlockMesh(BlockMesh& mesh) {
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.instanceVBO);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(BlockFaceInstance) * mesh.faceSize, mesh.faces);
-	
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+// увеличить общий буфер: новый буфер, копирование старого содержимого на ГПУ, перенастройка VAO
+static void growBlockMeshBuffer(u32 newCapacity) {
+	BlockMeshBuffer& buffer = blockMeshBuffer;
+	GLuint newVBO;
+	glGenBuffers(1, &newVBO);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, newVBO);
+	glBufferData(GL_COPY_WRITE_BUFFER, sizeof(BlockFaceInstance) * newCapacity, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_READ_BUFFER, buffer.instanceVBO);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(BlockFaceInstance) * buffer.allocator.capacity);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glDeleteBuffers(1, &buffer.instanceVBO);
+	buffer.instanceVBO = newVBO;
+	buffer.allocator.grow(newCapacity);
+
+	glBindVertexArray(buffer.VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer.instanceVBO);
+	pointBlockInstanceAttribs(0);
+	glBindVertexArray(0);
+}
+
+void releaseBlockMesh(BlockMesh& mesh) {
+	if (mesh.gpuFaceSize > 0)
+		blockMeshBuffer.allocator.release(mesh.gpuOffset, mesh.gpuFaceSize);
+	mesh.gpuOffset = mesh.gpuFaceSize = mesh.gpuFaceCount = 0;
+}
+
+u64 blockMeshUploadedBytes = 0;
+
+u32 BlockMesh::pendingUploadFaces() const {
+	if (dirtyAll)
+		return faceCount;
+	u32 count = 0;
+	for (int i = 0; i < dirtyRangeCount; i++)
+		count += std::min(dirtyRanges[i].end, faceCount) - std::min(dirtyRanges[i].begin, faceCount);
+	return count;
+}
+
+// обновить геометрию в ГПУ
+u32 updateBlockMesh(BlockMesh& mesh) {
+	RangeAllocator& allocator = blockMeshBuffer.allocator;
+	u32 bytes = 0;
+	bool uploadAll = mesh.dirtyAll;
+	// участок выделяется заново, если граней больше, чем в него помещается, или меньше половины.
+	// Небольшой запас, чтобы правка одного блока обычно не меняла участок
+	if (mesh.faceCount > mesh.gpuFaceSize || mesh.faceCount < mesh.gpuFaceSize / 2) {
+		uploadAll = true;
+		releaseBlockMesh(mesh);
+		if (mesh.faceCount > 0) {
+			u32 size = mesh.faceCount + mesh.faceCount / 8;
+			u32 offset;
+			while (!allocator.alloc(size, &offset))
+				growBlockMeshBuffer(std::max(allocator.capacity * 2, allocator.capacity + size));
+			mesh.gpuOffset = offset;
+			mesh.gpuFaceSize = size;
+		}
+	}
+	// отправляются только действительные грани: все или измененные участки
+	if (mesh.faceCount > 0) {
+		glBindBuffer(GL_ARRAY_BUFFER, blockMeshBuffer.instanceVBO);
+		if (uploadAll) {
+			glBufferSubData(GL_ARRAY_BUFFER, sizeof(BlockFaceInstance) * mesh.gpuOffset, sizeof(BlockFaceInstance) * mesh.faceCount, mesh.faces);
+			bytes = sizeof(BlockFaceInstance) * mesh.faceCount;
+		}
+		else {
+			for (int i = 0; i < mesh.dirtyRangeCount; i++) {
+				u32 begin = mesh.dirtyRanges[i].begin;
+				u32 end = std::min(mesh.dirtyRanges[i].end, mesh.faceCount);
+				if (begin >= end)
+					continue;
+				glBufferSubData(GL_ARRAY_BUFFER, sizeof(BlockFaceInstance) * (mesh.gpuOffset + begin), sizeof(BlockFaceInstance) * (end - begin), mesh.faces + begin);
+				bytes += sizeof(BlockFaceInstance) * (end - begin);
+			}
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	blockMeshUploadedBytes += bytes;
+	mesh.gpuFaceCount = mesh.faceCount;
 	mesh.needUpdate = false;
+	mesh.dirtyRangeCount = 0;
+	mesh.dirtyAll = false;
+	return bytes;
 }
 
-//     
-void useCubeShader(glm::vec3 sunDir, glm::vec3 sunColor, glm::vec3 moonColor, glm::vec3 ambientColor,
-	glm::mat4 projection, glm::mat4 view, glm::mat4 lightSpaceMatrix
-)
-{
-	GLuint shader = cubeInstancedShader;
-	glUseProgram(shader);
+void BlockDrawList::clear() {
+	count = 0;
+}
 
-	// 
-	if (sunDir.y > 0) {
-		float sunIntencity = glm::max(sunDir.y, 0.0f);
-		glm::vec3 sunShadingColor = sunColor * sunIntencity;
-		glm::vec3 ambientShadingColor = ambientColor * glm::max(sunIntencity, 0.2f);
+void BlockDrawList::add(const BlockMesh& mesh) {
+	if (mesh.gpuFaceCount == 0)
+		return;
+	if (count == capacity) {
+		capacity = std::max(capacity * 2, 64);
+		commands = (BlockDrawCommand*)realloc(commands, capacity * sizeof(BlockDrawCommand));
+	}
+	BlockDrawCommand& command = commands[count++];
+	command.count = 6;
+	command.instanceCount = mesh.gpuFaceCount;
+	command.firstIndex = 0;
+	command.baseVertex = 0;
+	command.baseInstance = mesh.gpuOffset;
+}
+
+// glad сгенерирован для GL 3.3, функция загружается вручную
+#define GL_DRAW_INDIRECT_BUFFER_ 0x8F3F
+typedef void (APIENTRYP MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+static MultiDrawElementsIndirectProc multiDrawElementsIndirect = NULL;
+bool blockMultiDrawIndirect = false;
+
+void initBlockMultiDraw() {
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	bool multiDraw = major > 4 || (major == 4 && minor >= 3) || glfwExtensionSupported("GL_ARB_multi_draw_indirect");
+	// участок чанка в общем буфере выбирается через baseInstance, до GL 4.2 без расширения это поле должно быть 0
+	bool baseInstance = major > 4 || (major == 4 && minor >= 2) || glfwExtensionSupported("GL_ARB_base_instance");
+	if (multiDraw && baseInstance)
+		multiDrawElementsIndirect = (MultiDrawElementsIndirectProc)glfwGetProcAddress("glMultiDrawElementsIndirect");
+	blockMultiDrawIndirect = multiDrawElementsIndirect != NULL;
+}
 
-		glUniform3f(glGetUniformLocation(shader, "sunDir"), sunDir.x, sunDir.y, sunDir.z);
-		glUniform3f(glGetUniformLocation(shader, "sunColor"), sunShadingColor.r, sunShadingColor.g, sunShadingColor.b);
-		glUniform3f(glGetUniformLocation(shader, "ambientColor"), ambientShadingColor.r, ambientShadingColor.g, ambientShadingColor.b);
+int drawBlockDrawList(const BlockDrawList& list) {
+	if (list.count == 0)
+		return 0;
+	BlockMeshBuffer& buffer = blockMeshBuffer;
+	glBindVertexArray(buffer.VAO);
+	int drawCalls;
+	if (blockMultiDrawIndirect) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER_, buffer.indirectBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER_, list.count * sizeof(BlockDrawCommand), list.commands, GL_STREAM_DRAW);
+		multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, list.count, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER_, 0);
+		drawCalls = 1;
 	}
-	// 
 	else {
-		float sunIntencity = glm::max(-sunDir.y, 0.0f) * 0.3;
-		glm::vec3 sunShadingColor = moonColor * sunIntencity;
-		glm::vec3 ambientShadingColor = ambientColor * glm::max(sunIntencity, 0.2f);
-
-		glUniform3f(glGetUniformLocation(shader, "sunDir"), -sunDir.x, -sunDir.y, -sunDir.z);
-		glUniform3f(glGetUniformLocation(shader, "sunColor"), sunShadingColor.r, sunShadingColor.g, sunShadingColor.b);
-		glUniform3f(glGetUniformLocation(shader, "ambientColor"), ambientShadingColor.r, ambientShadingColor.g, ambientShadingColor.b);
+		// в GL 3.3 нет baseInstance: атрибуты инстансов переносятся на начало участка каждого меша
+		glBindBuffer(GL_ARRAY_BUFFER, buffer.instanceVBO);
+		for (int i = 0; i < list.count; i++) {
+			const BlockDrawCommand& command = list.commands[i];
+			pointBlockInstanceAttribs(sizeof(BlockFaceInstance) * command.baseInstance);
+			glDrawElementsInstanced(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, 0, command.instanceCount);
+		}
+		pointBlockInstanceAttribs(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		drawCalls = list.count;
 	}
+	glBindVertexArray(0);
+	return drawCalls;
+}
 
-	//     
-	glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-	glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv(glGetUniformLocation(shader, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+// камера, освещение и матрица теней берутся из FrameData
+void useCubeShader() {
+	cubeInstancedShader.use();
+}
 
-	glUniform1i(glGetUniformLocation(shader, "texture1"), 0);
-	glUniform1i(glGetUniformLocation(shader, "shadowMap"), 1);
+// чанки в карту теней, матрица света берется из FrameData
+void useBlockShadowShader() {
+	blockShadowShader.use();
 }
 
-//    
+// локальная трансформация для модели
 void cubeApplyTransform(glm::vec3 pos, glm::vec3 rot, glm::vec3 scale) {
-	glm::mat4 model = glm::mat4(1.0f); //   (1  )
+	glm::mat4 model = glm::mat4(1.0f); // единичная матрица (1 по диагонали)
 	model = glm::translate(model, pos);
 	model = glm::rotate(model, glm::radians(rot.x), glm::vec3(1.0, 0.0, 0.0));
 	model = glm::rotate(model, glm::radians(rot.y), glm::vec3(0.0, 1.0, 0.0));
 	model = glm::rotate(model, glm::radians(rot.z), glm::vec3(0.0, 0.0, 1.0));
 	model = glm::scale(model, scale);
-	glUniformMatrix4fv(glGetUniformLocation(cubeInstancedShader, "model"), 1, GL_FALSE, glm::value_ptr(model));
+	glUniformMatrix4fv(cubeInstancedShader.location(uniformModel), 1, GL_FALSE, glm::value_ptr(model));
 }
 
-void drawBlockMesh(BlockMesh& mesh, const Texture& textureAtlas, GLuint shadowMap, glm::ivec2 chunkPos) {
+void bindCubeTextures(const Texture& textureAtlas, GLuint shadowMap) {
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, textureAtlas.ID);
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_2D, shadowMap);
 	glActiveTexture(GL_TEXTURE0);
 
-	glUniform2i(glGetUniformLocation(cubeInstancedShader, "chunkPos"), chunkPos.x, chunkPos.y);
-	glUniform2i(glGetUniformLocation(cubeInstancedShader, "atlasSize"), textureAtlas.width, textureAtlas.height);
-
-
-	glBindVertexArray(mesh.VAO);
-	glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, mesh.faceCount);
-
-	glBindVertexArray(0);
+	glUniform2i(cubeInstancedShader.location(uniformAtlasSize), textureAtlas.width, textureAtlas.height);
 }
 #pragma endregion
 
@@ -228,15 +420,15 @@ void setupSprite(Sprite& sprite) {
 	sprite.VBO = VBO;
 	sprite.EBO = EBO;
 
-	//    
+	// выбираем буфер как текущий
 	glBindVertexArray(VAO);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * sprite.vertexCount, sprite.vertices, GL_STATIC_DRAW); //     
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Triangle) * sprite.trianglesCount, sprite.triangles, GL_STATIC_DRAW); //  
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * sprite.vertexCount, sprite.vertices, GL_STATIC_DRAW); // отправка вершин в память видеокарты
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Triangle) * sprite.trianglesCount, sprite.triangles, GL_STATIC_DRAW); // загружаем индексы
 
-	// ""      
+	// "объясняем" как необходимо прочитать массив с вершинами
 	GLint stride = sizeof(Vertex);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, pos)); // pos
@@ -246,28 +438,23 @@ void setupSprite(Sprite& sprite) {
 	glBindVertexArray(0);
 }
 
-//      
-void useSpriteShader(glm::mat4 projection, glm::mat4 view) {
-	GLuint shader = spriteShader;
-	glUseProgram(shader);
-
-	//     
-	glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-	glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE, glm::value_ptr(view));
+// камера берется из FrameData
+void useSpriteShader() {
+	spriteShader.use();
 }
 
-//    
+// локальная трансформация для спрайта
 void spriteApplyTransform(glm::vec3 pos, float scale, bool spherical) {
-	glUniform1f(glGetUniformLocation(spriteShader, "scale"), scale);
+	glUniform1f(spriteShader.location(uniformScale), scale);
 	if (spherical)
-		glUniform1i(glGetUniformLocation(spriteShader, "spherical"), 1);
+		glUniform1i(spriteShader.location(uniformSpherical), 1);
 	else
-		glUniform1i(glGetUniformLocation(spriteShader, "spherical"), 0);
+		glUniform1i(spriteShader.location(uniformSpherical), 0);
 
-	glm::mat4 model = glm::mat4(1.0f); //   (1  )
+	glm::mat4 model = glm::mat4(1.0f); // единичная матрица (1 по диагонали)
 	model = glm::translate(model, pos);
 	model = glm::scale(model, glm::vec3(scale, scale, scale));
-	glUniformMatrix4fv(glGetUniformLocation(spriteShader, "model"), 1, GL_FALSE, glm::value_ptr(model));
+	glUniformMatrix4fv(spriteShader.location(uniformModel), 1, GL_FALSE, glm::value_ptr(model));
 }
 
 
@@ -291,15 +478,15 @@ void polyMeshSetup(PolyMesh& mesh) {
 	mesh.VBO = VBO;
 	mesh.EBO = EBO;
 
-	//    
+	// выбираем буфер как текущий
 	glBindVertexArray(VAO);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * mesh.vertexCapacity, mesh.vertices, GL_STATIC_DRAW); //     
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Triangle) * mesh.triCapacity, mesh.triangles, GL_STATIC_DRAW); //  
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * mesh.vertexCapacity, mesh.vertices, GL_STATIC_DRAW); // отправка вершин в память видеокарты
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Triangle) * mesh.triCapacity, mesh.triangles, GL_STATIC_DRAW); // загружаем индексы
 
-	// ""      
+	// "объясняем" как необходимо прочитать массив с вершинами
 	GLint stride = sizeof(Vertex);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, pos)); // pos
@@ -313,32 +500,24 @@ void polyMeshSetup(PolyMesh& mesh) {
 	glBindVertexArray(0);
 }
 
-void polyMeshUseShader(glm::mat4 projection, glm::mat4 view, glm::mat4 lightSpaceMatrix)
+// камера, освещение и матрица теней берутся из FrameData
+void polyMeshUseShader()
 {
-	GLuint shader = polyMeshShader;
-	glUseProgram(shader);
-
-	//     
-	glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-	glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv(glGetUniformLocation(shader, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-
-	glUniform1i(glGetUniformLocation(shader, "texture1"), 0);
-	glUniform1i(glGetUniformLocation(shader, "shadowMap"), 1);
+	polyMeshShader.use();
 }
 
 void polyMeshApplyTransform(glm::vec3 pos, glm::vec3 rot, glm::vec3 scale)
 {
-	glm::mat4 model = glm::mat4(1.0f); //   (1  )
+	glm::mat4 model = glm::mat4(1.0f); // единичная матрица (1 по диагонали)
 	model = glm::translate(model, pos);
 	model = glm::rotate(model, glm::radians(rot.x), glm::vec3(1.0, 0.0, 0.0));
 	model = glm::rotate(model, glm::radians(rot.y), glm::vec3(0.0, 1.0, 0.0));
 	model = glm::rotate(model, glm::radians(rot.z), glm::vec3(0.0, 0.0, 1.0));
 	model = glm::scale(model, scale);
-	glUniformMatrix4fv(glGetUniformLocation(polyMeshShader, "model"), 1, GL_FALSE, glm::value_ptr(model));
+	glUniformMatrix4fv(polyMeshShader.location(uniformModel), 1, GL_FALSE, glm::value_ptr(model));
 }
 
-void polyMeshDraw(PolyMesh& mesh, GLuint texture, GLuint shadowMap, glm::vec3 sunDir, glm::vec3 sunColor, glm::vec3 ambientColor) {
+void polyMeshDraw(PolyMesh& mesh, GLuint texture, GLuint shadowMap) {
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, texture);
 	
@@ -347,10 +526,7 @@ void polyMeshDraw(PolyMesh& mesh, GLuint texture, GLuint shadowMap, glm::vec3 su
 
 	glActiveTexture(GL_TEXTURE0);
 
-	glUniform1f(glGetUniformLocation(polyMeshShader, "lightingFactor"), 1.0f);
-	glUniform3f(glGetUniformLocation(polyMeshShader, "sunDir"), sunDir.x, sunDir.y, sunDir.z);
-	glUniform3f(glGetUniformLocation(polyMeshShader, "sunColor"), sunColor.x, sunColor.y, sunColor.z);
-	glUniform3f(glGetUniformLocation(polyMeshShader, "ambientColor"), ambientColor.x, ambientColor.y, ambientColor.z);
+	glUniform1f(polyMeshShader.location(uniformLightingFactor), 1.0f);
 
 	glBindVertexArray(mesh.VAO);
 	glDrawElements(GL_TRIANGLES, mesh.triCount * 3, GL_UNSIGNED_INT, 0);
@@ -359,28 +535,24 @@ void polyMeshDraw(PolyMesh& mesh, GLuint texture, GLuint shadowMap, glm::vec3 su
 #pragma endregion
 
 #pragma region Flat
-void useFlatShader(glm::mat4 projection, glm::mat4 view) {
-	GLuint shader = flatShader;
-	glUseProgram(shader);
-	
-	//     
-	glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-	glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE, glm::value_ptr(view));
+// камера берется из FrameData
+void useFlatShader() {
+	flatShader.use();
 }
 
-//    
+// локальная трансформация для модели
 void flatApplyTransform(glm::vec3 pos, glm::vec3 rot, glm::vec3 scale) {
-	glm::mat4 model = glm::mat4(1.0f); //   (1  )
+	glm::mat4 model = glm::mat4(1.0f); // единичная матрица (1 по диагонали)
 	model = glm::translate(model, pos);
 	model = glm::rotate(model, glm::radians(rot.x), glm::vec3(1.0, 0.0, 0.0));
 	model = glm::rotate(model, glm::radians(rot.y), glm::vec3(0.0, 1.0, 0.0));
 	model = glm::rotate(model, glm::radians(rot.z), glm::vec3(0.0, 0.0, 1.0));
 	model = glm::scale(model, scale);
-	glUniformMatrix4fv(glGetUniformLocation(flatShader, "model"), 1, GL_FALSE, glm::value_ptr(model));
+	glUniformMatrix4fv(flatShader.location(uniformModel), 1, GL_FALSE, glm::value_ptr(model));
 }
 
 void drawFlat(PolyMesh& mesh, glm::vec3 color) {
-	glUniform4f(glGetUniformLocation(flatShader, "color"), color.r, color.g, color.b, 1);
+	glUniform4f(flatShader.location(uniformColor), color.r, color.g, color.b, 1);
 
 	glBindVertexArray(mesh.VAO);
 	glDrawElements(GL_TRIANGLES, mesh.triCount * 3, GL_UNSIGNED_INT, 0);
@@ -4,11 +4,28 @@
 #include <glad/glad.h>
 #include "Typedefs.h"
 #include "ResourceLoader.h"
+#include "DataStructures.h"
 
 
 
 void initShaders();
 
+// данные кадра, общие для всех шейдеров: uniform-блок FrameData (std140) в точке FRAME_UNIFORMS_BINDING
+struct FrameUniforms {
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::mat4 lightSpaceMatrix;
+	glm::vec4 sunDir; // направление на источник света: солнце днем, луна ночью
+	glm::vec4 sunColor; // с учетом высоты источника
+	glm::vec4 ambientColor;
+};
+
+void initFrameUniforms();
+// раз в кадр перед первой отрисовкой
+void updateFrameUniforms(glm::vec3 sunDir, glm::vec3 sunColor, glm::vec3 moonColor, glm::vec3 ambientColor,
+	const glm::mat4& projection, const glm::mat4& view, const glm::mat4& lightSpaceMatrix
+);
+
 enum BlockFace : u8 {
 	faceYPos = 0,
 	faceYNeg = 1,
@@ -18,7 +35,7 @@ enum BlockFace : u8 {
 	faceZNeg = 5,
 };
 
-//    ,    
+// в том же порядке, что и в атласе
 enum TextureID : u16 {
 	tidGround,
 	tidStone,
@@ -35,33 +52,84 @@ struct BlockFaceInstance {
 	u16 pos;
 	TextureID textureID;
 	BlockFace face;
+	u8 sizeX, sizeY; // размер полигона в блоках (greedy meshing), в локальных осях полигона
+	s16 chunkX, chunkZ; // координаты чанка в чанках: все чанки рисуются из одного буфера, без uniform на чанк
 
-	BlockFaceInstance(int pos, BlockFace face, TextureID textureID);
+	BlockFaceInstance(int pos, BlockFace face, TextureID textureID, u8 sizeX = 1, u8 sizeY = 1);
 };
 #pragma pack(pop)
 
 // BLOCKS
-// TODO:   BlockMesh
+#define BLOCK_MESH_DIRTY_RANGES 32
+
+// грани [begin, end) меша
+struct FaceRange {
+	u32 begin, end;
+};
+
+// TODO: переименовать в BlockMesh
 struct BlockMesh {
 	BlockFaceInstance* faces;
 
 	u32 faceCount;
-	u32 faceSize;
-
-	GLuint VAO, VBO, instanceVBO, EBO; // TODO: EBO  VBO   ,           
+	u32 faceSize; // размер массива faces, после полного мешинга равен faceCount
+	u32 gpuOffset; // начало участка меша в общем буфере граней, в гранях
+	u32 gpuFaceSize; // размер участка в общем буфере, в гранях (0 - участка нет)
+	u32 gpuFaceCount; // граней в участке после последней отправки. faceCount может уже измениться при перемешивании
 
 	bool needUpdate;
+	// грани, измененные после последней отправки. При dirtyAll отправляются все грани
+	FaceRange dirtyRanges[BLOCK_MESH_DIRTY_RANGES];
+	u8 dirtyRangeCount;
+	bool dirtyAll;
 
 	BlockMesh();
+	void markDirty(u32 begin, u32 end);
+	u32 pendingUploadFaces() const; // граней к отправке при следующем updateBlockMesh (без учета нового участка)
 };
 
-void setupBlockMesh(BlockMesh& mesh, bool onlyAllocBuffer = false, bool staticMesh = true);
-void updateBlockMesh(BlockMesh& mesh);
-void useCubeShader(glm::vec3 sunDir, glm::vec3 sunColor, glm::vec3 moonColor, glm::vec3 ambientColor,
-	glm::mat4 projection, glm::mat4 view, glm::mat4 lightSpaceMatrix
-);
+// общий для всех чанков буфер граней: один VAO, один полигон и один буфер инстансов,
+// из которого каждому мешу выделяется участок
+struct BlockMeshBuffer {
+	GLuint VAO, VBO, EBO, instanceVBO, indirectBuffer;
+	RangeAllocator allocator; // в гранях
+};
+extern BlockMeshBuffer blockMeshBuffer;
+
+void initBlockMeshBuffer(u32 faceCapacity);
+u32 updateBlockMesh(BlockMesh& mesh); // возвращает число отправленных байт
+void releaseBlockMesh(BlockMesh& mesh); // вернуть участок меша в общий буфер
+extern u64 blockMeshUploadedBytes; // всего отправлено граней на ГПУ, байт
+
+// команда отрисовки в формате glMultiDrawElementsIndirect
+struct BlockDrawCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// список мешей на отрисовку за кадр
+struct BlockDrawList {
+	BlockDrawCommand* commands;
+	int count;
+	int capacity;
+
+	void clear();
+	void add(const BlockMesh& mesh);
+};
+
+// true, если драйвер поддерживает glMultiDrawElementsIndirect (GL 4.3 или ARB_multi_draw_indirect)
+extern bool blockMultiDrawIndirect;
+// вызывать после создания контекста
+void initBlockMultiDraw();
+// все меши списка одним вызовом (или по вызову на меш без MDI). Шейдер должен быть выбран. Возвращает число draw call'ов
+int drawBlockDrawList(const BlockDrawList& list);
+void useCubeShader();
+void useBlockShadowShader();
 void cubeApplyTransform(glm::vec3 pos, glm::vec3 rot, glm::vec3 scale);
-void drawBlockMesh(BlockMesh& mesh, const Texture& textureAtlas, GLuint shadowMap, glm::ivec2 chunkPos);
+void bindCubeTextures(const Texture& textureAtlas, GLuint shadowMap);
 
 // POLYGONAL MESH
 #pragma pack(push, 1)
@@ -96,9 +164,9 @@ struct PolyMesh {
 };
 
 void polyMeshSetup(PolyMesh& mesh);
-void polyMeshUseShader(glm::mat4 projection, glm::mat4 view, glm::mat4 lightSpaceMatrix);
+void polyMeshUseShader();
 void polyMeshApplyTransform(glm::vec3 pos, glm::vec3 rot, glm::vec3 scale);
-void polyMeshDraw(PolyMesh& mesh, GLuint texture, GLuint shadowMap, glm::vec3 sunDir, glm::vec3 sunColor, glm::vec3 ambientColor);
+void polyMeshDraw(PolyMesh& mesh, GLuint texture, GLuint shadowMap);
 
 // SPRITE
 struct Sprite {
@@ -112,11 +180,11 @@ struct Sprite {
 
 void setupSprite(Sprite& sprite);
 void createSprite(Sprite& sprite, float scaleX, float scaleY, glm::vec2& uv, float sizeU, float sizeV);
-void useSpriteShader(glm::mat4 projection, glm::mat4 view);
+void useSpriteShader();
 void spriteApplyTransform(glm::vec3 pos, float scale, bool spherical = true);
 void drawSprite(Sprite& sprite, GLuint texture);
 
 // FLAT
-void useFlatShader(glm::mat4 projection, glm::mat4 view);
+void useFlatShader();
 void flatApplyTransform(glm::vec3 pos, glm::vec3 rot, glm::vec3 scale);
 void drawFlat(PolyMesh& mesh, glm::vec3 color);
\ No newline at end of file
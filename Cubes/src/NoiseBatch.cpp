@@ -0,0 +1,465 @@
+#include "NoiseBatch.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define NOISE_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC разрешает использовать любые intrinsic-функции без флагов компилятора
+#define NOISE_TARGET_SSE41
+#define NOISE_TARGET_AVX2
+#else
+#define NOISE_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define NOISE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define NOISE_X86 0
+#endif
+
+const char* noiseSimdLevelNames[noiseSimdCOUNT] = { "Scalar", "SSE4.1", "AVX2" };
+NoiseSimdLevel noiseSimdLevel = detectNoiseSimdLevel();
+
+NoiseSimdLevel detectNoiseSimdLevel() {
+#if NOISE_X86
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	bool sse41 = (info[2] & (1 << 19)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	bool avx2 = false;
+	// AVX регистры должна сохранять ОС
+	if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	bool sse41 = __builtin_cpu_supports("sse4.1");
+	bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+	if (avx2) return noiseSimdAVX2;
+	if (sse41) return noiseSimdSSE41;
+#endif
+	return noiseSimdScalar;
+}
+
+#pragma region lookup tables
+// таблицы градиентов из FastNoiseLite (MIT License, Copyright(c) 2023 Jordan Peck), индексы совпадают
+static const float gradients2D[256] = {
+	0.130526192220052f, 0.99144486137381f, 0.38268343236509f, 0.923879532511287f, 0.608761429008721f, 0.793353340291235f, 0.793353340291235f, 0.608761429008721f,
+	0.923879532511287f, 0.38268343236509f, 0.99144486137381f, 0.130526192220051f, 0.99144486137381f, -0.130526192220051f, 0.923879532511287f, -0.38268343236509f,
+	0.793353340291235f, -0.60876142900872f, 0.608761429008721f, -0.793353340291235f, 0.38268343236509f, -0.923879532511287f, 0.130526192220052f, -0.99144486137381f,
+	-0.130526192220052f, -0.99144486137381f, -0.38268343236509f, -0.923879532511287f, -0.608761429008721f, -0.793353340291235f, -0.793353340291235f, -0.608761429008721f,
+	-0.923879532511287f, -0.38268343236509f, -0.99144486137381f, -0.130526192220052f, -0.99144486137381f, 0.130526192220051f, -0.923879532511287f, 0.38268343236509f,
+	-0.793353340291235f, 0.608761429008721f, -0.608761429008721f, 0.793353340291235f, -0.38268343236509f, 0.923879532511287f, -0.130526192220052f, 0.99144486137381f,
+	0.130526192220052f, 0.99144486137381f, 0.38268343236509f, 0.923879532511287f, 0.608761429008721f, 0.793353340291235f, 0.793353340291235f, 0.608761429008721f,
+	0.923879532511287f, 0.38268343236509f, 0.99144486137381f, 0.130526192220051f, 0.99144486137381f, -0.130526192220051f, 0.923879532511287f, -0.38268343236509f,
+	0.793353340291235f, -0.60876142900872f, 0.608761429008721f, -0.793353340291235f, 0.38268343236509f, -0.923879532511287f, 0.130526192220052f, -0.99144486137381f,
+	-0.130526192220052f, -0.99144486137381f, -0.38268343236509f, -0.923879532511287f, -0.608761429008721f, -0.793353340291235f, -0.793353340291235f, -0.608761429008721f,
+	-0.923879532511287f, -0.38268343236509f, -0.99144486137381f, -0.130526192220052f, -0.99144486137381f, 0.130526192220051f, -0.923879532511287f, 0.38268343236509f,
+	-0.793353340291235f, 0.608761429008721f, -0.608761429008721f, 0.793353340291235f, -0.38268343236509f, 0.923879532511287f, -0.130526192220052f, 0.99144486137381f,
+	0.130526192220052f, 0.99144486137381f, 0.38268343236509f, 0.923879532511287f, 0.608761429008721f, 0.793353340291235f, 0.793353340291235f, 0.608761429008721f,
+	0.923879532511287f, 0.38268343236509f, 0.99144486137381f, 0.130526192220051f, 0.99144486137381f, -0.130526192220051f, 0.923879532511287f, -0.38268343236509f,
+	0.793353340291235f, -0.60876142900872f, 0.608761429008721f, -0.793353340291235f, 0.38268343236509f, -0.923879532511287f, 0.130526192220052f, -0.99144486137381f,
+	-0.130526192220052f, -0.99144486137381f, -0.38268343236509f, -0.923879532511287f, -0.608761429008721f, -0.793353340291235f, -0.793353340291235f, -0.608761429008721f,
+	-0.923879532511287f, -0.38268343236509f, -0.99144486137381f, -0.130526192220052f, -0.99144486137381f, 0.130526192220051f, -0.923879532511287f, 0.38268343236509f,
+	-0.793353340291235f, 0.608761429008721f, -0.608761429008721f, 0.793353340291235f, -0.38268343236509f, 0.923879532511287f, -0.130526192220052f, 0.99144486137381f,
+	0.130526192220052f, 0.99144486137381f, 0.38268343236509f, 0.923879532511287f, 0.608761429008721f, 0.793353340291235f, 0.793353340291235f, 0.608761429008721f,
+	0.923879532511287f, 0.38268343236509f, 0.99144486137381f, 0.130526192220051f, 0.99144486137381f, -0.130526192220051f, 0.923879532511287f, -0.38268343236509f,
+	0.793353340291235f, -0.60876142900872f, 0.608761429008721f, -0.793353340291235f, 0.38268343236509f, -0.923879532511287f, 0.130526192220052f, -0.99144486137381f,
+	-0.130526192220052f, -0.99144486137381f, -0.38268343236509f, -0.923879532511287f, -0.608761429008721f, -0.793353340291235f, -0.793353340291235f, -0.608761429008721f,
+	-0.923879532511287f, -0.38268343236509f, -0.99144486137381f, -0.130526192220052f, -0.99144486137381f, 0.130526192220051f, -0.923879532511287f, 0.38268343236509f,
+	-0.793353340291235f, 0.608761429008721f, -0.608761429008721f, 0.793353340291235f, -0.38268343236509f, 0.923879532511287f, -0.130526192220052f, 0.99144486137381f,
+	0.130526192220052f, 0.99144486137381f, 0.38268343236509f, 0.923879532511287f, 0.608761429008721f, 0.793353340291235f, 0.793353340291235f, 0.608761429008721f,
+	0.923879532511287f, 0.38268343236509f, 0.99144486137381f, 0.130526192220051f, 0.99144486137381f, -0.130526192220051f, 0.923879532511287f, -0.38268343236509f,
+	0.793353340291235f, -0.60876142900872f, 0.608761429008721f, -0.793353340291235f, 0.38268343236509f, -0.923879532511287f, 0.130526192220052f, -0.99144486137381f,
+	-0.130526192220052f, -0.99144486137381f, -0.38268343236509f, -0.923879532511287f, -0.608761429008721f, -0.793353340291235f, -0.793353340291235f, -0.608761429008721f,
+	-0.923879532511287f, -0.38268343236509f, -0.99144486137381f, -0.130526192220052f, -0.99144486137381f, 0.130526192220051f, -0.923879532511287f, 0.38268343236509f,
+	-0.793353340291235f, 0.608761429008721f, -0.608761429008721f, 0.793353340291235f, -0.38268343236509f, 0.923879532511287f, -0.130526192220052f, 0.99144486137381f,
+	0.38268343236509f, 0.923879532511287f, 0.923879532511287f, 0.38268343236509f, 0.923879532511287f, -0.38268343236509f, 0.38268343236509f, -0.923879532511287f,
+	-0.38268343236509f, -0.923879532511287f, -0.923879532511287f, -0.38268343236509f, -0.923879532511287f, 0.38268343236509f, -0.38268343236509f, 0.923879532511287f,
+};
+
+static const float gradients3D[256] = {
+	0, 1, 1, 0,  0,-1, 1, 0,  0, 1,-1, 0,  0,-1,-1, 0,
+	1, 0, 1, 0, -1, 0, 1, 0,  1, 0,-1, 0, -1, 0,-1, 0,
+	1, 1, 0, 0, -1, 1, 0, 0,  1,-1, 0, 0, -1,-1, 0, 0,
+	0, 1, 1, 0,  0,-1, 1, 0,  0, 1,-1, 0,  0,-1,-1, 0,
+	1, 0, 1, 0, -1, 0, 1, 0,  1, 0,-1, 0, -1, 0,-1, 0,
+	1, 1, 0, 0, -1, 1, 0, 0,  1,-1, 0, 0, -1,-1, 0, 0,
+	0, 1, 1, 0,  0,-1, 1, 0,  0, 1,-1, 0,  0,-1,-1, 0,
+	1, 0, 1, 0, -1, 0, 1, 0,  1, 0,-1, 0, -1, 0,-1, 0,
+	1, 1, 0, 0, -1, 1, 0, 0,  1,-1, 0, 0, -1,-1, 0, 0,
+	0, 1, 1, 0,  0,-1, 1, 0,  0, 1,-1, 0,  0,-1,-1, 0,
+	1, 0, 1, 0, -1, 0, 1, 0,  1, 0,-1, 0, -1, 0,-1, 0,
+	1, 1, 0, 0, -1, 1, 0, 0,  1,-1, 0, 0, -1,-1, 0, 0,
+	0, 1, 1, 0,  0,-1, 1, 0,  0, 1,-1, 0,  0,-1,-1, 0,
+	1, 0, 1, 0, -1, 0, 1, 0,  1, 0,-1, 0, -1, 0,-1, 0,
+	1, 1, 0, 0, -1, 1, 0, 0,  1,-1, 0, 0, -1,-1, 0, 0,
+	1, 1, 0, 0,  0,-1, 1, 0, -1, 1, 0, 0,  0,-1,-1, 0
+};
+#pragma endregion
+
+// константы хеширования FastNoiseLite
+static const int primeX = 501125321;
+static const int primeY = 1136930381;
+static const int primeZ = 1720413743;
+static const int hashMultiplier = 0x27d4eb2d;
+
+#pragma region scalar
+// переполнение при умножении ожидаемо, поэтому умножаем как беззнаковые
+static int mulWrap(int a, int b) {
+	return (int)((u32)a * (u32)b);
+}
+
+static int fastFloor(float f) {
+	return f >= 0 ? (int)f : (int)f - 1;
+}
+
+static float lerp(float a, float b, float t) {
+	return a + t * (b - a);
+}
+
+static float interpQuintic(float t) {
+	return t * t * t * (t * (t * 6 - 15) + 10);
+}
+
+static float gradCoord(int seed, int xPrimed, int yPrimed, float xd, float yd) {
+	int hash = mulWrap(seed ^ xPrimed ^ yPrimed, hashMultiplier);
+	hash ^= hash >> 15;
+	hash &= 127 << 1;
+	return xd * gradients2D[hash] + yd * gradients2D[hash | 1];
+}
+
+static float gradCoord(int seed, int xPrimed, int yPrimed, int zPrimed, float xd, float yd, float zd) {
+	int hash = mulWrap(seed ^ xPrimed ^ yPrimed ^ zPrimed, hashMultiplier);
+	hash ^= hash >> 15;
+	hash &= 63 << 2;
+	return xd * gradients3D[hash] + yd * gradients3D[hash | 1] + zd * gradients3D[hash | 2];
+}
+
+static float perlin(int seed, float x, float y) {
+	int x0 = fastFloor(x);
+	int y0 = fastFloor(y);
+
+	float xd0 = (float)(x - x0);
+	float yd0 = (float)(y - y0);
+	float xd1 = xd0 - 1;
+	float yd1 = yd0 - 1;
+
+	float xs = interpQuintic(xd0);
+	float ys = interpQuintic(yd0);
+
+	x0 = mulWrap(x0, primeX);
+	y0 = mulWrap(y0, primeY);
+	int x1 = x0 + primeX;
+	int y1 = y0 + primeY;
+
+	float xf0 = lerp(gradCoord(seed, x0, y0, xd0, yd0), gradCoord(seed, x1, y0, xd1, yd0), xs);
+	float xf1 = lerp(gradCoord(seed, x0, y1, xd0, yd1), gradCoord(seed, x1, y1, xd1, yd1), xs);
+
+	return lerp(xf0, xf1, ys) * 1.4247691104677813f;
+}
+
+static float perlin(int seed, float x, float y, float z) {
+	int x0 = fastFloor(x);
+	int y0 = fastFloor(y);
+	int z0 = fastFloor(z);
+
+	float xd0 = (float)(x - x0);
+	float yd0 = (float)(y - y0);
+	float zd0 = (float)(z - z0);
+	float xd1 = xd0 - 1;
+	float yd1 = yd0 - 1;
+	float zd1 = zd0 - 1;
+
+	float xs = interpQuintic(xd0);
+	float ys = interpQuintic(yd0);
+	float zs = interpQuintic(zd0);
+
+	x0 = mulWrap(x0, primeX);
+	y0 = mulWrap(y0, primeY);
+	z0 = mulWrap(z0, primeZ);
+	int x1 = x0 + primeX;
+	int y1 = y0 + primeY;
+	int z1 = z0 + primeZ;
+
+	float xf00 = lerp(gradCoord(seed, x0, y0, z0, xd0, yd0, zd0), gradCoord(seed, x1, y0, z0, xd1, yd0, zd0), xs);
+	float xf10 = lerp(gradCoord(seed, x0, y1, z0, xd0, yd1, zd0), gradCoord(seed, x1, y1, z0, xd1, yd1, zd0), xs);
+	float xf01 = lerp(gradCoord(seed, x0, y0, z1, xd0, yd0, zd1), gradCoord(seed, x1, y0, z1, xd1, yd0, zd1), xs);
+	float xf11 = lerp(gradCoord(seed, x0, y1, z1, xd0, yd1, zd1), gradCoord(seed, x1, y1, z1, xd1, yd1, zd1), xs);
+
+	float yf0 = lerp(xf00, xf10, ys);
+	float yf1 = lerp(xf01, xf11, ys);
+
+	return lerp(yf0, yf1, zs) * 0.964921414852142333984375f;
+}
+#pragma endregion
+
+#if NOISE_X86
+#pragma region SSE4.1
+// те же операции, что и в скалярной версии, в том же порядке - результат совпадает побитово
+NOISE_TARGET_SSE41 static inline __m128i floorSSE(__m128 f) {
+	// (int)f для f >= 0, (int)f - 1 для f < 0 (как в FastFloor)
+	__m128i truncated = _mm_cvttps_epi32(f);
+	__m128i negative = _mm_castps_si128(_mm_cmplt_ps(f, _mm_setzero_ps()));
+	return _mm_add_epi32(truncated, negative);
+}
+
+NOISE_TARGET_SSE41 static inline __m128 lerpSSE(__m128 a, __m128 b, __m128 t) {
+	return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+NOISE_TARGET_SSE41 static inline __m128 interpQuinticSSE(__m128 t) {
+	__m128 t3 = _mm_mul_ps(_mm_mul_ps(t, t), t);
+	__m128 poly = _mm_mul_ps(t, _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6)), _mm_set1_ps(15)));
+	return _mm_mul_ps(t3, _mm_add_ps(poly, _mm_set1_ps(10)));
+}
+
+NOISE_TARGET_SSE41 static inline __m128i hashSSE(__m128i seed, __m128i xPrimed, __m128i yPrimed) {
+	__m128i hash = _mm_xor_si128(_mm_xor_si128(seed, xPrimed), yPrimed);
+	hash = _mm_mullo_epi32(hash, _mm_set1_epi32(hashMultiplier));
+	return _mm_xor_si128(hash, _mm_srai_epi32(hash, 15));
+}
+
+NOISE_TARGET_SSE41 static inline __m128 gatherSSE(const float* table, __m128i indices) {
+	alignas(16) int index[4];
+	_mm_store_si128((__m128i*)index, indices);
+	return _mm_setr_ps(table[index[0]], table[index[1]], table[index[2]], table[index[3]]);
+}
+
+NOISE_TARGET_SSE41 static inline __m128 gradCoordSSE(__m128i seed, __m128i xPrimed, __m128i yPrimed, __m128 xd, __m128 yd) {
+	__m128i hash = _mm_and_si128(hashSSE(seed, xPrimed, yPrimed), _mm_set1_epi32(127 << 1));
+	__m128 xg = gatherSSE(gradients2D, hash);
+	__m128 yg = gatherSSE(gradients2D + 1, hash);
+	return _mm_add_ps(_mm_mul_ps(xd, xg), _mm_mul_ps(yd, yg));
+}
+
+NOISE_TARGET_SSE41 static inline __m128 gradCoordSSE(__m128i seed, __m128i xPrimed, __m128i yPrimed, __m128i zPrimed, __m128 xd, __m128 yd, __m128 zd) {
+	__m128i hash = _mm_and_si128(hashSSE(seed, _mm_xor_si128(xPrimed, yPrimed), zPrimed), _mm_set1_epi32(63 << 2));
+	__m128 xg = gatherSSE(gradients3D, hash);
+	__m128 yg = gatherSSE(gradients3D + 1, hash);
+	__m128 zg = gatherSSE(gradients3D + 2, hash);
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(xd, xg), _mm_mul_ps(yd, yg)), _mm_mul_ps(zd, zg));
+}
+
+// возвращает количество обработанных точек (кратно 4), остаток считается скалярно
+NOISE_TARGET_SSE41 static int perlinBatchSSE41(int seedValue, float frequency, const float* xs, const float* ys, int count, float* out) {
+	__m128i seed = _mm_set1_epi32(seedValue);
+	__m128 freq = _mm_set1_ps(frequency);
+	__m128 one = _mm_set1_ps(1);
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 x = _mm_mul_ps(_mm_loadu_ps(xs + i), freq);
+		__m128 y = _mm_mul_ps(_mm_loadu_ps(ys + i), freq);
+		__m128i x0 = floorSSE(x);
+		__m128i y0 = floorSSE(y);
+
+		__m128 xd0 = _mm_sub_ps(x, _mm_cvtepi32_ps(x0));
+		__m128 yd0 = _mm_sub_ps(y, _mm_cvtepi32_ps(y0));
+		__m128 xd1 = _mm_sub_ps(xd0, one);
+		__m128 yd1 = _mm_sub_ps(yd0, one);
+
+		__m128 xsm = interpQuinticSSE(xd0);
+		__m128 ysm = interpQuinticSSE(yd0);
+
+		x0 = _mm_mullo_epi32(x0, _mm_set1_epi32(primeX));
+		y0 = _mm_mullo_epi32(y0, _mm_set1_epi32(primeY));
+		__m128i x1 = _mm_add_epi32(x0, _mm_set1_epi32(primeX));
+		__m128i y1 = _mm_add_epi32(y0, _mm_set1_epi32(primeY));
+
+		__m128 xf0 = lerpSSE(gradCoordSSE(seed, x0, y0, xd0, yd0), gradCoordSSE(seed, x1, y0, xd1, yd0), xsm);
+		__m128 xf1 = lerpSSE(gradCoordSSE(seed, x0, y1, xd0, yd1), gradCoordSSE(seed, x1, y1, xd1, yd1), xsm);
+
+		_mm_storeu_ps(out + i, _mm_mul_ps(lerpSSE(xf0, xf1, ysm), _mm_set1_ps(1.4247691104677813f)));
+	}
+	return i;
+}
+
+NOISE_TARGET_SSE41 static int perlinBatchSSE41(int seedValue, float frequency, const float* xs, const float* ys, const float* zs, int count, float* out) {
+	__m128i seed = _mm_set1_epi32(seedValue);
+	__m128 freq = _mm_set1_ps(frequency);
+	__m128 one = _mm_set1_ps(1);
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 x = _mm_mul_ps(_mm_loadu_ps(xs + i), freq);
+		__m128 y = _mm_mul_ps(_mm_loadu_ps(ys + i), freq);
+		__m128 z = _mm_mul_ps(_mm_loadu_ps(zs + i), freq);
+		__m128i x0 = floorSSE(x);
+		__m128i y0 = floorSSE(y);
+		__m128i z0 = floorSSE(z);
+
+		__m128 xd0 = _mm_sub_ps(x, _mm_cvtepi32_ps(x0));
+		__m128 yd0 = _mm_sub_ps(y, _mm_cvtepi32_ps(y0));
+		__m128 zd0 = _mm_sub_ps(z, _mm_cvtepi32_ps(z0));
+		__m128 xd1 = _mm_sub_ps(xd0, one);
+		__m128 yd1 = _mm_sub_ps(yd0, one);
+		__m128 zd1 = _mm_sub_ps(zd0, one);
+
+		__m128 xsm = interpQuinticSSE(xd0);
+		__m128 ysm = interpQuinticSSE(yd0);
+		__m128 zsm = interpQuinticSSE(zd0);
+
+		x0 = _mm_mullo_epi32(x0, _mm_set1_epi32(primeX));
+		y0 = _mm_mullo_epi32(y0, _mm_set1_epi32(primeY));
+		z0 = _mm_mullo_epi32(z0, _mm_set1_epi32(primeZ));
+		__m128i x1 = _mm_add_epi32(x0, _mm_set1_epi32(primeX));
+		__m128i y1 = _mm_add_epi32(y0, _mm_set1_epi32(primeY));
+		__m128i z1 = _mm_add_epi32(z0, _mm_set1_epi32(primeZ));
+
+		__m128 xf00 = lerpSSE(gradCoordSSE(seed, x0, y0, z0, xd0, yd0, zd0), gradCoordSSE(seed, x1, y0, z0, xd1, yd0, zd0), xsm);
+		__m128 xf10 = lerpSSE(gradCoordSSE(seed, x0, y1, z0, xd0, yd1, zd0), gradCoordSSE(seed, x1, y1, z0, xd1, yd1, zd0), xsm);
+		__m128 xf01 = lerpSSE(gradCoordSSE(seed, x0, y0, z1, xd0, yd0, zd1), gradCoordSSE(seed, x1, y0, z1, xd1, yd0, zd1), xsm);
+		__m128 xf11 = lerpSSE(gradCoordSSE(seed, x0, y1, z1, xd0, yd1, zd1), gradCoordSSE(seed, x1, y1, z1, xd1, yd1, zd1), xsm);
+
+		__m128 yf0 = lerpSSE(xf00, xf10, ysm);
+		__m128 yf1 = lerpSSE(xf01, xf11, ysm);
+
+		_mm_storeu_ps(out + i, _mm_mul_ps(lerpSSE(yf0, yf1, zsm), _mm_set1_ps(0.964921414852142333984375f)));
+	}
+	return i;
+}
+#pragma endregion
+
+#pragma region AVX2
+NOISE_TARGET_AVX2 static inline __m256i floorAVX2(__m256 f) {
+	__m256i truncated = _mm256_cvttps_epi32(f);
+	__m256i negative = _mm256_castps_si256(_mm256_cmp_ps(f, _mm256_setzero_ps(), _CMP_LT_OQ));
+	return _mm256_add_epi32(truncated, negative);
+}
+
+NOISE_TARGET_AVX2 static inline __m256 lerpAVX2(__m256 a, __m256 b, __m256 t) {
+	return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+}
+
+NOISE_TARGET_AVX2 static inline __m256 interpQuinticAVX2(__m256 t) {
+	__m256 t3 = _mm256_mul_ps(_mm256_mul_ps(t, t), t);
+	__m256 poly = _mm256_mul_ps(t, _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6)), _mm256_set1_ps(15)));
+	return _mm256_mul_ps(t3, _mm256_add_ps(poly, _mm256_set1_ps(10)));
+}
+
+NOISE_TARGET_AVX2 static inline __m256i hashAVX2(__m256i seed, __m256i xPrimed, __m256i yPrimed) {
+	__m256i hash = _mm256_xor_si256(_mm256_xor_si256(seed, xPrimed), yPrimed);
+	hash = _mm256_mullo_epi32(hash, _mm256_set1_epi32(hashMultiplier));
+	return _mm256_xor_si256(hash, _mm256_srai_epi32(hash, 15));
+}
+
+NOISE_TARGET_AVX2 static inline __m256 gradCoordAVX2(__m256i seed, __m256i xPrimed, __m256i yPrimed, __m256 xd, __m256 yd) {
+	__m256i hash = _mm256_and_si256(hashAVX2(seed, xPrimed, yPrimed), _mm256_set1_epi32(127 << 1));
+	__m256 xg = _mm256_i32gather_ps(gradients2D, hash, 4);
+	__m256 yg = _mm256_i32gather_ps(gradients2D + 1, hash, 4);
+	return _mm256_add_ps(_mm256_mul_ps(xd, xg), _mm256_mul_ps(yd, yg));
+}
+
+NOISE_TARGET_AVX2 static inline __m256 gradCoordAVX2(__m256i seed, __m256i xPrimed, __m256i yPrimed, __m256i zPrimed, __m256 xd, __m256 yd, __m256 zd) {
+	__m256i hash = _mm256_and_si256(hashAVX2(seed, _mm256_xor_si256(xPrimed, yPrimed), zPrimed), _mm256_set1_epi32(63 << 2));
+	__m256 xg = _mm256_i32gather_ps(gradients3D, hash, 4);
+	__m256 yg = _mm256_i32gather_ps(gradients3D + 1, hash, 4);
+	__m256 zg = _mm256_i32gather_ps(gradients3D + 2, hash, 4);
+	return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(xd, xg), _mm256_mul_ps(yd, yg)), _mm256_mul_ps(zd, zg));
+}
+
+NOISE_TARGET_AVX2 static int perlinBatchAVX2(int seedValue, float frequency, const float* xs, const float* ys, int count, float* out) {
+	__m256i seed = _mm256_set1_epi32(seedValue);
+	__m256 freq = _mm256_set1_ps(frequency);
+	__m256 one = _mm256_set1_ps(1);
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 x = _mm256_mul_ps(_mm256_loadu_ps(xs + i), freq);
+		__m256 y = _mm256_mul_ps(_mm256_loadu_ps(ys + i), freq);
+		__m256i x0 = floorAVX2(x);
+		__m256i y0 = floorAVX2(y);
+
+		__m256 xd0 = _mm256_sub_ps(x, _mm256_cvtepi32_ps(x0));
+		__m256 yd0 = _mm256_sub_ps(y, _mm256_cvtepi32_ps(y0));
+		__m256 xd1 = _mm256_sub_ps(xd0, one);
+		__m256 yd1 = _mm256_sub_ps(yd0, one);
+
+		__m256 xsm = interpQuinticAVX2(xd0);
+		__m256 ysm = interpQuinticAVX2(yd0);
+
+		x0 = _mm256_mullo_epi32(x0, _mm256_set1_epi32(primeX));
+		y0 = _mm256_mullo_epi32(y0, _mm256_set1_epi32(primeY));
+		__m256i x1 = _mm256_add_epi32(x0, _mm256_set1_epi32(primeX));
+		__m256i y1 = _mm256_add_epi32(y0, _mm256_set1_epi32(primeY));
+
+		__m256 xf0 = lerpAVX2(gradCoordAVX2(seed, x0, y0, xd0, yd0), gradCoordAVX2(seed, x1, y0, xd1, yd0), xsm);
+		__m256 xf1 = lerpAVX2(gradCoordAVX2(seed, x0, y1, xd0, yd1), gradCoordAVX2(seed, x1, y1, xd1, yd1), xsm);
+
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(lerpAVX2(xf0, xf1, ysm), _mm256_set1_ps(1.4247691104677813f)));
+	}
+	return i;
+}
+
+NOISE_TARGET_AVX2 static int perlinBatchAVX2(int seedValue, float frequency, const float* xs, const float* ys, const float* zs, int count, float* out) {
+	__m256i seed = _mm256_set1_epi32(seedValue);
+	__m256 freq = _mm256_set1_ps(frequency);
+	__m256 one = _mm256_set1_ps(1);
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 x = _mm256_mul_ps(_mm256_loadu_ps(xs + i), freq);
+		__m256 y = _mm256_mul_ps(_mm256_loadu_ps(ys + i), freq);
+		__m256 z = _mm256_mul_ps(_mm256_loadu_ps(zs + i), freq);
+		__m256i x0 = floorAVX2(x);
+		__m256i y0 = floorAVX2(y);
+		__m256i z0 = floorAVX2(z);
+
+		__m256 xd0 = _mm256_sub_ps(x, _mm256_cvtepi32_ps(x0));
+		__m256 yd0 = _mm256_sub_ps(y, _mm256_cvtepi32_ps(y0));
+		__m256 zd0 = _mm256_sub_ps(z, _mm256_cvtepi32_ps(z0));
+		__m256 xd1 = _mm256_sub_ps(xd0, one);
+		__m256 yd1 = _mm256_sub_ps(yd0, one);
+		__m256 zd1 = _mm256_sub_ps(zd0, one);
+
+		__m256 xsm = interpQuinticAVX2(xd0);
+		__m256 ysm = interpQuinticAVX2(yd0);
+		__m256 zsm = interpQuinticAVX2(zd0);
+
+		x0 = _mm256_mullo_epi32(x0, _mm256_set1_epi32(primeX));
+		y0 = _mm256_mullo_epi32(y0, _mm256_set1_epi32(primeY));
+		z0 = _mm256_mullo_epi32(z0, _mm256_set1_epi32(primeZ));
+		__m256i x1 = _mm256_add_epi32(x0, _mm256_set1_epi32(primeX));
+		__m256i y1 = _mm256_add_epi32(y0, _mm256_set1_epi32(primeY));
+		__m256i z1 = _mm256_add_epi32(z0, _mm256_set1_epi32(primeZ));
+
+		__m256 xf00 = lerpAVX2(gradCoordAVX2(seed, x0, y0, z0, xd0, yd0, zd0), gradCoordAVX2(seed, x1, y0, z0, xd1, yd0, zd0), xsm);
+		__m256 xf10 = lerpAVX2(gradCoordAVX2(seed, x0, y1, z0, xd0, yd1, zd0), gradCoordAVX2(seed, x1, y1, z0, xd1, yd1, zd0), xsm);
+		__m256 xf01 = lerpAVX2(gradCoordAVX2(seed, x0, y0, z1, xd0, yd0, zd1), gradCoordAVX2(seed, x1, y0, z1, xd1, yd0, zd1), xsm);
+		__m256 xf11 = lerpAVX2(gradCoordAVX2(seed, x0, y1, z1, xd0, yd1, zd1), gradCoordAVX2(seed, x1, y1, z1, xd1, yd1, zd1), xsm);
+
+		__m256 yf0 = lerpAVX2(xf00, xf10, ysm);
+		__m256 yf1 = lerpAVX2(xf01, xf11, ysm);
+
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(lerpAVX2(yf0, yf1, zsm), _mm256_set1_ps(0.964921414852142333984375f)));
+	}
+	return i;
+}
+#pragma endregion
+#endif // NOISE_X86
+
+void perlinNoiseBatch(int seed, float frequency, const float* xs, const float* ys, int count, float* out, NoiseSimdLevel level) {
+	int i = 0;
+#if NOISE_X86
+	if (level == noiseSimdAVX2)
+		i = perlinBatchAVX2(seed, frequency, xs, ys, count, out);
+	else if (level == noiseSimdSSE41)
+		i = perlinBatchSSE41(seed, frequency, xs, ys, count, out);
+#endif
+	for (; i < count; i++)
+		out[i] = perlin(seed, xs[i] * frequency, ys[i] * frequency);
+}
+
+void perlinNoiseBatch(int seed, float frequency, const float* xs, const float* ys, const float* zs, int count, float* out, NoiseSimdLevel level) {
+	int i = 0;
+#if NOISE_X86
+	if (level == noiseSimdAVX2)
+		i = perlinBatchAVX2(seed, frequency, xs, ys, zs, count, out);
+	else if (level == noiseSimdSSE41)
+		i = perlinBatchSSE41(seed, frequency, xs, ys, zs, count, out);
+#endif
+	for (; i < count; i++)
+		out[i] = perlin(seed, xs[i] * frequency, ys[i] * frequency, zs[i] * frequency);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "Typedefs.h"
+
+// пакетное вычисление шума Перлина (тот же алгоритм, что и Perlin в FastNoiseLite) сразу для ряда координат.
+// Версия с SIMD выбирается во время выполнения по возможностям процессора
+
+enum NoiseSimdLevel : u8 {
+	noiseSimdScalar,
+	noiseSimdSSE41,
+	noiseSimdAVX2,
+	noiseSimdCOUNT
+};
+
+extern const char* noiseSimdLevelNames[noiseSimdCOUNT];
+
+// уровень для новых задач генерации (читает только основной поток). По умолчанию - лучший доступный,
+// можно понизить для сравнения. Рабочие потоки получают уровень вместе с задачей
+extern NoiseSimdLevel noiseSimdLevel;
+
+NoiseSimdLevel detectNoiseSimdLevel();
+
+// out[i] = шум в точке (xs[i], ys[i]) (и zs[i]), совпадает с FastNoiseLite::GetNoise для NoiseType_Perlin
+// с теми же seed и frequency (с точностью до округления). level не выше detectNoiseSimdLevel()
+void perlinNoiseBatch(int seed, float frequency, const float* xs, const float* ys, int count, float* out, NoiseSimdLevel level);
+void perlinNoiseBatch(int seed, float frequency, const float* xs, const float* ys, const float* zs, int count, float* out, NoiseSimdLevel level);
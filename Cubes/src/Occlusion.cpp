@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <float.h>
+#include <stdlib.h>
+#include "Occlusion.h"
+#include "Chunk.h"
+
+// прямоугольник грани в мировых координатах, так же, как его строит block.vert
+static OcclusionBox faceBox(const BlockFaceInstance& face) {
+	float sx = face.sizeX, sy = face.sizeY;
+	glm::vec3 min(0), max(0);
+	switch (face.face) {
+	case faceYPos: min = glm::vec3(0, 1, 0); max = glm::vec3(sy, 1, sx); break;
+	case faceYNeg: min = glm::vec3(0, 0, 0); max = glm::vec3(sx, 0, sy); break;
+	case faceXPos: min = glm::vec3(0, 0, 0); max = glm::vec3(0, sy, sx); break;
+	case faceXNeg: min = glm::vec3(1, 0, 0); max = glm::vec3(1, sx, sy); break;
+	case faceZPos: min = glm::vec3(0, 0, 0); max = glm::vec3(sy, sx, 0); break;
+	case faceZNeg: min = glm::vec3(0, 0, 1); max = glm::vec3(sx, sy, 1); break;
+	}
+	glm::vec3 offset(
+		face.pos % CHUNK_SX + face.chunkX * CHUNK_SX,
+		face.pos / (CHUNK_SX * CHUNK_SZ),
+		face.pos / CHUNK_SX % CHUNK_SZ + face.chunkZ * CHUNK_SZ);
+	return { min + offset, max + offset };
+}
+
+void selectChunkOccluders(const BlockFaceInstance* faces, u32 faceCount, ChunkOccluders& out) {
+	out.count = 0;
+	out.bounds = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+	int areas[CHUNK_MAX_OCCLUDERS];
+	for (u32 i = 0; i < faceCount; i++) {
+		OcclusionBox box = faceBox(faces[i]);
+		out.bounds.min = glm::min(out.bounds.min, box.min);
+		out.bounds.max = glm::max(out.bounds.max, box.max);
+
+		int area = faces[i].sizeX * faces[i].sizeY;
+		if (area < OCCLUDER_MIN_AREA)
+			continue;
+		// вставка в отсортированный по убыванию площади список
+		int slot = out.count;
+		if (slot == CHUNK_MAX_OCCLUDERS) {
+			if (area <= areas[slot - 1])
+				continue;
+			slot--;
+		}
+		else
+			out.count++;
+		while (slot > 0 && areas[slot - 1] < area) {
+			areas[slot] = areas[slot - 1];
+			out.quads[slot] = out.quads[slot - 1];
+			slot--;
+		}
+		areas[slot] = area;
+		out.quads[slot] = box;
+	}
+}
+
+void OcclusionBuffer::init() {
+	for (int l = 0; l < OCCLUSION_LEVELS; l++)
+		levels[l] = (float*)malloc((OCCLUSION_WIDTH >> l) * (OCCLUSION_HEIGHT >> l) * sizeof(float));
+	occluders = NULL;
+	candidates = NULL;
+	occluderCount = occluderCapacity = 0;
+}
+
+#pragma region rasterization
+struct ScreenVertex {
+	float x, y, z; // пиксели, глубина [0, 1]
+};
+
+// закрашиваются только пиксели, целиком покрытые многоугольником, глубина - самая дальняя точка многоугольника в пределах пикселя.
+// Поэтому буфер никогда не закрывает больше, чем закрывают сами окклюдеры. Четырехугольник рисуется целиком,
+// а не двумя треугольниками: иначе пиксели на диагонали не покрыты ни одним из них
+static void rasterizePolygon(float* depth, ScreenVertex* v, int count) {
+	// удвоенная площадь со знаком
+	float area = 0;
+	for (int i = 1; i + 1 < count; i++)
+		area += (v[i].x - v[0].x) * (v[i + 1].y - v[0].y) - (v[i + 1].x - v[0].x) * (v[i].y - v[0].y);
+	if (fabsf(area) < 1e-6f)
+		return;
+	if (area < 0)
+		std::reverse(v, v + count);
+
+	// треугольник для градиента глубины выбирается после разворота: до него индексы и знак площади другие
+	int bestTriangle = 1;
+	float bestTriangleArea = 0;
+	for (int i = 1; i + 1 < count; i++) {
+		float triangleArea = (v[i].x - v[0].x) * (v[i + 1].y - v[0].y) - (v[i + 1].x - v[0].x) * (v[i].y - v[0].y);
+		if (fabsf(triangleArea) > fabsf(bestTriangleArea)) {
+			bestTriangleArea = triangleArea;
+			bestTriangle = i;
+		}
+	}
+
+	float minXf = v[0].x, maxXf = v[0].x, minYf = v[0].y, maxYf = v[0].y, zMax = v[0].z;
+	for (int i = 1; i < count; i++) {
+		minXf = std::min(minXf, v[i].x); maxXf = std::max(maxXf, v[i].x);
+		minYf = std::min(minYf, v[i].y); maxYf = std::max(maxYf, v[i].y);
+		zMax = std::max(zMax, v[i].z);
+	}
+	int minX = std::max(0, (int)floorf(minXf)), maxX = std::min(OCCLUSION_WIDTH - 1, (int)ceilf(maxXf));
+	int minY = std::max(0, (int)floorf(minYf)), maxY = std::min(OCCLUSION_HEIGHT - 1, (int)ceilf(maxYf));
+	if (minX > maxX || minY > maxY)
+		return;
+
+	// ребро i: e(x, y) = a * x + b * y + c >= 0 внутри. Пиксель покрыт целиком, если e в центре >= половины размаха по пикселю
+	float a[5], b[5], c[5];
+	for (int i = 0; i < count; i++) {
+		const ScreenVertex& p = v[i];
+		const ScreenVertex& q = v[(i + 1) % count];
+		a[i] = p.y - q.y;
+		b[i] = q.x - p.x;
+		c[i] = p.x * q.y - p.y * q.x - 0.5f * (fabsf(a[i]) + fabsf(b[i]));
+	}
+
+	// многоугольник плоский, глубина линейна в экранных координатах
+	const ScreenVertex& t0 = v[0];
+	const ScreenVertex& t1 = v[bestTriangle];
+	const ScreenVertex& t2 = v[bestTriangle + 1];
+	float dzdx = ((t1.z - t0.z) * (t2.y - t0.y) - (t2.z - t0.z) * (t1.y - t0.y)) / bestTriangleArea;
+	float dzdy = ((t2.z - t0.z) * (t1.x - t0.x) - (t1.z - t0.z) * (t2.x - t0.x)) / bestTriangleArea;
+	float zSpread = 0.5f * (fabsf(dzdx) + fabsf(dzdy));
+
+	for (int y = minY; y <= maxY; y++) {
+		float py = y + 0.5f;
+		float px = minX + 0.5f;
+		float e[5];
+		for (int i = 0; i < count; i++)
+			e[i] = a[i] * px + b[i] * py + c[i];
+		float z = t0.z + dzdx * (px - t0.x) + dzdy * (py - t0.y) + zSpread;
+		float* row = depth + y * OCCLUSION_WIDTH;
+		for (int x = minX; x <= maxX; x++) {
+			bool inside = true;
+			for (int i = 0; i < count; i++) {
+				inside &= e[i] >= 0;
+				e[i] += a[i];
+			}
+			if (inside) {
+				float pixelZ = std::min(z, zMax);
+				if (pixelZ < row[x])
+					row[x] = pixelZ;
+			}
+			z += dzdx;
+		}
+	}
+}
+
+static ScreenVertex toScreen(glm::vec4 clip) {
+	glm::vec3 ndc = glm::vec3(clip) / clip.w;
+	return { (ndc.x * 0.5f + 0.5f) * OCCLUSION_WIDTH, (ndc.y * 0.5f + 0.5f) * OCCLUSION_HEIGHT, ndc.z * 0.5f + 0.5f };
+}
+
+// четырехугольник в пространстве отсечения, обрезанный по ближней плоскости (z >= -w)
+static void rasterizeQuad(float* depth, const glm::vec4* quad) {
+	glm::vec4 clipped[5];
+	int count = 0;
+	for (int i = 0; i < 4; i++) {
+		const glm::vec4& p = quad[i];
+		const glm::vec4& q = quad[(i + 1) % 4];
+		float dp = p.z + p.w, dq = q.z + q.w;
+		if (dp >= 0)
+			clipped[count++] = p;
+		if ((dp >= 0) != (dq >= 0))
+			clipped[count++] = p + (q - p) * (dp / (dp - dq));
+	}
+	if (count < 3)
+		return;
+
+	ScreenVertex screen[5];
+	for (int i = 0; i < count; i++) {
+		if (clipped[i].w <= 1e-5f)
+			return;
+		screen[i] = toScreen(clipped[i]);
+	}
+	rasterizePolygon(depth, screen, count);
+}
+#pragma endregion
+
+void OcclusionBuffer::rasterize(const glm::mat4& viewProjection, glm::vec3 cameraPos, const ChunkOccluders* const* chunks, int chunkCount, int maxOccluders) {
+	this->viewProjection = viewProjection;
+
+	// все кандидаты, затем maxOccluders с наибольшей площадью относительно квадрата расстояния
+	int candidateCount = 0;
+	for (int c = 0; c < chunkCount; c++)
+		candidateCount += chunks[c]->count;
+	if (candidateCount > occluderCapacity) {
+		occluderCapacity = candidateCount;
+		occluders = (OcclusionBox*)realloc(occluders, occluderCapacity * sizeof(OcclusionBox));
+		candidates = (Candidate*)realloc(candidates, occluderCapacity * sizeof(Candidate));
+	}
+	int count = 0;
+	for (int c = 0; c < chunkCount; c++) {
+		for (int i = 0; i < chunks[c]->count; i++) {
+			const OcclusionBox& box = chunks[c]->quads[i];
+			glm::vec3 size = box.max - box.min;
+			float area = std::max({ size.x * size.y, size.x * size.z, size.y * size.z });
+			glm::vec3 toCamera = (box.min + box.max) * 0.5f - cameraPos;
+			candidates[count++] = { area / (glm::dot(toCamera, toCamera) + 1.0f), &box };
+		}
+	}
+	if (count > maxOccluders) {
+		std::nth_element(candidates, candidates + maxOccluders, candidates + count,
+			[](const Candidate& a, const Candidate& b) { return a.score > b.score; });
+		count = maxOccluders;
+	}
+	for (int i = 0; i < count; i++)
+		occluders[i] = *candidates[i].box;
+	occluderCount = count;
+
+	float* depth = levels[0];
+	for (int i = 0; i < OCCLUSION_WIDTH * OCCLUSION_HEIGHT; i++)
+		depth[i] = FLT_MAX;
+
+	for (int i = 0; i < occluderCount; i++) {
+		const OcclusionBox& box = occluders[i];
+		glm::vec3 size = box.max - box.min;
+		// у грани вырождена одна ось, остальные две задают четырехугольник
+		glm::vec3 u, v;
+		if (size.x == 0)		{ u = glm::vec3(0, size.y, 0); v = glm::vec3(0, 0, size.z); }
+		else if (size.y == 0)	{ u = glm::vec3(size.x, 0, 0); v = glm::vec3(0, 0, size.z); }
+		else					{ u = glm::vec3(size.x, 0, 0); v = glm::vec3(0, size.y, 0); }
+		glm::vec4 quad[4] = {
+			viewProjection * glm::vec4(box.min, 1),
+			viewProjection * glm::vec4(box.min + u, 1),
+			viewProjection * glm::vec4(box.min + u + v, 1),
+			viewProjection * glm::vec4(box.min + v, 1),
+		};
+		rasterizeQuad(depth, quad);
+	}
+
+	// Hi-Z: каждый уровень хранит самую дальнюю глубину из 2x2 пикселей предыдущего
+	for (int l = 1; l < OCCLUSION_LEVELS; l++) {
+		int width = OCCLUSION_WIDTH >> l, height = OCCLUSION_HEIGHT >> l;
+		const float* src = levels[l - 1];
+		float* dst = levels[l];
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				const float* s = src + (y * 2) * (width * 2) + x * 2;
+				dst[y * width + x] = std::max(std::max(s[0], s[1]), std::max(s[width * 2], s[width * 2 + 1]));
+			}
+		}
+	}
+}
+
+// пиксели уровня 0 [x0, x1] x [y0, y1] под проекцией бокса и ближайшая глубина бокса.
+// false - бокс пересекает ближнюю плоскость или целиком за пределами экрана: такой бокс не отсекается
+static bool boxScreenRect(const glm::mat4& viewProjection, const OcclusionBox& box, int* x0, int* y0, int* x1, int* y1, float* minZ) {
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	*minZ = FLT_MAX;
+	for (int i = 0; i < 8; i++) {
+		glm::vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+		glm::vec4 clip = viewProjection * glm::vec4(corner, 1);
+		if (clip.z < -clip.w || clip.w <= 1e-5f)
+			return false;
+		ScreenVertex p = toScreen(clip);
+		minX = std::min(minX, p.x); maxX = std::max(maxX, p.x);
+		minY = std::min(minY, p.y); maxY = std::max(maxY, p.y);
+		*minZ = std::min(*minZ, p.z);
+	}
+	*x0 = std::max(0, (int)floorf(minX)); *x1 = std::min(OCCLUSION_WIDTH - 1, (int)floorf(maxX));
+	*y0 = std::max(0, (int)floorf(minY)); *y1 = std::min(OCCLUSION_HEIGHT - 1, (int)floorf(maxY));
+	return *x0 <= *x1 && *y0 <= *y1;
+}
+
+bool OcclusionBuffer::isVisible(const OcclusionBox& box) const {
+	int x0, y0, x1, y1;
+	float minZ;
+	if (!boxScreenRect(viewProjection, box, &x0, &y0, &x1, &y1, &minZ))
+		return true; // за пределами экрана это решает отсечение по пирамиде
+
+	// уровень, на котором прямоугольник бокса занимает не больше 8x8 пикселей
+	int level = 0;
+	while (level < OCCLUSION_LEVELS - 1 && ((x1 >> level) - (x0 >> level) > 7 || (y1 >> level) - (y0 >> level) > 7))
+		level++;
+	int width = OCCLUSION_WIDTH >> level;
+	const float* depth = levels[level];
+	float maxDepth = 0;
+	for (int y = y0 >> level; y <= (y1 >> level); y++)
+		for (int x = x0 >> level; x <= (x1 >> level); x++)
+			maxDepth = std::max(maxDepth, depth[y * width + x]);
+	return minZ <= maxDepth;
+}
+
+// расстояние до входа луча в бокс, отрицательное - нет пересечения
+static float rayEnterBox(glm::vec3 origin, glm::vec3 dir, const OcclusionBox& box) {
+	float tEnter = -FLT_MAX, tExit = FLT_MAX;
+	for (int a = 0; a < 3; a++) {
+		if (fabsf(dir[a]) < 1e-9f) {
+			if (origin[a] < box.min[a] || origin[a] > box.max[a])
+				return -1;
+			continue;
+		}
+		float t0 = (box.min[a] - origin[a]) / dir[a];
+		float t1 = (box.max[a] - origin[a]) / dir[a];
+		if (t0 > t1) std::swap(t0, t1);
+		tEnter = std::max(tEnter, t0);
+		tExit = std::min(tExit, t1);
+	}
+	if (tEnter > tExit || tEnter <= 0)
+		return -1;
+	return tEnter;
+}
+
+// эталон на разрешении буфера: лучи через центр, углы и середины сторон каждого пикселя уровня 0 под прямоугольником бокса
+// (тот же прямоугольник, что проверяет isVisible). Просвет между окклюдерами не уже полупикселя попадает хотя бы
+// в один луч. Лучи идут от ближней плоскости: окклюдеры ближе нее не растеризуются
+OcclusionSelfTest occlusionSelfTest(const OcclusionBuffer& buffer, const OcclusionBox* boxes, int boxCount) {
+	glm::mat4 inverseViewProjection = glm::inverse(buffer.viewProjection);
+	auto screenRay = [&](float sx, float sy, glm::vec3* origin, glm::vec3* dir) {
+		float x = sx / OCCLUSION_WIDTH * 2 - 1, y = sy / OCCLUSION_HEIGHT * 2 - 1;
+		glm::vec4 nearPoint = inverseViewProjection * glm::vec4(x, y, -1, 1);
+		glm::vec4 farPoint = inverseViewProjection * glm::vec4(x, y, 1, 1);
+		*origin = glm::vec3(nearPoint) / nearPoint.w;
+		*dir = glm::vec3(farPoint) / farPoint.w - *origin;
+	};
+
+	OcclusionSelfTest result = {};
+	for (int b = 0; b < boxCount; b++) {
+		const OcclusionBox& box = boxes[b];
+		bool culled = !buffer.isVisible(box);
+
+		// бокс закрыт, если каждый луч, попавший в бокс, раньше входит в окклюдер.
+		// Бокс без прямоугольника на экране не отсекается, эталон для него не нужен
+		int x0, y0, x1, y1;
+		float minZ;
+		bool onScreen = boxScreenRect(buffer.viewProjection, box, &x0, &y0, &x1, &y1, &minZ);
+		bool referenceVisible = !onScreen;
+		int insideSamples = 0;
+		if (onScreen) {
+			int samplesX = (x1 - x0 + 1) * 2 + 1, samplesY = (y1 - y0 + 1) * 2 + 1;
+			for (int sy = 0; sy < samplesY && !referenceVisible; sy++) {
+				for (int sx = 0; sx < samplesX && !referenceVisible; sx++) {
+					glm::vec3 origin, dir;
+					screenRay(x0 + sx * 0.5f, y0 + sy * 0.5f, &origin, &dir);
+					float boxT = rayEnterBox(origin, dir, box);
+					if (boxT < 0)
+						continue;
+					insideSamples++;
+
+					// грани чанка лежат на границе его бокса: окклюдер в той же точке бокс не закрывает
+					bool hidden = false;
+					for (int o = 0; o < buffer.occluderCount && !hidden; o++) {
+						float t = rayEnterBox(origin, dir, buffer.occluders[o]);
+						hidden = t > 0 && t < boxT * (1.0f - 1e-5f);
+					}
+					referenceVisible = !hidden;
+				}
+			}
+		}
+
+		result.tested++;
+		result.culled += culled;
+		result.referenceCulled += insideSamples > 0 && !referenceVisible;
+		result.falseCulls += culled && referenceVisible;
+	}
+	return result;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <glm.hpp>
+#include "Typedefs.h"
+#include "Mesh.h"
+
+// программное отсечение перекрытых чанков: самые крупные грани мешей рисуются в буфер глубины низкого разрешения,
+// границы чанков проверяются по иерархии максимумов глубины (Hi-Z)
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+#define OCCLUSION_LEVELS 8 // до 2x1
+
+#define CHUNK_MAX_OCCLUDERS 32 // граней-окклюдеров на чанк
+#define OCCLUDER_MIN_AREA 4 // меньшие грани почти ничего не закрывают
+
+// бокс в мировых координатах. У грани одна из осей вырождена (min == max)
+struct OcclusionBox {
+	glm::vec3 min, max;
+};
+
+// данные чанка для отсечения, пересчитываются при отправке меша на ГПУ
+struct ChunkOccluders {
+	OcclusionBox bounds; // граница всех граней меша
+	OcclusionBox quads[CHUNK_MAX_OCCLUDERS]; // самые большие грани
+	int count;
+};
+
+void selectChunkOccluders(const BlockFaceInstance* faces, u32 faceCount, ChunkOccluders& out);
+
+struct OcclusionBuffer {
+	float* levels[OCCLUSION_LEVELS]; // уровень 0 - глубина окклюдеров, далее - максимум по 2x2
+	glm::mat4 viewProjection;
+	OcclusionBox* occluders; // отобранные для растеризации
+	int occluderCount;
+	int occluderCapacity;
+
+	struct Candidate {
+		float score;
+		const OcclusionBox* box;
+	};
+	Candidate* candidates;
+
+	void init();
+	// отбирает до maxOccluders граней, ближайших и крупнейших относительно камеры, и растеризует их
+	void rasterize(const glm::mat4& viewProjection, glm::vec3 cameraPos, const ChunkOccluders* const* chunks, int chunkCount, int maxOccluders);
+	// false - бокс гарантированно закрыт окклюдерами
+	bool isVisible(const OcclusionBox& box) const;
+};
+
+// сравнение с эталоном: лучи через каждый пиксель буфера под боксом проверяются против тех же окклюдеров
+struct OcclusionSelfTest {
+	int tested;
+	int culled; // отсечено по Hi-Z
+	int referenceCulled; // отсечено бы по эталону
+	int falseCulls; // отсечено по Hi-Z, но по эталону видно. Должно быть 0
+};
+
+OcclusionSelfTest occlusionSelfTest(const OcclusionBuffer& buffer, const OcclusionBox* boxes, int boxCount);
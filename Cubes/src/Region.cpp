@@ -0,0 +1,479 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include "Region.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static int floorDivRegion(int a, int b) {
+	int q = a / b;
+	if ((a % b != 0) && ((a < 0) != (b < 0)))
+		q--;
+	return q;
+}
+
+static u64 elapsedUS(std::chrono::steady_clock::time_point start) {
+	return (u64)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+#pragma region Encoding
+// заголовок, биомы и худший случай серий: каждый блок отдельной серией
+u32 regionPayloadBound() {
+	return sizeof(RegionChunkHeader) + CHUNK_SX * CHUNK_SZ * sizeof(Biome) + CHUNK_SIZE * 3;
+}
+
+u32 encodeRegionChunk(const BlockType* blocks, const Biome* biomes, u8* out) {
+	u8* p = out + sizeof(RegionChunkHeader);
+	memcpy(p, biomes, CHUNK_SX * CHUNK_SZ * sizeof(Biome));
+	p += CHUNK_SX * CHUNK_SZ * sizeof(Biome);
+	// в слое y блоки обычно одного типа: серии идут по слоям
+	for (int i = 0; i < CHUNK_SIZE;) {
+		BlockType type = blocks[i];
+		int run = 1;
+		while (i + run < CHUNK_SIZE && run < 0xFFFF && blocks[i + run] == type)
+			run++;
+		p[0] = (u8)run;
+		p[1] = (u8)(run >> 8);
+		p[2] = (u8)type;
+		p += 3;
+		i += run;
+	}
+	RegionChunkHeader header = {};
+	header.size = (u32)(p - out - sizeof(RegionChunkHeader));
+	header.version = REGION_FORMAT_VERSION;
+	memcpy(out, &header, sizeof(header));
+	return (u32)(p - out);
+}
+
+// false - данные повреждены или другой версии формата, чанк будет сгенерирован заново
+bool decodeRegionChunk(const u8* payload, u32 size, Block* blocks, Biome* biomes) {
+	RegionChunkHeader header;
+	if (size < sizeof(header))
+		return false;
+	memcpy(&header, payload, sizeof(header));
+	if (header.version != REGION_FORMAT_VERSION || header.size > size - sizeof(header)
+		|| header.size < CHUNK_SX * CHUNK_SZ * sizeof(Biome))
+		return false;
+	const u8* p = payload + sizeof(header);
+	const u8* end = p + header.size;
+	memcpy(biomes, p, CHUNK_SX * CHUNK_SZ * sizeof(Biome));
+	p += CHUNK_SX * CHUNK_SZ * sizeof(Biome);
+	int i = 0;
+	while (p + 3 <= end) {
+		int run = p[0] | (p[1] << 8);
+		BlockType type = (BlockType)p[2];
+		p += 3;
+		if (run == 0 || i + run > CHUNK_SIZE || type >= btCOUNT)
+			return false;
+		for (int j = 0; j < run; j++)
+			blocks[i + j].type = type;
+		i += run;
+	}
+	return i == CHUNK_SIZE && p == end;
+}
+#pragma endregion
+
+#pragma region Files
+static void makeFolder(const char* path) {
+#ifdef _WIN32
+	_mkdir(path);
+#else
+	mkdir(path, 0755);
+#endif
+}
+
+// создает папку и все родительские, ошибки (папка уже есть) не важны
+static void makeFolders(const char* path) {
+	char buffer[256];
+	strncpy(buffer, path, sizeof(buffer) - 1);
+	buffer[sizeof(buffer) - 1] = 0;
+	for (char* c = buffer + 1; *c; c++) {
+		if (*c == '/' || *c == '\\') {
+			char separator = *c;
+			*c = 0;
+			makeFolder(buffer);
+			*c = separator;
+		}
+	}
+	makeFolder(buffer);
+}
+
+static void regionPath(const RegionStorage& storage, int regionX, int regionZ, char* out, size_t size) {
+	snprintf(out, size, "%sr.%d.%d.region", storage.folder, regionX, regionZ);
+}
+
+static void unmapRegion(RegionFile& region) {
+	if (!region.view)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(region.view);
+	CloseHandle((HANDLE)region.mapping);
+#else
+	munmap(region.view, region.viewSize);
+#endif
+	region.view = NULL;
+	region.mapping = NULL;
+	region.viewSize = 0;
+}
+
+// отображение заново, если файл вырос после прошлого отображения. Записанное в отображенную часть видно и так
+static bool mapRegion(RegionFile& region) {
+	if (region.view && region.viewSize == region.fileSize)
+		return true;
+	unmapRegion(region);
+	if (region.fileSize == 0)
+		return false;
+#ifdef _WIN32
+	HANDLE mapping = CreateFileMappingA((HANDLE)region.file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping)
+		return false;
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, region.fileSize);
+	if (!view) {
+		CloseHandle(mapping);
+		return false;
+	}
+	region.mapping = mapping;
+#else
+	void* view = mmap(NULL, region.fileSize, PROT_READ, MAP_SHARED, (int)region.file, 0);
+	if (view == MAP_FAILED)
+		return false;
+#endif
+	region.view = (u8*)view;
+	region.viewSize = region.fileSize;
+	return true;
+}
+
+static bool writeRegionAt(RegionFile& region, u64 offset, const void* data, size_t size) {
+#ifdef _WIN32
+	OVERLAPPED overlapped = {};
+	overlapped.Offset = (DWORD)offset;
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+	DWORD written = 0;
+	if (!WriteFile((HANDLE)region.file, data, (DWORD)size, &written, &overlapped) || written != size)
+		return false;
+#else
+	if (pwrite((int)region.file, data, size, (off_t)offset) != (ssize_t)size)
+		return false;
+#endif
+	region.fileSize = std::max(region.fileSize, (size_t)(offset + size));
+	return true;
+}
+
+static void closeRegion(RegionFile& region) {
+	unmapRegion(region);
+	if (region.exists) {
+#ifdef _WIN32
+		CloseHandle((HANDLE)region.file);
+#else
+		close((int)region.file);
+#endif
+	}
+	region.open = false;
+	region.exists = false;
+}
+
+// открыть существующий файл региона; create - создать, если его нет
+static bool openRegionFile(RegionStorage& storage, RegionFile& region, bool create) {
+	char path[300];
+	regionPath(storage, region.regionX, region.regionZ, path, sizeof(path));
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+		create ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	region.file = (intptr_t)file;
+	region.fileSize = (size_t)size.QuadPart;
+#else
+	int file = open(path, O_RDWR | (create ? O_CREAT : 0), 0644);
+	if (file < 0)
+		return false;
+	struct stat info;
+	fstat(file, &info);
+	region.file = file;
+	region.fileSize = (size_t)info.st_size;
+#endif
+	region.exists = true;
+	// новый файл начинается с пустого заголовка
+	if (region.fileSize < REGION_HEADER_SECTORS * REGION_SECTOR) {
+		memset(region.offsets, 0, sizeof(region.offsets));
+		region.fileSize = 0;
+		return writeRegionAt(region, 0, region.offsets, sizeof(region.offsets));
+	}
+	if (!mapRegion(region))
+		return false;
+	memcpy(region.offsets, region.view, sizeof(region.offsets));
+	return true;
+}
+#pragma endregion
+
+void RegionStorage::init(const char* folder, JobSystem* jobs) {
+	snprintf(this->folder, sizeof(this->folder), "%s", folder);
+	makeFolders(folder);
+	this->jobs = jobs;
+	for (int i = 0; i < REGION_CACHE; i++) {
+		files[i] = {};
+		files[i].file = -1;
+	}
+	useCounter = 0;
+	pendingSaves = {};
+	savedChunks = loadedChunks = 0;
+	savedBytes = saveUS = loadUS = 0;
+}
+
+void RegionStorage::shutdown() {
+	std::lock_guard<std::mutex> guard(lock);
+	for (int i = 0; i < REGION_CACHE; i++)
+		if (files[i].open)
+			closeRegion(files[i]);
+}
+
+void RegionStorage::removeFiles() {
+	std::lock_guard<std::mutex> guard(lock);
+	for (int i = 0; i < REGION_CACHE; i++) {
+		if (!files[i].open)
+			continue;
+		bool existed = files[i].exists;
+		closeRegion(files[i]);
+		if (existed) {
+			char path[300];
+			regionPath(*this, files[i].regionX, files[i].regionZ, path, sizeof(path));
+			remove(path);
+		}
+	}
+}
+
+// под lock. Регион из кеша открытых, иначе закрывается давно не использованный.
+// Отсутствующий файл тоже кешируется, чтобы не искать его на диске для каждого чанка
+RegionFile* RegionStorage::getFile(int regionX, int regionZ) {
+	RegionFile* oldest = &files[0];
+	for (int i = 0; i < REGION_CACHE; i++) {
+		RegionFile& region = files[i];
+		if (region.open && region.regionX == regionX && region.regionZ == regionZ) {
+			region.lastUse = ++useCounter;
+			return &region;
+		}
+		if (!region.open || (oldest->open && region.lastUse < oldest->lastUse))
+			oldest = &region;
+	}
+	if (oldest->open)
+		closeRegion(*oldest);
+	RegionFile& region = *oldest;
+	region.regionX = regionX;
+	region.regionZ = regionZ;
+	region.open = true;
+	region.lastUse = ++useCounter;
+	if (!openRegionFile(*this, region, false)) {
+		if (region.exists)
+			closeRegion(region);
+		region.open = true;
+		region.exists = false;
+		memset(region.offsets, 0, sizeof(region.offsets));
+	}
+	return &region;
+}
+
+// под lock: копия данных чанка из отображения файла
+bool RegionStorage::readPayload(RegionFile& region, int slot, u8* out, u32* outSize) {
+	u32 entry = region.offsets[slot];
+	if (!region.exists || entry == 0)
+		return false;
+	u64 offset = (u64)(entry >> 8) * REGION_SECTOR;
+	u64 size = (u64)(entry & 0xFF) * REGION_SECTOR;
+	if (!mapRegion(region) || offset + sizeof(RegionChunkHeader) > region.viewSize)
+		return false;
+	RegionChunkHeader header;
+	memcpy(&header, region.view + offset, sizeof(header));
+	u64 payloadSize = sizeof(header) + (u64)header.size;
+	if (payloadSize > size || offset + payloadSize > region.viewSize || payloadSize > regionPayloadBound())
+		return false;
+	memcpy(out, region.view + offset, payloadSize);
+	*outSize = (u32)payloadSize;
+	return true;
+}
+
+// под lock: данные всегда пишутся в первый свободный промежуток секторов, прежние сектора чанка
+// не трогаются. Запись заголовка последней переключает чанк на новые данные и освобождает старые сектора
+bool RegionStorage::writePayload(RegionFile& region, int slot, const u8* payload, u32 size) {
+	u32 sectors = (size + REGION_SECTOR - 1) / REGION_SECTOR;
+	if (sectors > REGION_MAX_CHUNK_SECTORS)
+		return false;
+	if (!region.exists) {
+		closeRegion(region);
+		region.open = true;
+		if (!openRegionFile(*this, region, true)) {
+			closeRegion(region);
+			region.open = true;
+			return false;
+		}
+	}
+
+	// занятые сектора, включая текущую версию этого чанка
+	u32 fileSectors = (u32)((region.fileSize + REGION_SECTOR - 1) / REGION_SECTOR);
+	u32 totalSectors = std::max(fileSectors, (u32)REGION_HEADER_SECTORS);
+	u8* used = (u8*)calloc(totalSectors, 1);
+	memset(used, 1, REGION_HEADER_SECTORS);
+	for (int i = 0; i < REGION_CHUNKS; i++) {
+		u32 entry = region.offsets[i];
+		for (u32 s = entry >> 8; s < (entry >> 8) + (entry & 0xFF) && s < totalSectors; s++)
+			used[s] = 1;
+	}
+	u32 start = totalSectors;
+	for (u32 s = REGION_HEADER_SECTORS, run = 0; s < totalSectors; s++) {
+		run = used[s] ? 0 : run + 1;
+		if (run == sectors) {
+			start = s + 1 - sectors;
+			break;
+		}
+	}
+	free(used);
+
+	// сектор дописывается целиком, чтобы следующий чанк начинался с границы сектора
+	static thread_local u8 padding[REGION_SECTOR];
+	if (!writeRegionAt(region, (u64)start * REGION_SECTOR, payload, size))
+		return false;
+	u32 tail = sectors * REGION_SECTOR - size;
+	if (tail > 0 && !writeRegionAt(region, (u64)start * REGION_SECTOR + size, padding, tail))
+		return false;
+	region.offsets[slot] = start << 8 | sectors;
+	return writeRegionAt(region, (u64)slot * sizeof(u32), &region.offsets[slot], sizeof(u32));
+}
+
+static int regionSlot(int posx, int posz, int* regionX, int* regionZ) {
+	int chunkX = floorDivRegion(posx, CHUNK_SX), chunkZ = floorDivRegion(posz, CHUNK_SZ);
+	*regionX = floorDivRegion(chunkX, REGION_SIZE);
+	*regionZ = floorDivRegion(chunkZ, REGION_SIZE);
+	return (chunkX - *regionX * REGION_SIZE) + (chunkZ - *regionZ * REGION_SIZE) * REGION_SIZE;
+}
+
+// под lock
+bool RegionStorage::writeChunk(int posx, int posz, const u8* payload, u32 size) {
+	int regionX, regionZ;
+	int slot = regionSlot(posx, posz, &regionX, &regionZ);
+	if (!writePayload(*getFile(regionX, regionZ), slot, payload, size)) {
+		fprintf(stderr, "Failed to save chunk (%d, %d) to %s\n", posx, posz, folder);
+		return false;
+	}
+	return true;
+}
+
+static u8* threadPayloadBuffer() {
+	static thread_local u8* payload = NULL;
+	if (!payload)
+		payload = (u8*)malloc(regionPayloadBound());
+	return payload;
+}
+
+u32 RegionStorage::saveChunk(int posx, int posz, const BlockType* blocks, const Biome* biomes) {
+	auto start = std::chrono::steady_clock::now();
+	u8* payload = threadPayloadBuffer();
+	u32 size = encodeRegionChunk(blocks, biomes, payload);
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (!writeChunk(posx, posz, payload, size))
+			return 0;
+	}
+	savedChunks++;
+	savedBytes += size;
+	saveUS += elapsedUS(start);
+	return size;
+}
+
+static void regionSaveJob(void* data) {
+	RegionSave* save = (RegionSave*)data;
+	RegionStorage& storage = *save->storage;
+	auto start = std::chrono::steady_clock::now();
+	u8* payload = threadPayloadBuffer();
+	u32 size = encodeRegionChunk(save->blocks, save->biomes, payload);
+
+	bool written = false;
+	{
+		// проверка и запись под одной блокировкой: более поздний снимок не будет затерт этим
+		std::lock_guard<std::mutex> guard(storage.lock);
+		if (!save->superseded)
+			written = storage.writeChunk(save->posx, save->posz, payload, size);
+		// снимок нужен загрузке, пока данные не на диске
+		for (int i = 0; i < storage.pendingSaves.count; i++) {
+			if (storage.pendingSaves.items[i] == save) {
+				storage.pendingSaves.items[i] = storage.pendingSaves.items[--storage.pendingSaves.count];
+				break;
+			}
+		}
+	}
+	if (written) {
+		storage.savedChunks++;
+		storage.savedBytes += size;
+		storage.saveUS += elapsedUS(start);
+	}
+	free(save);
+}
+
+void RegionStorage::queueSave(const Chunk& chunk) {
+	RegionSave* save = (RegionSave*)malloc(sizeof(RegionSave));
+	save->storage = this;
+	save->posx = chunk.posx;
+	save->posz = chunk.posz;
+	save->superseded = false;
+	chunk.blocks.unpack(save->blocks);
+	memcpy(save->biomes, chunk.columns.biomes, sizeof(save->biomes));
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		// прежний снимок того же чанка мог еще не записаться: записи не должны обогнать друг друга
+		for (int i = 0; i < pendingSaves.count; i++) {
+			RegionSave* other = pendingSaves.items[i];
+			if (other->posx == save->posx && other->posz == save->posz)
+				other->superseded = true;
+		}
+		pendingSaves.append(save);
+	}
+	jobs->submit(regionSaveJob, save);
+}
+
+int RegionStorage::pendingSaveCount() {
+	std::lock_guard<std::mutex> guard(lock);
+	return pendingSaves.count;
+}
+
+bool RegionStorage::loadChunk(int posx, int posz, Block* blocks, ChunkColumns* columns) {
+	auto start = std::chrono::steady_clock::now();
+	int regionX, regionZ;
+	int slot = regionSlot(posx, posz, &regionX, &regionZ);
+	u8* payload = threadPayloadBuffer();
+	u32 size = 0;
+	bool fromSnapshot = false;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		// последний снимок, еще не записанный на диск
+		for (int i = pendingSaves.count - 1; i >= 0 && !fromSnapshot; i--) {
+			RegionSave* save = pendingSaves.items[i];
+			if (save->posx == posx && save->posz == posz && !save->superseded) {
+				for (int b = 0; b < CHUNK_SIZE; b++)
+					blocks[b].type = save->blocks[b];
+				memcpy(columns->biomes, save->biomes, sizeof(save->biomes));
+				fromSnapshot = true;
+			}
+		}
+		if (!fromSnapshot && !readPayload(*getFile(regionX, regionZ), slot, payload, &size))
+			return false;
+	}
+	if (!fromSnapshot && !decodeRegionChunk(payload, size, blocks, columns->biomes)) {
+		fprintf(stderr, "Chunk (%d, %d) in %s is corrupted, regenerating\n", posx, posz, folder);
+		return false;
+	}
+	for (int column = 0; column < CHUNK_SX * CHUNK_SZ; column++)
+		columns->heightmap[column] = columnSurfaceHeight(blocks, column);
+	loadedChunks++;
+	loadUS += elapsedUS(start);
+	return true;
+}
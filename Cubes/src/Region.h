@@ -0,0 +1,87 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include "Typedefs.h"
+#include "DataStructures.h"
+#include "Chunk.h"
+
+// сохранение мира в файлы регионов: регион - REGION_SIZE x REGION_SIZE чанков в одном файле.
+// Файл: заголовок из REGION_CHUNKS записей (начальный сектор << 8 | число секторов, 0 - чанка нет),
+// дальше данные чанков, каждый с начала сектора в REGION_SECTOR байт. Данные чанка: RegionChunkHeader,
+// биомы столбцов и блоки в порядке индекса чанка, сжатые сериями (число блоков u16, тип u8).
+// Чтение идет через отображение файла в память (MapViewOfFile / mmap), запись - обычная. Новая версия
+// чанка пишется в свободные сектора, не на место прежней, и только потом меняется запись заголовка:
+// запись, прерванная падением игры, оставляет прежнюю версию. Сброс на диск (fsync) не делается,
+// порядок записей при отключении питания не гарантирован
+
+#define REGION_SIZE 32
+#define REGION_CHUNKS (REGION_SIZE * REGION_SIZE)
+#define REGION_SECTOR 4096
+#define REGION_HEADER_SECTORS (REGION_CHUNKS * sizeof(u32) / REGION_SECTOR)
+#define REGION_MAX_CHUNK_SECTORS 255
+#define REGION_CACHE 16 // открытых файлов регионов
+#define REGION_FORMAT_VERSION 1
+
+struct RegionChunkHeader {
+	u32 size; // байт после заголовка
+	u8 version;
+	u8 pad[3];
+};
+
+struct RegionFile {
+	int regionX, regionZ;
+	bool open;
+	bool exists; // false - файла еще нет, заголовок пуст
+	u32 lastUse;
+	intptr_t file;
+	void* mapping; // объект отображения (Windows)
+	u8* view;
+	size_t viewSize;
+	size_t fileSize;
+	u32 offsets[REGION_CHUNKS];
+};
+
+// блоки чанка, ожидающие записи. Чанк, вернувшийся в радиус до записи, читается отсюда
+struct RegionStorage;
+struct RegionSave {
+	RegionStorage* storage;
+	int posx, posz;
+	bool superseded; // тот же чанк выгружен еще раз позже, запись не нужна
+	BlockType blocks[CHUNK_SIZE];
+	Biome biomes[CHUNK_SX * CHUNK_SZ];
+};
+
+struct RegionStorage {
+	char folder[256];
+	JobSystem* jobs;
+	// один замок на файлы и очередь записи: доступ к диску все равно последовательный,
+	// сжатие и распаковка идут без него
+	std::mutex lock;
+	RegionFile files[REGION_CACHE];
+	u32 useCounter;
+	DynamicArray<RegionSave*> pendingSaves;
+
+	std::atomic<int> savedChunks, loadedChunks;
+	std::atomic<u64> savedBytes, saveUS, loadUS;
+
+	void init(const char* folder, JobSystem* jobs);
+	void shutdown(); // закрывает файлы: записи должны быть завершены, потоки, читающие чанки, остановлены
+	// снимок блоков чанка и задача записи. Вызывается под блокировкой чанка
+	void queueSave(const Chunk& chunk);
+	int pendingSaveCount();
+	// в рабочем потоке: сохраненный чанк, false - чанка нет на диске
+	bool loadChunk(int posx, int posz, Block* blocks, ChunkColumns* columns);
+	// сразу сжать и записать (в вызывающем потоке), возвращает размер данных чанка
+	u32 saveChunk(int posx, int posz, const BlockType* blocks, const Biome* biomes);
+	void removeFiles(); // удалить файлы регионов, открытые или созданные этим хранилищем
+
+	RegionFile* getFile(int regionX, int regionZ);
+	bool readPayload(RegionFile& region, int slot, u8* out, u32* outSize);
+	bool writePayload(RegionFile& region, int slot, const u8* payload, u32 size);
+	bool writeChunk(int posx, int posz, const u8* payload, u32 size);
+};
+
+// сжатие сериями: размер данных, не больше regionPayloadBound()
+u32 regionPayloadBound();
+u32 encodeRegionChunk(const BlockType* blocks, const Biome* biomes, u8* out);
+bool decodeRegionChunk(const u8* payload, u32 size, Block* blocks, Biome* biomes);
@@ -40,7 +40,17 @@ void ReadShaderProgramErrors(GLuint shaderProgram) {
 	}
 }
 
-GLuint BuildShader(const char* vertexShaderFilename, const char* fragmentShaderFilename) {
+// вставить defines после строки #version (она должна быть первой в шейдере)
+static void insertShaderDefines(std::string& source, const char* defines) {
+	if (!defines)
+		return;
+	size_t lineEnd = source.find('\n');
+	if (lineEnd == std::string::npos || source.compare(0, 8, "#version") != 0)
+		FatalError("Shader must start with #version");
+	source.insert(lineEnd + 1, defines);
+}
+
+GLuint BuildShader(const char* vertexShaderFilename, const char* fragmentShaderFilename, const char* defines) {
 	std::ifstream vs(vertexShaderFilename);
 	std::ifstream fs(fragmentShaderFilename);
 	if (!vs.is_open() || !fs.is_open()) {
@@ -54,25 +64,27 @@ GLuint BuildShader(const char* vertexShaderFilename, const char* fragmentShaderF
 	ss2 << fs.rdbuf();
 	std::string vs_str = ss1.str();
 	std::string fs_str = ss2.str();
+	insertShaderDefines(vs_str, defines);
+	insertShaderDefines(fs_str, defines);
 	const char* vs_cstr = vs_str.c_str();
 	const char* fs_cstr = fs_str.c_str();
 
 	vs.close();
 	fs.close();
 
-	//  Vertex Shader
+	// создаем Vertex Shader
 	unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
 	glShaderSource(vertexShader, 1, &vs_cstr, NULL);
 	glCompileShader(vertexShader);
 	ReadShaderProgramErrors(vertexShader);
 
-	//  Fragment Shader
+	// создадим Fragment Shader
 	unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
 	glShaderSource(fragmentShader, 1, &fs_cstr, NULL);
 	glCompileShader(fragmentShader);
 	ReadShaderProgramErrors(fragmentShader);
 
-	//  Shader Program ( Vertex Shader  Fragment Shader)
+	// создадим Shader Program (объединим Vertex Shader и Fragment Shader)
 	unsigned int shaderProgram = glCreateProgram();
 	glAttachShader(shaderProgram, vertexShader);
 	glAttachShader(shaderProgram, fragmentShader);
@@ -85,6 +97,48 @@ GLuint BuildShader(const char* vertexShaderFilename, const char* fragmentShaderF
 	return shaderProgram;
 }
 
+static const char* shaderUniformNames[uniformCOUNT] = {
+	"model",
+	"projection",
+	"atlasSize",
+	"scale",
+	"spherical",
+	"color",
+	"lightingFactor",
+	"UVScale",
+	"UVShift",
+};
+
+void Shader::build(const char* vertexFilename, const char* fragmentFilename, const char* defines) {
+	this->vertexFilename = vertexFilename;
+	this->fragmentFilename = fragmentFilename;
+	this->defines = defines;
+	ID = BuildShader(vertexFilename, fragmentFilename, defines);
+
+	for (int u = 0; u < uniformCOUNT; u++)
+		uniforms[u] = glGetUniformLocation(ID, shaderUniformNames[u]);
+
+	GLuint frameBlock = glGetUniformBlockIndex(ID, "FrameData");
+	if (frameBlock != GL_INVALID_INDEX)
+		glUniformBlockBinding(ID, frameBlock, FRAME_UNIFORMS_BINDING);
+
+	// текстурные блоки не меняются, задаются один раз
+	glUseProgram(ID);
+	GLint texture1 = glGetUniformLocation(ID, "texture1");
+	if (texture1 != -1)
+		glUniform1i(texture1, 0);
+	GLint shadowMap = glGetUniformLocation(ID, "shadowMap");
+	if (shadowMap != -1)
+		glUniform1i(shadowMap, 1);
+	glUseProgram(0);
+}
+
+void Shader::rebuild() {
+	GLuint oldID = ID;
+	build(vertexFilename, fragmentFilename, defines);
+	glDeleteProgram(oldID);
+}
+
 Texture LoadTexture(const char* path, TextureType textureType) {
 	Texture texture;
 	
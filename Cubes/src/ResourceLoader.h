@@ -1,11 +1,45 @@
 #pragma once
 #include <glad/glad.h>
+#include "Typedefs.h"
 
 void ReadShaderErrors(GLuint shader);
 
 void ReadShaderProgramErrors(GLuint shaderProgram);
 
-GLuint BuildShader(const char* vertexShaderFilename, const char* fragmentShaderFilename);
+// defines - строки "#define ...", вставляются в оба шейдера сразу после #version
+GLuint BuildShader(const char* vertexShaderFilename, const char* fragmentShaderFilename, const char* defines = NULL);
+
+#define FRAME_UNIFORMS_BINDING 0 // точка привязки uniform-блока FrameData (общие данные кадра, см. FrameUniforms)
+
+// uniform-переменные, которые меняются между отрисовками. Остальное - в FrameData или задается при сборке
+enum ShaderUniform : u8 {
+	uniformModel,
+	uniformProjection, // только у шейдеров без FrameData (интерфейс)
+	uniformAtlasSize,
+	uniformScale,
+	uniformSpherical,
+	uniformColor,
+	uniformLightingFactor,
+	uniformUVScale,
+	uniformUVShift,
+	uniformCOUNT
+};
+
+// программа с расположениями uniform-переменных, найденными один раз при сборке.
+// Помнит исходники, чтобы пересобраться ("Rebuild shaders") с новыми расположениями
+struct Shader {
+	GLuint ID;
+	GLint uniforms[uniformCOUNT]; // -1, если переменной нет в программе
+	const char* vertexFilename;
+	const char* fragmentFilename;
+	const char* defines;
+
+	// сэмплеры texture1 и shadowMap привязываются к текстурным блокам 0 и 1, блок FrameData - к FRAME_UNIFORMS_BINDING
+	void build(const char* vertexFilename, const char* fragmentFilename, const char* defines = NULL);
+	void rebuild(); // прежняя программа удаляется
+	void use() const { glUseProgram(ID); }
+	GLint location(ShaderUniform uniform) const { return uniforms[uniform]; }
+};
 
 enum TextureType : char {
 	textureRGBA
@@ -27,7 +27,7 @@ void dbgprint(const char* str, ...) {
 	OutputDebugStringA(dbg_out);
 }
 
-//   ,    (   GetLastError())
+// печатает последнюю ошибку, связанную с системой (полученную при помощи GetLastError())
 void syserrprint(const char* msg) {
 	LPSTR dbg_out;
 	auto err = GetLastError();
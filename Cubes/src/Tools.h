@@ -12,7 +12,7 @@ void dbgprint(const wchar_t* str, ...);
 
 void dbgprint(const char* str, ...);
 
-//   ,    (   GetLastError())
+// печатает последнюю ошибку, связанную с системой (полученную при помощи GetLastError())
 void syserrprint(const char* msg);
 
 struct Timer {
@@ -4,8 +4,49 @@
 #include <gtc/matrix_transform.hpp>
 #include "World.h"
 #include "FastNoiseLite.h"
+#include "NoiseBatch.h"
 
-static FastNoiseLite noise;
+// параметры слоев шума (в порядке NoiseLayer): смещение сида мира и масштаб координат
+static const struct {
+	int seedShift;
+	float scale;
+} noiseLayerParams[noiseLayerCOUNT] = {
+	{ 0, 0.7f },	// noiseTemperature
+	{ 0, 6.0f },	// noiseHeight
+	{ 1, 30.0f },	// noiseOre
+	{ 0, 5.0f },	// noiseCave
+};
+
+// у каждого потока свой набор заранее настроенных генераторов шума (по одному на слой),
+// после настройки они только читаются: общего изменяемого состояния между потоками нет
+struct ThreadNoise {
+	bool configured;
+	u32 seed;
+	FastNoiseLite layers[noiseLayerCOUNT];
+};
+static thread_local ThreadNoise threadNoise;
+
+static const FastNoiseLite& getThreadNoise(u32 seed, NoiseLayer layer) {
+	if (!threadNoise.configured || threadNoise.seed != seed) {
+		for (int i = 0; i < noiseLayerCOUNT; i++) {
+			FastNoiseLite& noise = threadNoise.layers[i];
+			noise = FastNoiseLite(seed + noiseLayerParams[i].seedShift);
+			noise.SetNoiseType(FastNoiseLite::NoiseType_Perlin);
+			noise.SetFrequency(0.01f * noiseLayerParams[i].scale); // 0.01 - частота по умолчанию
+		}
+		threadNoise.seed = seed;
+		threadNoise.configured = true;
+	}
+	return threadNoise.layers[layer];
+}
+
+// смещения позиций соседних чанков, в порядке ChunkNeighbor
+static const int chunkNeighborOffsets[neighborCOUNT][2] = {
+	{ -CHUNK_SX, 0 },
+	{ CHUNK_SX, 0 },
+	{ 0, -CHUNK_SZ },
+	{ 0, CHUNK_SZ },
+};
 
 
 void Display::update(GLFWwindow* window) {
@@ -16,9 +57,21 @@ glm::mat4 getProjection(float FOV, int displayW, int displayH) {
 	return glm::perspective(glm::radians(FOV), (float)displayW / (float)displayH, 0.1f, 1000.0f);
 }
 
-int getChunksCount(int renderDistance) {
-	int chunkSide = renderDistance * 2 + 1;
-	return chunkSide * chunkSide;
+// полуширина строки dz радиуса загрузки. Круг немного шире radius, чтобы на осях доставать до края квадрата
+static int computeLoadRowHalfWidth(int radius, bool circular, int dz) {
+	if (!circular)
+		return radius;
+	int halfWidth = 0;
+	while (halfWidth < radius && (halfWidth + 1) * (halfWidth + 1) + dz * dz <= radius * radius + radius)
+		halfWidth++;
+	return halfWidth;
+}
+
+int getChunksCount(int renderDistance, bool circular) {
+	int count = 0;
+	for (int dz = -renderDistance; dz <= renderDistance; dz++)
+		count += 2 * computeLoadRowHalfWidth(renderDistance, circular, dz) + 1;
+	return count;
 }
 
 void Camera::update(float yaw, float pitch) {
@@ -29,54 +82,274 @@ void Camera::update(float yaw, float pitch) {
 	front = glm::normalize(direction);
 }
 
-void GameWorld::init(u32 seed, u32 chunksCount) {
+void GameWorld::init(u32 seed, int loadRadius, bool circularLoad, int maxLoadRadius) {
+	loadRadius = std::min(loadRadius, maxLoadRadius);
+	loadedChunksCount = getChunksCount(loadRadius, circularLoad);
+	// слоты выделяются сразу на наибольший радиус: при смене радиуса чанки не переезжают в памяти
+	u32 chunksCount = getChunksCount(maxLoadRadius, circularLoad) + CHUNK_PREFETCH_MAX;
+	int chunksSide = loadRadius * 2 + 1;
+	int maxSide = maxLoadRadius * 2 + 1;
 	//chunks = (Chunk*)malloc(sizeof(Chunk) * chunksCount);
-	chunks = (Chunk*)calloc(chunksCount, sizeof(Chunk));
+	chunks = new Chunk[chunksCount](); // не calloc: в чанке есть мьютекс
 	this->chunksCount = chunksCount;
 	this->seed = seed;
+	noise3DStep = 1;
+	storage = NULL;
+
+	this->chunksSide = chunksSide;
+	chunkGrid = (int*)malloc(sizeof(int) * maxSide * maxSide);
+	for (int i = 0; i < maxSide * maxSide; i++)
+		chunkGrid[i] = -1;
 
-	noise = FastNoiseLite(seed);
+	this->loadRadius = loadRadius;
+	this->maxLoadRadius = maxLoadRadius;
+	this->circularLoad = circularLoad;
+	loadRowHalfWidth = (int*)malloc(sizeof(int) * maxSide);
+	for (int dz = -loadRadius; dz <= loadRadius; dz++)
+		loadRowHalfWidth[dz + loadRadius] = computeLoadRowHalfWidth(loadRadius, circularLoad, dz);
+	// все чанки свободны до первого streamChunks
+	freeChunks = (int*)malloc(sizeof(int) * chunksCount);
+	freeChunkCount = chunksCount;
+	for (u32 i = 0; i < chunksCount; i++)
+		freeChunks[i] = chunksCount - 1 - i;
+	streamStarted = false;
+	streamCenterX = streamCenterZ = 0;
+	prefetchedChunks = (int*)malloc(sizeof(int) * CHUNK_PREFETCH_MAX);
+	prefetchedCount = 0;
 }
 
-void GameWorld::reallocChunks(u32 chunksCount) {
-	chunks = (Chunk*)realloc(chunks, sizeof(Chunk) * chunksCount);
-	this->chunksCount = chunksCount;
+float GameWorld::perlinNoise(NoiseLayer layer, glm::vec2 pos) {
+	return getThreadNoise(seed, layer).GetNoise(pos.x, pos.y);
 }
 
-float GameWorld::perlinNoise(glm::vec2 pos, int seedShift) {
-	if (seedShift != 0)
-		noise.SetSeed(seed + seedShift);
-	noise.SetNoiseType(FastNoiseLite::NoiseType_Perlin);
-	return noise.GetNoise(pos.x, pos.y);
+float GameWorld::perlinNoise(NoiseLayer layer, glm::vec3 pos) {
+	return getThreadNoise(seed, layer).GetNoise(pos.x, pos.y, pos.z);
 }
 
-float GameWorld::perlinNoise(glm::vec3 pos, int seedShift) {
-	if (seedShift != 0)
-		noise.SetSeed(seed + seedShift);
-	noise.SetNoiseType(FastNoiseLite::NoiseType_Perlin);
-	return noise.GetNoise(pos.x, pos.y, pos.z);
+// шум сразу для count точек (SIMD), результат совпадает с perlinNoise для тех же точек
+void GameWorld::perlinNoise(NoiseLayer layer, const float* xs, const float* ys, int count, float* out, NoiseSimdLevel simdLevel) {
+	perlinNoiseBatch(seed + noiseLayerParams[layer].seedShift, 0.01f * noiseLayerParams[layer].scale, xs, ys, count, out, simdLevel);
+}
+
+void GameWorld::perlinNoise(NoiseLayer layer, const float* xs, const float* ys, const float* zs, int count, float* out, NoiseSimdLevel simdLevel) {
+	perlinNoiseBatch(seed + noiseLayerParams[layer].seedShift, 0.01f * noiseLayerParams[layer].scale, xs, ys, zs, count, out, simdLevel);
+}
+
+// значения 3D шума в узлах решетки с шагом step над чанком: по x и z узлы 0, step, ..., CHUNK_SX,
+// по y - от 0 до первого узла выше последнего каменного блока. Между узлами шум интерполируется трилинейно
+struct NoiseLattice {
+	int step;
+	int nx, ny, nz;
+	float values[(CHUNK_SX / NOISE_LATTICE_MIN_STEP + 1) * (CHUNK_SZ / NOISE_LATTICE_MIN_STEP + 1) * (CHUNK_SY / NOISE_LATTICE_MIN_STEP + 2)];
+
+	void init(int step, int maxY) {
+		this->step = step;
+		nx = CHUNK_SX / step + 1;
+		nz = CHUNK_SZ / step + 1;
+		ny = maxY / step + 2;
+	}
+
+	// шум ряда блоков (0..CHUNK_SX-1, y, z) чанка
+	void sampleRow(int y, int z, float* out) {
+		int ly = y / step, lz = z / step;
+		float fy = (float)(y - ly * step) / step;
+		float fz = (float)(z - lz * step) / step;
+
+		// сначала интерполяция по y и z для каждого узла ряда, затем по x
+		float column[CHUNK_SX / NOISE_LATTICE_MIN_STEP + 1];
+		for (int lx = 0; lx < nx; lx++) {
+			float v00 = values[(ly * nz + lz) * nx + lx];
+			float v01 = values[(ly * nz + lz + 1) * nx + lx];
+			float v10 = values[((ly + 1) * nz + lz) * nx + lx];
+			float v11 = values[((ly + 1) * nz + lz + 1) * nx + lx];
+			float v0 = v00 + (v01 - v00) * fz;
+			float v1 = v10 + (v11 - v10) * fz;
+			column[lx] = v0 + (v1 - v0) * fy;
+		}
+		for (int x = 0; x < CHUNK_SX; x++) {
+			int lx = x / step;
+			float fx = (float)(x - lx * step) / step;
+			out[x] = column[lx] + (column[lx + 1] - column[lx]) * fx;
+		}
+	}
+};
+
+// шум слоя во всех узлах решетки, в мировых координатах (узлы соседних чанков на общей границе совпадают)
+static void sampleNoiseLattice(GameWorld* world, NoiseLayer layer, NoiseLattice* lattice, int posx, int posz, NoiseSimdLevel simdLevel) {
+	const int maxCount = sizeof(lattice->values) / sizeof(float);
+	static thread_local float xs[maxCount], ys[maxCount], zs[maxCount];
+	int count = 0;
+	for (int ly = 0; ly < lattice->ny; ly++) {
+		for (int lz = 0; lz < lattice->nz; lz++) {
+			for (int lx = 0; lx < lattice->nx; lx++) {
+				xs[count] = (float)(lx * lattice->step + posx);
+				ys[count] = (float)(ly * lattice->step);
+				zs[count] = (float)(lz * lattice->step + posz);
+				count++;
+			}
+		}
+	}
+	world->perlinNoise(layer, xs, ys, zs, count, lattice->values, simdLevel);
 }
 
 void GameWorld::generateChunk(int index, int posx, int posz) {
 	Chunk& chunk = chunks[index];
 	chunk.generated = false;
 
-	chunk.posx = posx;
-	chunk.posz = posz;
+	// позицию чанка меняет только основной поток (setChunkPos), чтобы сетка чанков оставалась согласованной
+	static thread_local Block blocks[CHUNK_SIZE];
+	generateChunkBlocks(blocks, &chunk.columns, posx, posz, noise3DStep, noiseSimdLevel);
+	chunk.blocks.pack(blocks);
+	chunk.connectivityDirty = (1 << CHUNK_SECTIONS) - 1;
 
-	float noiseScale = 6.0f;
-	float caveNoiseScale = 5.0f;
-	float temperatureNoiseScale = 0.7f;
+	chunk.generated = true;
+}
+
+// заполнить блоки чанка с позицией (posx, posz); буфер может не принадлежать чанку (генерация во временный буфер)
+void GameWorld::generateChunkBlocks(Block* blocks, ChunkColumns* columns, int posx, int posz, int noise3DStep, NoiseSimdLevel simdLevel) {
+	// этап 1: 2D шум по столбцам - биом и высота рельефа, шум считается сразу для всех столбцов
+	float columnX[CHUNK_SX * CHUNK_SZ], columnZ[CHUNK_SX * CHUNK_SZ];
+	float temperatures[CHUNK_SX * CHUNK_SZ], heights[CHUNK_SX * CHUNK_SZ];
+	int columnIndex = 0;
+	for (size_t z = 0; z < CHUNK_SZ; z++) {
+		for (size_t x = 0; x < CHUNK_SX; x++) {
+			columnX[columnIndex] = (float)((int)x + posx);
+			columnZ[columnIndex] = (float)((int)z + posz);
+			columnIndex++;
+		}
+	}
+	perlinNoise(noiseTemperature, columnX, columnZ, CHUNK_SX * CHUNK_SZ, temperatures, simdLevel);
+	perlinNoise(noiseHeight, columnX, columnZ, CHUNK_SX * CHUNK_SZ, heights, simdLevel);
+
+	float terrainHeight[CHUNK_SX * CHUNK_SZ];
+	for (columnIndex = 0; columnIndex < CHUNK_SX * CHUNK_SZ; columnIndex++) {
+		// biome
+		float temperature = temperatures[columnIndex];
+		float biomeEdge = 0.5;
+		float riverWidth = 0.06;
+		temperature = (temperature + 1.0f) / 2.0f;
+		Biome biome = temperature > biomeEdge ? biomeTemperate : biomeSnow;
+
+		// height
+		float height = heights[columnIndex];
+		height = (height + 1.0f) / 2.0f;
+
+		// generate rivers between biomes
+		if (temperature > biomeEdge && temperature - riverWidth <= biomeEdge) {
+			height *= 0.15;
+			height += 0.2;
+			biome = biomeRiver;
+		}
+
+		terrainHeight[columnIndex] = height;
+		columns->biomes[columnIndex] = biome;
+	}
+
+	// для грубого 3D шума - значения в узлах решетки, покрывающей весь камень чанка
+	int latticeStep = glm::clamp(noise3DStep, 1, NOISE_LATTICE_MAX_STEP);
+	static thread_local NoiseLattice oreLattice, caveLattice; // десятки КБ, не на стеке
+	if (latticeStep > 1) {
+		float maxStoneHeight = 0;
+		for (columnIndex = 0; columnIndex < CHUNK_SX * CHUNK_SZ; columnIndex++)
+			maxStoneHeight = glm::max(maxStoneHeight, terrainHeight[columnIndex] * 20.0f);
+		int maxStoneY = glm::min((int)maxStoneHeight, CHUNK_SY - 1);
+		oreLattice.init(latticeStep, maxStoneY);
+		caveLattice.init(latticeStep, maxStoneY);
+		sampleNoiseLattice(this, noiseOre, &oreLattice, posx, posz, simdLevel);
+		sampleNoiseLattice(this, noiseCave, &caveLattice, posx, posz, simdLevel);
+	}
+
+	// этап 2: 3D заполнение блоков по готовым высотам. 3D шум считается рядами вдоль x,
+	// только для рядов, в которых есть камень (или интерполируется по решетке)
+	float rowX[CHUNK_SX], rowY[CHUNK_SX], rowZ[CHUNK_SX];
+	float oreRow[CHUNK_SX], caveRow[CHUNK_SX];
+	for (size_t x = 0; x < CHUNK_SX; x++)
+		rowX[x] = (float)((int)x + posx);
+
+	// выше самого высокого столбца только воздух, его слои заполняются сразу
+	float maxTerrainHeight = 0;
+	for (columnIndex = 0; columnIndex < CHUNK_SX * CHUNK_SZ; columnIndex++)
+		maxTerrainHeight = glm::max(maxTerrainHeight, terrainHeight[columnIndex] * 23.0f);
+	int terrainTop = glm::min((int)maxTerrainHeight + 1, CHUNK_SY);
+	for (int i = terrainTop * CHUNK_SX * CHUNK_SZ; i < CHUNK_SIZE; i++)
+		blocks[i].type = btAir;
+
+	int blockIndex = 0;
+	for (size_t y = 0; y < (size_t)terrainTop; y++) {
+		columnIndex = 0;
+		for (size_t z = 0; z < CHUNK_SZ; z++) {
+			bool rowHasStone = false;
+			for (size_t x = 0; x < CHUNK_SX; x++)
+				rowHasStone |= !(y > terrainHeight[columnIndex + x] * 20.0f);
+			if (rowHasStone && latticeStep > 1) {
+				oreLattice.sampleRow((int)y, (int)z, oreRow);
+				caveLattice.sampleRow((int)y, (int)z, caveRow);
+			}
+			else if (rowHasStone) {
+				for (size_t x = 0; x < CHUNK_SX; x++) {
+					rowY[x] = (float)y;
+					rowZ[x] = (float)((int)z + posz);
+				}
+				perlinNoise(noiseOre, rowX, rowY, rowZ, CHUNK_SX, oreRow, simdLevel);
+				perlinNoise(noiseCave, rowX, rowY, rowZ, CHUNK_SX, caveRow, simdLevel);
+			}
+
+			for (size_t x = 0; x < CHUNK_SX; x++) {
+				float height = terrainHeight[columnIndex];
+				BlockType groundBlockType = columns->biomes[columnIndex] == biomeSnow ? btSnow : btGround;
+
+				// generate height
+				if (y > height * 23.0f)
+					blocks[blockIndex].type = btAir;
+				else if (y > height * 20.0f) {
+					blocks[blockIndex].type = groundBlockType;
+				}
+				else
+				{
+					blocks[blockIndex].type = btStone;
+					
+					float ironOre = oreRow[x];
+					ironOre = (ironOre + 1.0f) / 2;
+					if (ironOre > 0.7)
+						blocks[blockIndex].type = btIronOre;
+
+					// generate caves
+					float cave = caveRow[x];
+					float caveWidth = 0.06;
+					cave = (cave + 1.0f) / 2.0f;
+					if (cave > 0.5 && cave < 0.5 + caveWidth) {
+						blocks[blockIndex].type = btAir;
+					}
+				}
+
+				// bedrock
+				if (y == 0) {
+					blocks[blockIndex].type = btStone;
+				}
+
+				blockIndex++;
+				columnIndex++;
+			}
+		}
+	}
+
+	// этап 3: карта высот по итоговым блокам (с учетом пещер)
+	for (columnIndex = 0; columnIndex < CHUNK_SX * CHUNK_SZ; columnIndex++)
+		columns->heightmap[columnIndex] = columnSurfaceHeight(blocks, columnIndex);
+}
+
+// прежний вариант генерации: 2D шум вычисляется заново для каждого блока столбца.
+// Оставлен для сравнения скорости и результата с generateChunkBlocks
+void GameWorld::generateChunkBlocksPerVoxel(Block* blocks, int posx, int posz) {
 	
-	//   
-	Block* blocks = chunk.blocks;
+	// определение типов блоков
 	int blockIndex = 0;
 	for (size_t y = 0; y < CHUNK_SY; y++) {
 		for (size_t z = 0; z < CHUNK_SZ; z++) {
 			for (size_t x = 0; x < CHUNK_SX; x++) {
 				// biome
 				BlockType groundBlockType;
-				float temperature = perlinNoise(glm::vec2((int)x + posx, (int)z + posz) * temperatureNoiseScale);
+				float temperature = perlinNoise(noiseTemperature, glm::vec2((int)x + posx, (int)z + posz));
 				float biomeEdge = 0.5;
 				float riverWidth = 0.06;
 				temperature = (temperature + 1.0f) / 2.0f;
@@ -86,7 +359,7 @@ void GameWorld::generateChunk(int index, int posx, int posz) {
 					groundBlockType = btSnow;
 				
 				// height
-				float height = perlinNoise(glm::vec2((int)x + posx, (int)z + posz) * noiseScale);
+				float height = perlinNoise(noiseHeight, glm::vec2((int)x + posx, (int)z + posz));
 				height = (height + 1.0f) / 2.0f;
 
 				// generate rivers between biomes
@@ -105,13 +378,13 @@ void GameWorld::generateChunk(int index, int posx, int posz) {
 				{
 					blocks[blockIndex].type = btStone;
 					
-					float ironOre = perlinNoise(glm::vec3((int)x + posx, (int)y, (int)z + posz) * 30.0f, 1);
+					float ironOre = perlinNoise(noiseOre, glm::vec3((int)x + posx, (int)y, (int)z + posz));
 					ironOre = (ironOre + 1.0f) / 2;
 					if (ironOre > 0.7)
 						blocks[blockIndex].type = btIronOre;
 
 					// generate caves
-					float cave = perlinNoise(glm::vec3((int)x + posx, y, (int)z + posz) * caveNoiseScale);
+					float cave = perlinNoise(noiseCave, glm::vec3((int)x + posx, y, (int)z + posz));
 					float caveWidth = 0.06;
 					cave = (cave + 1.0f) / 2.0f;
 					if (cave > 0.5 && cave < 0.5 + caveWidth) {
@@ -129,68 +402,575 @@ void GameWorld::generateChunk(int index, int posx, int posz) {
 			}
 		}
 	}
+}
 
-	chunk.generated = true;
+// деление с округлением вниз (для отрицательных координат)
+static int floorDiv(int a, int b) {
+	int res = a / b;
+	if ((a % b != 0) && ((a < 0) != (b < 0)))
+		res--;
+	return res;
 }
 
-Block* GameWorld::peekBlockFromPos(glm::vec3 pos) {
-	int chunkIndex = -1;
-	
-	//  ,     
-	// TODO:   ,  ?
-	for (size_t i = 0; i < chunksCount; i++)
+static int positiveMod(int a, int b) {
+	int res = a % b;
+	return res < 0 ? res + b : res;
+}
+
+// ячейка тороидальной сетки для чанка с позицией (posx, posz)
+int GameWorld::getChunkGridCell(int posx, int posz) {
+	int cellX = positiveMod(floorDiv(posx, CHUNK_SX), chunksSide);
+	int cellZ = positiveMod(floorDiv(posz, CHUNK_SZ), chunksSide);
+	return cellX + cellZ * chunksSide;
+}
+
+// индекс чанка с позицией (posx, posz), -1 если такого чанка нет
+int GameWorld::findChunkIndex(int posx, int posz) {
+	int index = chunkGrid[getChunkGridCell(posx, posz)];
+	if (index != -1 && chunks[index].posx == posx && chunks[index].posz == posz)
+		return index;
+	return -1;
+}
+
+// под lock: меш, построенный для прежней позиции и еще не отправленный, на ГПУ не попадет
+static void dropPendingMesh(Chunk& chunk) {
+	chunk.remeshNeighbors = false;
+	chunk.mesh.needUpdate = false;
+	chunk.mesh.dirtyRangeCount = 0;
+	chunk.mesh.dirtyAll = false;
+}
+
+// переместить чанк на новую позицию, обновив сетку. Все задачи, отправленные для чанка раньше, устаревают
+void GameWorld::setChunkPos(int index, int posx, int posz) {
+	Chunk& chunk = chunks[index];
+	int oldCell = getChunkGridCell(chunk.posx, chunk.posz);
+	if (chunkGrid[oldCell] == index)
+		chunkGrid[oldCell] = -1;
+	chunk.connectivityOpen = true;
+
 	{
-		if (pos.x >= chunks[i].posx && pos.x < chunks[i].posx + CHUNK_SX &&
-			pos.z >= chunks[i].posz && pos.z < chunks[i].posz + CHUNK_SZ) {
-			chunkIndex = i;
+		std::lock_guard<std::mutex> lock(chunk.lock);
+		chunk.posx = posx;
+		chunk.posz = posz;
+		chunk.generated = false; // блоки и меш относятся к старой позиции
+		chunk.pendingEditCount = 0;
+		chunk.pendingFullRemesh = false;
+		dropPendingMesh(chunk);
+		chunk.version.fetch_add(1, std::memory_order_release);
+	}
+	chunkGrid[getChunkGridCell(posx, posz)] = index;
+}
+
+// чанк вышел за радиус загрузки (или больше не нужен заранее): убирается из сетки,
+// все задачи для него устаревают, слот становится свободным
+void GameWorld::unloadChunk(int index) {
+	Chunk& chunk = chunks[index];
+	if (chunk.prefetched) {
+		for (int i = 0; i < prefetchedCount; i++) {
+			if (prefetchedChunks[i] == index) {
+				prefetchedChunks[i] = prefetchedChunks[--prefetchedCount];
+				break;
+			}
+		}
+	}
+	else {
+		int cell = getChunkGridCell(chunk.posx, chunk.posz);
+		if (chunkGrid[cell] == index)
+			chunkGrid[cell] = -1;
+	}
+	chunk.connectivityOpen = true;
+
+	{
+		std::lock_guard<std::mutex> lock(chunk.lock);
+		// слот сразу займет другая позиция: измененные блоки копируются, запись идет в рабочем потоке
+		if (storage && chunk.modified && chunk.generated)
+			storage->queueSave(chunk);
+		chunk.modified = false;
+		chunk.generated = false;
+		chunk.prefetched = false;
+		chunk.pendingEditCount = 0;
+		chunk.pendingFullRemesh = false;
+		dropPendingMesh(chunk);
+		chunk.version.fetch_add(1, std::memory_order_release);
+	}
+	// меш на ГПУ относится к прежней позиции, участок буфера остается за чанком
+	chunk.mesh.gpuFaceCount = 0;
+	chunk.remeshQueued = false;
+	freeChunks[freeChunkCount++] = index;
+}
+
+bool GameWorld::isInLoadRadius(int dx, int dz) {
+	return abs(dz) <= loadRadius && abs(dx) <= loadRowHalfWidth[dz + loadRadius];
+}
+
+// чанки [x0, x1] строки z, загружаемые вокруг центра (в чанках). false - строка вне радиуса
+static bool loadRowSpan(const GameWorld& world, int centerX, int centerZ, int z, int* x0, int* x1) {
+	int dz = z - centerZ;
+	if (abs(dz) > world.loadRadius)
+		return false;
+	int halfWidth = world.loadRowHalfWidth[dz + world.loadRadius];
+	*x0 = centerX - halfWidth;
+	*x1 = centerX + halfWidth;
+	return true;
+}
+
+// вызывает f(x) для x из [a0, a1], не попавших в [b0, b1] (если hasB)
+template <typename F>
+static void forSpanDifference(int a0, int a1, bool hasB, int b0, int b1, F f) {
+	if (!hasB || b1 < a0 || b0 > a1) {
+		for (int x = a0; x <= a1; x++)
+			f(x);
+		return;
+	}
+	for (int x = a0; x < b0; x++)
+		f(x);
+	for (int x = b1 + 1; x <= a1; x++)
+		f(x);
+}
+
+int GameWorld::findPrefetchedChunk(int posx, int posz) {
+	for (int i = 0; i < prefetchedCount; i++) {
+		int index = prefetchedChunks[i];
+		if (chunks[index].posx == posx && chunks[index].posz == posz)
+			return index;
+	}
+	return -1;
+}
+
+int GameWorld::prefetchChunk(int posx, int posz) {
+	if (freeChunkCount == 0 || prefetchedCount == CHUNK_PREFETCH_MAX)
+		return -1;
+	int index = freeChunks[--freeChunkCount];
+	Chunk& chunk = chunks[index];
+	chunk.connectivityOpen = true;
+	{
+		std::lock_guard<std::mutex> lock(chunk.lock);
+		chunk.posx = posx;
+		chunk.posz = posz;
+		chunk.generated = false;
+		chunk.prefetched = true;
+		dropPendingMesh(chunk);
+		chunk.version.fetch_add(1, std::memory_order_release);
+	}
+	prefetchedChunks[prefetchedCount++] = index;
+	return index;
+}
+
+// заранее сгенерированный чанк вошел в радиус загрузки: переходит в сетку. Его граничные грани
+// и грани соседей строились без учета друг друга, поэтому меши перестраиваются
+void GameWorld::promoteChunk(int index) {
+	Chunk& chunk = chunks[index];
+	for (int i = 0; i < prefetchedCount; i++) {
+		if (prefetchedChunks[i] == index) {
+			prefetchedChunks[i] = prefetchedChunks[--prefetchedCount];
 			break;
 		}
 	}
-	if (chunkIndex == -1) 
-		return NULL;
+	chunkGrid[getChunkGridCell(chunk.posx, chunk.posz)] = index;
+	bool generated;
+	{
+		// рабочий поток публикует результат под блокировкой: либо он увидит, что чанк уже в сетке,
+		// либо здесь будет видно, что чанк сгенерирован
+		std::lock_guard<std::mutex> lock(chunk.lock);
+		chunk.prefetched = false;
+		generated = chunk.generated;
+	}
+	if (generated) {
+		chunk.needRemesh = true;
+		markNeighborsForRemesh(index);
+	}
+}
+
+int GameWorld::chunksEnteringRadius(int fromX, int fromZ, int toX, int toZ, glm::ivec2* out, int maxCount) {
+	int count = 0;
+	int a0, a1, b0, b1;
+	for (int z = toZ - loadRadius; z <= toZ + loadRadius && count < maxCount; z++) {
+		loadRowSpan(*this, toX, toZ, z, &a0, &a1);
+		bool hasB = loadRowSpan(*this, fromX, fromZ, z, &b0, &b1);
+		forSpanDifference(a0, a1, hasB, b0, b1, [&](int x) {
+			if (count < maxCount)
+				out[count++] = glm::ivec2(x * CHUNK_SX, z * CHUNK_SZ);
+		});
+	}
+	return count;
+}
+
+int GameWorld::streamChunks(int centerX, int centerZ, int* placed, int* promoted, int* promotedCount) {
+	std::lock_guard<std::mutex> lock(gridLock);
+	int newX = floorDiv(centerX, CHUNK_SX), newZ = floorDiv(centerZ, CHUNK_SZ);
+	int oldX = streamCenterX, oldZ = streamCenterZ;
+	int a0, a1, b0, b1;
+
+	// вышедшие из радиуса: участки старых строк, не покрытые новыми
+	if (streamStarted) {
+		for (int z = oldZ - loadRadius; z <= oldZ + loadRadius; z++) {
+			loadRowSpan(*this, oldX, oldZ, z, &a0, &a1);
+			bool hasB = loadRowSpan(*this, newX, newZ, z, &b0, &b1);
+			forSpanDifference(a0, a1, hasB, b0, b1, [&](int x) {
+				int index = findChunkIndex(x * CHUNK_SX, z * CHUNK_SZ);
+				if (index != -1)
+					unloadChunk(index);
+			});
+		}
+	}
+
+	// вошедшие в радиус: заранее сгенерированные переходят в сетку, остальные занимают освободившиеся слоты
+	int placedCount = 0;
+	*promotedCount = 0;
+	for (int z = newZ - loadRadius; z <= newZ + loadRadius; z++) {
+		loadRowSpan(*this, newX, newZ, z, &a0, &a1);
+		bool hasB = streamStarted && loadRowSpan(*this, oldX, oldZ, z, &b0, &b1);
+		forSpanDifference(a0, a1, hasB, b0, b1, [&](int x) {
+			int posx = x * CHUNK_SX, posz = z * CHUNK_SZ;
+			if (findChunkIndex(posx, posz) != -1)
+				return;
+			int index = findPrefetchedChunk(posx, posz);
+			if (index != -1) {
+				promoteChunk(index);
+				promoted[(*promotedCount)++] = index;
+				return;
+			}
+			if (freeChunkCount == 0)
+				return;
+			index = freeChunks[--freeChunkCount];
+			setChunkPos(index, posx, posz);
+			placed[placedCount++] = index;
+		});
+	}
+
+	streamCenterX = newX;
+	streamCenterZ = newZ;
+	streamStarted = true;
+	return placedCount;
+}
 
-	glm::vec3 relativePos(
-		pos.x - chunks[chunkIndex].posx, 
-		pos.y, 
-		pos.z - chunks[chunkIndex].posz);
+int GameWorld::setLoadRadius(int radius, int* placed, int* promoted, int* promotedCount) {
+	radius = glm::clamp(radius, 1, maxLoadRadius);
+	*promotedCount = 0;
+	if (radius == loadRadius)
+		return 0;
+	// рабочие потоки ищут соседей по сетке: между очисткой и заполнением сетки они ждут на gridLock,
+	// иначе соседи оказались бы отсутствующими и на границах вернулись бы грани
+	std::lock_guard<std::mutex> lock(gridLock);
 
-	glm::floor(relativePos);
+	// чанки сетки до смены стороны: ячейки старой сетки перестанут соответствовать позициям
+	int oldSide = chunksSide;
+	int keptCount = 0;
+	int* kept = placed; // временно, placed заполняется только после перестроения сетки
+	for (int cell = 0; cell < oldSide * oldSide; cell++) {
+		int index = chunkGrid[cell];
+		if (index == -1)
+			continue;
+		chunkGrid[cell] = -1;
+		kept[keptCount++] = index;
+	}
+
+	loadRadius = radius;
+	chunksSide = radius * 2 + 1;
+	loadedChunksCount = getChunksCount(radius, circularLoad);
+	for (int dz = -radius; dz <= radius; dz++)
+		loadRowHalfWidth[dz + radius] = computeLoadRowHalfWidth(radius, circularLoad, dz);
+
+	// оставшиеся в радиусе сохраняют слот, блоки и меш, вышедшие выгружаются
+	for (int i = 0; i < keptCount; i++) {
+		int index = kept[i];
+		Chunk& chunk = chunks[index];
+		if (streamStarted && isInLoadRadius(chunk.posx / CHUNK_SX - streamCenterX, chunk.posz / CHUNK_SZ - streamCenterZ))
+			chunkGrid[getChunkGridCell(chunk.posx, chunk.posz)] = index;
+		else
+			unloadChunk(index); // чанка уже нет в сетке, занятую ячейку он не тронет
+	}
+	if (!streamStarted)
+		return 0;
+
+	// появившиеся позиции: только при увеличении радиуса
+	int placedCount = 0;
+	int a0, a1;
+	for (int z = streamCenterZ - radius; z <= streamCenterZ + radius; z++) {
+		loadRowSpan(*this, streamCenterX, streamCenterZ, z, &a0, &a1);
+		for (int x = a0; x <= a1; x++) {
+			int posx = x * CHUNK_SX, posz = z * CHUNK_SZ;
+			if (findChunkIndex(posx, posz) != -1)
+				continue;
+			int index = findPrefetchedChunk(posx, posz);
+			if (index != -1) {
+				promoteChunk(index);
+				promoted[(*promotedCount)++] = index;
+				continue;
+			}
+			if (freeChunkCount == 0)
+				continue;
+			index = freeChunks[--freeChunkCount];
+			setChunkPos(index, posx, posz);
+			placed[placedCount++] = index;
+		}
+	}
+	return placedCount;
+}
 
-	static int strideZ = CHUNK_SX;
-	static int strideY = CHUNK_SX * CHUNK_SZ;
-	int shift = (int)relativePos.x + (int)relativePos.z * strideZ + (int)relativePos.y * strideY;
-	if (shift >= CHUNK_SIZE) { //    
+// чанк, в котором находится позиция
+Chunk* GameWorld::getChunkFromPos(glm::vec3 pos) {
+	int posx = floorDiv((int)floorf(pos.x), CHUNK_SX) * CHUNK_SX;
+	int posz = floorDiv((int)floorf(pos.z), CHUNK_SZ) * CHUNK_SZ;
+	int index = findChunkIndex(posx, posz);
+	if (index == -1)
 		return NULL;
+	return &chunks[index];
+}
+
+// высота поверхности в мировых координатах (x, z) по карте высот чанка, -1 если чанк не сгенерирован
+int GameWorld::getSurfaceHeight(int x, int z) {
+	int posx = floorDiv(x, CHUNK_SX) * CHUNK_SX;
+	int posz = floorDiv(z, CHUNK_SZ) * CHUNK_SZ;
+	int index = findChunkIndex(posx, posz);
+	if (index == -1 || !chunks[index].generated)
+		return -1;
+	return chunks[index].columns.heightmap[(z - posz) * CHUNK_SX + (x - posx)];
+}
+
+// копирует граничные слои блоков соседних чанков (для отсечения граней на границе чанка).
+// Блокирует соседей по одному, поэтому вызывается без блокировки самого чанка
+void GameWorld::getChunkBorders(int chunkIndex, ChunkBorders* borders) {
+	Chunk& chunk = chunks[chunkIndex];
+	int posx, posz;
+	{
+		std::lock_guard<std::mutex> lock(chunk.lock);
+		posx = chunk.posx;
+		posz = chunk.posz;
+	}
+	// вызывается и в рабочих потоках, пока основной поток меняет сетку: соседи ищутся под gridLock
+	int neighbors[neighborCOUNT];
+	{
+		std::lock_guard<std::mutex> lock(gridLock);
+		for (int n = 0; n < neighborCOUNT; n++)
+			neighbors[n] = findChunkIndex(posx + chunkNeighborOffsets[n][0], posz + chunkNeighborOffsets[n][1]);
 	}
+	for (int n = 0; n < neighborCOUNT; n++) {
+		int neighborIndex = neighbors[n];
+		borders->present[n] = false;
+		if (neighborIndex == -1)
+			continue;
 
-	return &chunks[chunkIndex].blocks[shift];
+		// блоки соседа может в это же время заменять поток генерации, а слот - получить другую позицию
+		const Chunk& neighbor = chunks[neighborIndex];
+		std::lock_guard<std::mutex> lock(chunks[neighborIndex].lock);
+		borders->present[n] = neighbor.generated
+			&& neighbor.posx == posx + chunkNeighborOffsets[n][0] && neighbor.posz == posz + chunkNeighborOffsets[n][1];
+		if (!borders->present[n])
+			continue;
+
+		const ChunkBlocks& neighborBlocks = neighbor.blocks;
+		BlockType* slab = borders->slabs[n];
+		for (int y = 0; y < CHUNK_SY; y++) {
+			int layer = y * CHUNK_SX * CHUNK_SZ;
+			switch (n) {
+			case neighborXNeg:
+				for (int z = 0; z < CHUNK_SZ; z++)
+					slab[y * CHUNK_SZ + z] = neighborBlocks.get(layer + z * CHUNK_SX + CHUNK_SX - 1);
+				break;
+			case neighborXPos:
+				for (int z = 0; z < CHUNK_SZ; z++)
+					slab[y * CHUNK_SZ + z] = neighborBlocks.get(layer + z * CHUNK_SX);
+				break;
+			case neighborZNeg:
+				for (int x = 0; x < CHUNK_SX; x++)
+					slab[y * CHUNK_SX + x] = neighborBlocks.get(layer + (CHUNK_SZ - 1) * CHUNK_SX + x);
+				break;
+			case neighborZPos:
+				for (int x = 0; x < CHUNK_SX; x++)
+					slab[y * CHUNK_SX + x] = neighborBlocks.get(layer + x);
+				break;
+			}
+		}
+	}
+}
+
+// соседи уже построенного чанка должны перестроить меш с учетом его граничных блоков.
+// urgent - после правки игрока, перестроение важнее генерации
+void GameWorld::markNeighborsForRemesh(int chunkIndex, bool urgent) {
+	Chunk& chunk = chunks[chunkIndex];
+	for (int n = 0; n < neighborCOUNT; n++) {
+		int neighborIndex = findChunkIndex(chunk.posx + chunkNeighborOffsets[n][0], chunk.posz + chunkNeighborOffsets[n][1]);
+		if (neighborIndex != -1 && chunks[neighborIndex].generated) {
+			if (urgent)
+				chunks[neighborIndex].remeshUrgent = true;
+			chunks[neighborIndex].needRemesh = true;
+		}
+	}
+}
+
+#define CONNECTIVITY_COLUMN_CELLS (CHUNK_SY / CONNECTIVITY_CELL) // ячеек по высоте чанка
+#define CHUNK_CELLS (CONNECTIVITY_CELLS_X * CONNECTIVITY_COLUMN_CELLS * CONNECTIVITY_CELLS_Z)
+
+// связность ячейки для обхода, только из копии основного потока: рабочие потоки в это время могут
+// пересчитывать cellConnectivity. Через чанк без актуальной копии (не отправлен меш, были правки) проход открыт
+static u16 traversalConnectivity(const Chunk& chunk, int cellX, int cellY, int cellZ) {
+	if (chunk.connectivityOpen)
+		return SECTION_ALL_CONNECTED;
+	int section = cellY / CONNECTIVITY_CELLS_Y;
+	int y = cellY % CONNECTIVITY_CELLS_Y;
+	return chunk.drawnConnectivity[section][(y * CONNECTIVITY_CELLS_Z + cellZ) * CONNECTIVITY_CELLS_X + cellX];
+}
+
+// секция целиком из воздуха обходится как один узел: ячеек над рельефом в десятки раз больше, чем в нем
+static bool isAirSection(const Chunk& chunk, int section) {
+	return !chunk.connectivityOpen && (chunk.drawnAirSections & (1 << section));
 }
 
-Block* GameWorld::peekBlockFromRay(glm::vec3 rayPos, glm::vec3 rayDir, u8 maxDist, glm::vec3* outBlockPos) {
+struct CellVisit {
+	int chunk;
+	u8 x, y, z; // ячейка в чанке, y - по всей высоте чанка. Для воздушной секции - ее нижняя ячейка (0, y, 0)
+	u8 enteredFrom; // сторона ячейки, через которую в нее вошли, sideCOUNT - ячейка камеры
+	u8 directions; // бит на сторону: направления, в которых уже шли от камеры
+};
+
+// обход в ширину по ячейкам: из ячейки можно выйти через сторону, связанную со стороной входа,
+// и только в направлении, противоположного которому еще не было (иначе путь поворачивает к камере)
+bool GameWorld::findReachableChunks(glm::vec3 cameraPos, u8* reached) {
+	static CellVisit* queue = NULL;
+	static u8* visited = NULL;
+	static u32 capacity = 0;
+	u32 nodeCount = chunksCount * CHUNK_CELLS;
+	if (nodeCount > capacity) {
+		capacity = nodeCount;
+		queue = (CellVisit*)realloc(queue, capacity * sizeof(CellVisit));
+		visited = (u8*)realloc(visited, capacity);
+	}
+
+	Chunk* cameraChunk = getChunkFromPos(cameraPos);
+	if (cameraChunk == NULL || cameraPos.y < 0 || cameraPos.y >= CHUNK_SY)
+		return false;
+
+	memset(visited, 0, nodeCount);
+	memset(reached, 0, chunksCount);
+	int head = 0, tail = 0;
+	// ячейка, в воздушной секции - узел секции
+	auto enqueue = [&](int chunk, int x, int y, int z, int enteredFrom, int directions) {
+		if (isAirSection(chunks[chunk], y / CONNECTIVITY_CELLS_Y)) {
+			x = z = 0;
+			y -= y % CONNECTIVITY_CELLS_Y;
+		}
+		int node = ((chunk * CONNECTIVITY_COLUMN_CELLS + y) * CONNECTIVITY_CELLS_Z + z) * CONNECTIVITY_CELLS_X + x;
+		if (visited[node])
+			return;
+		visited[node] = 1;
+		queue[tail++] = { chunk, (u8)x, (u8)y, (u8)z, (u8)enteredFrom, (u8)directions };
+	};
+	enqueue((int)(cameraChunk - chunks),
+		((int)floorf(cameraPos.x) - cameraChunk->posx) / CONNECTIVITY_CELL,
+		(int)floorf(cameraPos.y) / CONNECTIVITY_CELL,
+		((int)floorf(cameraPos.z) - cameraChunk->posz) / CONNECTIVITY_CELL, sideCOUNT, 0);
+
+	while (head < tail) {
+		CellVisit visit = queue[head++];
+		reached[visit.chunk] = 1;
+		const Chunk& chunk = chunks[visit.chunk];
+		bool wholeSection = isAirSection(chunk, visit.y / CONNECTIVITY_CELLS_Y);
+		u16 connectivity = wholeSection ? SECTION_ALL_CONNECTED : traversalConnectivity(chunk, visit.x, visit.y, visit.z);
+		// ячейки узла: одна или вся секция
+		int x0 = visit.x, x1 = visit.x, y0 = visit.y, y1 = visit.y, z0 = visit.z, z1 = visit.z;
+		if (wholeSection) {
+			x1 = CONNECTIVITY_CELLS_X - 1;
+			y1 = visit.y + CONNECTIVITY_CELLS_Y - 1;
+			z1 = CONNECTIVITY_CELLS_Z - 1;
+		}
+		for (int out = 0; out < sideCOUNT; out++) {
+			if (visit.directions & (1 << (out ^ 1)))
+				continue;
+			if (visit.enteredFrom != sideCOUNT && !(connectivity & sectionSidePairBit(visit.enteredFrom, out)))
+				continue;
+
+			int next = visit.chunk;
+			// ячейки за стороной out
+			int nx0 = x0, nx1 = x1, ny0 = y0, ny1 = y1, nz0 = z0, nz1 = z1;
+			switch (out) {
+			case sideXNeg:
+				nx0 = nx1 = x0 - 1;
+				if (nx0 < 0) { nx0 = nx1 = CONNECTIVITY_CELLS_X - 1; next = findChunkIndex(chunk.posx - CHUNK_SX, chunk.posz); }
+				break;
+			case sideXPos:
+				nx0 = nx1 = x1 + 1;
+				if (nx0 == CONNECTIVITY_CELLS_X) { nx0 = nx1 = 0; next = findChunkIndex(chunk.posx + CHUNK_SX, chunk.posz); }
+				break;
+			case sideZNeg:
+				nz0 = nz1 = z0 - 1;
+				if (nz0 < 0) { nz0 = nz1 = CONNECTIVITY_CELLS_Z - 1; next = findChunkIndex(chunk.posx, chunk.posz - CHUNK_SZ); }
+				break;
+			case sideZPos:
+				nz0 = nz1 = z1 + 1;
+				if (nz0 == CONNECTIVITY_CELLS_Z) { nz0 = nz1 = 0; next = findChunkIndex(chunk.posx, chunk.posz + CHUNK_SZ); }
+				break;
+			case sideYNeg: ny0 = ny1 = y0 - 1; break;
+			case sideYPos: ny0 = ny1 = y1 + 1; break;
+			}
+			if (next == -1 || ny0 < 0 || ny0 >= CONNECTIVITY_COLUMN_CELLS)
+				continue;
+			for (int y = ny0; y <= ny1; y++)
+				for (int z = nz0; z <= nz1; z++)
+					for (int x = nx0; x <= nx1; x++)
+						enqueue(next, x, y, z, out ^ 1, visit.directions | (1 << out));
+		}
+	}
+	return true;
+}
+
+// тип блока в мировой позиции pos, false если позиция вне загруженных чанков
+bool GameWorld::peekBlockFromPos(glm::vec3 pos, BlockType* outType) {
+	Chunk* chunk = getChunkFromPos(pos);
+	if (chunk == NULL || pos.y < 0 || pos.y >= CHUNK_SY) // выход за пределы чанка
+		return false;
+
+	int x = (int)floorf(pos.x) - chunk->posx;
+	int y = (int)floorf(pos.y);
+	int z = (int)floorf(pos.z) - chunk->posz;
+
+	std::lock_guard<std::mutex> lock(chunk->lock);
+	if (!chunk->generated)
+		return false;
+	*outType = chunk->blocks.get(x + z * CHUNK_SX + y * CHUNK_SX * CHUNK_SZ);
+	return true;
+}
+
+// первый непрозрачный блок на луче, true если найден
+bool GameWorld::peekBlockFromRay(glm::vec3 rayPos, glm::vec3 rayDir, u8 maxDist, glm::vec3* outBlockPos) {
 	if (glm::length(rayDir) == 0)
-		return NULL;
+		return false;
 	float deltaDist = 1;
 	float dist = 0;
 
-	Block* block;
+	BlockType blockType;
 
 	glm::vec3 norm = glm::normalize(rayDir);
 	while (dist < maxDist) {
 		glm::vec3 currentPos = rayPos + (norm * dist);
 
-		block = peekBlockFromPos(
-			glm::vec3(
-			currentPos.x,
-			currentPos.y,
-			currentPos.z));
-
-		if (block != NULL && block->type != btAir) {
+		if (peekBlockFromPos(currentPos, &blockType) && blockType != btAir) {
 			if (outBlockPos)
 				*outBlockPos = glm::floor(glm::vec3(currentPos.x, currentPos.y, currentPos.z));
-			return block;
+			return true;
 		}
 
 		dist += deltaDist;
 	}
-	return NULL;	
-}
\ No newline at end of file
+	return false;	
+}
+
+// заменить блок в мировой позиции pos и обновить карту высот его столбца.
+// Возвращает измененный чанк, NULL если позиция вне загруженных чанков
+Chunk* GameWorld::setBlockFromPos(glm::vec3 pos, BlockType type) {
+	Chunk* chunk = getChunkFromPos(pos);
+	if (chunk == NULL || pos.y < 0 || pos.y >= CHUNK_SY)
+		return NULL;
+
+	int x = (int)floorf(pos.x) - chunk->posx;
+	int y = (int)floorf(pos.y);
+	int z = (int)floorf(pos.z) - chunk->posz;
+
+	std::lock_guard<std::mutex> lock(chunk->lock);
+	if (!chunk->generated)
+		return NULL;
+	setChunkBlock(*chunk, x, y, z, type);
+	chunk->modified = true;
+	chunk->connectivityOpen = true; // копия связности устарела до отправки нового меша
+	return chunk;
+}
@@ -1,10 +1,13 @@
 #pragma once
+#include <mutex>
 #include <glm.hpp>
 #include "Typedefs.h"
 #include "Entity.h"
 #include "Mesh.h"
 #include "DataStructures.h"
 #include "Chunk.h"
+#include "Region.h"
+#include "NoiseBatch.h"
 
 struct Display {
 	int displayWidth;
@@ -14,7 +17,7 @@ struct Display {
 };
 
 glm::mat4 getProjection(float FOV, int displayW, int displayH);
-int getChunksCount(int renderDistance);
+int getChunksCount(int renderDistance, bool circular);
 
 struct Camera {
 	glm::vec3 pos = glm::vec3(0, 0, 0);
@@ -30,20 +33,96 @@ struct Player {
 	float speed = 20;
 };
 
+// слои шума генерации мира, у каждого свой сид и частота
+enum NoiseLayer : u8 {
+	noiseTemperature,
+	noiseHeight,
+	noiseOre,
+	noiseCave,
+	noiseLayerCOUNT
+};
+
+// шаг решетки 3D шума пещер и руды: 1 - шум в каждом блоке, иначе шум считается в узлах решетки
+// с этим шагом и интерполируется между ними. Шаг должен делить CHUNK_SX и CHUNK_SZ
+#define NOISE_LATTICE_MIN_STEP 2
+#define NOISE_LATTICE_MAX_STEP 8
+
+#define CHUNK_PREFETCH_MAX 64 // слоты чанков сверх радиуса загрузки для упреждающей генерации
+#define MAX_LOAD_RADIUS 32 // под него выделяются слоты чанков, радиус загрузки меняется в этих пределах
+
 struct GameWorld {
 	u32 seed;
 	
 	Chunk* chunks;
-	u32 chunksCount;
+	u32 chunksCount; // все слоты, вместе со слотами упреждающей генерации
+	u32 loadedChunksCount; // чанков в радиусе загрузки
+
+	// тороидальная сетка chunksSide x chunksSide: ячейка (posx / CHUNK_SX mod side, posz / CHUNK_SZ mod side)
+	// хранит индекс чанка, занимающего ее, или -1. Все чанки в пределах видимости попадают в разные ячейки
+	int chunksSide;
+	int* chunkGrid;
+	// сетку и chunksSide меняет только основной поток, под этим замком. Рабочие потоки ищут соседей под ним
+	std::mutex gridLock;
+
+	// загружаются чанки в радиусе loadRadius (в чанках) от чанка камеры: в квадрате или в круге.
+	// loadRowHalfWidth[dz + loadRadius] - загружаются чанки строки dz с |dx| <= полуширины
+	int loadRadius;
+	int maxLoadRadius;
+	bool circularLoad;
+	int* loadRowHalfWidth;
+	// чанки без позиции: вышли за радиус и еще не заняты новой позицией
+	int* freeChunks;
+	int freeChunkCount;
+	bool streamStarted;
+	int streamCenterX, streamCenterZ; // чанк центра загрузки при последнем streamChunks, в чанках
+	// чанки, сгенерированные заранее по направлению движения. Когда позиция входит в радиус,
+	// чанк переходит в сетку без повторной генерации
+	int* prefetchedChunks;
+	int prefetchedCount;
+
+	int noise3DStep; // шаг решетки 3D шума для новых задач генерации, читается только основным потоком
+	RegionStorage* storage; // NULL - мир не сохраняется, выгруженные чанки генерируются заново
 	
 	DynamicArray<Entity> entities;
 	u32 entitiesCount;
 
-	void init(u32 seed, u32 chunksCount);
-	void reallocChunks(u32 chunksCount);
-	float perlinNoise(glm::vec2 pos, int seedShift = 0);
-	float perlinNoise(glm::vec3 pos, int seedShift = 0);
+	void init(u32 seed, int loadRadius, bool circularLoad, int maxLoadRadius = MAX_LOAD_RADIUS);
+	float perlinNoise(NoiseLayer layer, glm::vec2 pos);
+	float perlinNoise(NoiseLayer layer, glm::vec3 pos);
+	void perlinNoise(NoiseLayer layer, const float* xs, const float* ys, int count, float* out, NoiseSimdLevel simdLevel);
+	void perlinNoise(NoiseLayer layer, const float* xs, const float* ys, const float* zs, int count, float* out, NoiseSimdLevel simdLevel);
 	void generateChunk(int index, int posx, int posz);
-	Block* peekBlockFromPos(glm::vec3 pos);
-	Block* peekBlockFromRay(glm::vec3 rayPos, glm::vec3 rayDir, u8 maxDist, glm::vec3* outBlockPos = NULL);
+	// noise3DStep - шаг решетки пещер и руды, simdLevel - версия пакетного шума. Оба снимаются при отправке задачи:
+	// настройки могут меняться во время генерации
+	void generateChunkBlocks(Block* blocks, ChunkColumns* columns, int posx, int posz, int noise3DStep, NoiseSimdLevel simdLevel);
+	void generateChunkBlocksPerVoxel(Block* blocks, int posx, int posz);
+	int getChunkGridCell(int posx, int posz);
+	int findChunkIndex(int posx, int posz);
+	void setChunkPos(int index, int posx, int posz);
+	void unloadChunk(int index);
+	bool isInLoadRadius(int dx, int dz); // в чанках от центра
+	// центр загрузки переместился в чанк (centerX, centerZ): чанки, вышедшие из радиуса, выгружаются,
+	// их слоты занимают вошедшие позиции. Обходятся только строки изменившихся участков, O(сторона + изменения).
+	// В placed записываются чанки с новой позицией, в promoted - заранее сгенерированные чанки, вошедшие в радиус
+	// (оба не больше chunksCount). Возвращается число placed
+	int streamChunks(int centerX, int centerZ, int* placed, int* promoted, int* promotedCount);
+	// сменить радиус загрузки на ходу: чанки, оставшиеся в радиусе, сохраняют слоты, блоки и участки буфера на ГПУ,
+	// вышедшие выгружаются, появившиеся позиции занимают свободные слоты. Выход как у streamChunks
+	int setLoadRadius(int radius, int* placed, int* promoted, int* promotedCount);
+	// позиции чанков (в блоках) в радиусе вокруг чанка (toX, toZ), но не вокруг (fromX, fromZ). Центры в чанках
+	int chunksEnteringRadius(int fromX, int fromZ, int toX, int toZ, glm::ivec2* out, int maxCount);
+	int findPrefetchedChunk(int posx, int posz);
+	// занять свободный слот под заранее генерируемый чанк, -1 - свободных слотов нет
+	int prefetchChunk(int posx, int posz);
+	void promoteChunk(int index);
+	Chunk* getChunkFromPos(glm::vec3 pos);
+	int getSurfaceHeight(int x, int z);
+	void getChunkBorders(int chunkIndex, ChunkBorders* borders); // не под блокировкой чанка
+	void markNeighborsForRemesh(int chunkIndex, bool urgent = false); // только в основном потоке
+	// обход графа связности ячеек от камеры: reached[i] = 1, если в чанк i можно заглянуть по воздуху,
+	// двигаясь только от камеры. false - камера вне загруженных секций, reached не заполнен
+	bool findReachableChunks(glm::vec3 cameraPos, u8* reached);
+	bool peekBlockFromPos(glm::vec3 pos, BlockType* outType);
+	bool peekBlockFromRay(glm::vec3 rayPos, glm::vec3 rayDir, u8 maxDist, glm::vec3* outBlockPos = NULL);
+	Chunk* setBlockFromPos(glm::vec3 pos, BlockType type);
 };
\ No newline at end of file
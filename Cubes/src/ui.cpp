@@ -5,7 +5,7 @@
 #include "Mesh.h"
 #include "Directories.h"
 
-static GLuint uiShader;
+static Shader uiShader;
 static GLuint faceVAO;
 
 float originX = 0, originY = 0;
@@ -15,9 +15,9 @@ int displayW, displayH;
 glm::mat4 projection;
 
 void uiInit() {
-	uiShader = BuildShader(SHADER_FOLDER "uiElement.vert", SHADER_FOLDER "uiElement.frag");
+	uiShader.build(SHADER_FOLDER "uiElement.vert", SHADER_FOLDER "uiElement.frag");
 
-	// TODO:          CPU
+	// TODO: запечь вершины в вершинный шейдер вместо создания их на CPU
 	static Vertex faceVerts[] = {
 		Vertex(-0.5,-0.5,0, 0,0),
 		Vertex(0.5, -0.5,0, 1,0),
@@ -34,15 +34,15 @@ void uiInit() {
 	glGenBuffers(1, &VBO);
 	glGenBuffers(1, &EBO);
 
-	//    
+	// выбираем буфер как текущий
 	glBindVertexArray(VAO);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(faceVerts), faceVerts, GL_STATIC_DRAW); //     
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faceTris), faceTris, GL_STATIC_DRAW); //  
+	glBufferData(GL_ARRAY_BUFFER, sizeof(faceVerts), faceVerts, GL_STATIC_DRAW); // отправка вершин в память видеокарты
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faceTris), faceTris, GL_STATIC_DRAW); // загружаем индексы
 
-	// ""      
+	// "объясняем" как необходимо прочитать массив с вершинами
 	GLint stride = sizeof(Vertex);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, pos)); // pos
@@ -53,6 +53,10 @@ void uiInit() {
 	glBindVertexArray(0);
 }
 
+void uiRebuildShader() {
+	uiShader.rebuild();
+}
+
 void uiStart(GLFWwindow* window) {
 	glfwGetFramebufferSize(window, &displayW, &displayH);
 
@@ -71,24 +75,24 @@ void uiStart(GLFWwindow* window) {
 	projection = glm::ortho(-centerX, centerX, -centerY, centerY, -1.0f, 1.0f);
 
 	// use ui shader
-	glUseProgram(uiShader);
-	glUniformMatrix4fv(glGetUniformLocation(uiShader, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+	uiShader.use();
+	glUniformMatrix4fv(uiShader.location(uniformProjection), 1, GL_FALSE, glm::value_ptr(projection));
 }
 
 
 void uiDrawElement(GLuint texture, glm::vec3 rot, glm::vec3 scale, glm::vec2 uvScale, glm::vec2 uvShift) {
 	glBindTexture(GL_TEXTURE_2D, texture);
 
-	glm::mat4 model = glm::mat4(1.0f); //   (1  )
+	glm::mat4 model = glm::mat4(1.0f); // единичная матрица (1 по диагонали)
 	model = glm::translate(model, glm::vec3(originX, originY, 0.0f));
 	model = glm::rotate(model, glm::radians(rot.x), glm::vec3(1.0, 0.0, 0.0));
 	model = glm::rotate(model, glm::radians(rot.y), glm::vec3(0.0, 1.0, 0.0));
-	model = glm::rotate(model, glm::radians(rot.z+180), glm::vec3(0.0, 0.0, 1.0)); // +180      
+	model = glm::rotate(model, glm::radians(rot.z+180), glm::vec3(0.0, 0.0, 1.0)); // +180 так как элемент отрисовывался вверх ногами
 	model = glm::scale(model, scale);
-	glUniformMatrix4fv(glGetUniformLocation(uiShader, "model"), 1, GL_FALSE, glm::value_ptr(model));
+	glUniformMatrix4fv(uiShader.location(uniformModel), 1, GL_FALSE, glm::value_ptr(model));
 
-	glUniform2f(glGetUniformLocation(uiShader, "UVScale"), uvScale.x, uvScale.y);
-	glUniform2f(glGetUniformLocation(uiShader, "UVShift"), uvShift.x, uvShift.y);
+	glUniform2f(uiShader.location(uniformUVScale), uvScale.x, uvScale.y);
+	glUniform2f(uiShader.location(uniformUVShift), uvShift.x, uvShift.y);
 
 	glBindVertexArray(faceVAO);
 	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
@@ -5,6 +5,7 @@
 #include <glm.hpp>
 
 void uiInit();
+void uiRebuildShader();
 void uiStart(GLFWwindow* window);
 
 void uiDrawElement(GLuint texture, glm::vec3 rot, glm::vec3 scale, glm::vec2 uvScale, glm::vec2 uvShift);
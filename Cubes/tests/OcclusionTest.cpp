@@ -0,0 +1,145 @@
+// проверка программного отсечения (Occlusion.cpp) без OpenGL и окна: Hi-Z сравнивается с эталоном occlusionSelfTest
+// на случайных сценах и на двух заданных. Код возврата 0 - ложных отсечений нет и эталон их ловит.
+// Сборка из корня репозитория:
+//   g++ -O2 -std=c++17 -ICubes/src -Ideps/glm -Ideps/glad/include -Ideps/other Cubes/tests/OcclusionTest.cpp Cubes/src/Occlusion.cpp -o OcclusionTest
+//   cl /O2 /std:c++17 /EHsc /ICubes\src /Ideps\glm /Ideps\glad\include /Ideps\other Cubes\tests\OcclusionTest.cpp Cubes\src\Occlusion.cpp
+#include <stdio.h>
+#include <algorithm>
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+#include "Occlusion.h"
+
+#define SCENES 200
+#define SCENE_CHUNKS 4 // по CHUNK_MAX_OCCLUDERS граней
+#define SCENE_BOXES 64
+
+static u32 rngState = 12345;
+static float rnd(float min, float max) {
+	rngState = rngState * 1664525u + 1013904223u;
+	return min + (max - min) * ((rngState >> 8) / float(1 << 24));
+}
+
+static glm::mat4 cameraMatrix(glm::vec3 pos, glm::vec3 dir) {
+	glm::mat4 projection = glm::perspective(glm::radians(70.0f), float(OCCLUSION_WIDTH) / OCCLUSION_HEIGHT, 0.1f, 1000.0f);
+	return projection * glm::lookAt(pos, pos + dir, glm::vec3(0, 1, 0));
+}
+
+static OcclusionBox makeBox(glm::vec3 min, glm::vec3 max) {
+	return { min, max };
+}
+
+static void addResult(OcclusionSelfTest& total, const OcclusionSelfTest& r) {
+	total.tested += r.tested;
+	total.culled += r.culled;
+	total.referenceCulled += r.referenceCulled;
+	total.falseCulls += r.falseCulls;
+}
+
+// грань на случайном месте перед камерой, одна ось вырождена
+static OcclusionBox randomQuad() {
+	glm::vec3 min(rnd(-60, 60), rnd(-30, 30), rnd(5, 120));
+	glm::vec3 size(rnd(1, 16), rnd(1, 16), rnd(1, 16));
+	size[int(rnd(0, 3)) % 3] = 0;
+	return makeBox(min, min + size);
+}
+
+static OcclusionSelfTest randomScenes() {
+	static ChunkOccluders chunks[SCENE_CHUNKS];
+	const ChunkOccluders* chunkPtrs[SCENE_CHUNKS];
+	OcclusionBox boxes[SCENE_BOXES];
+	OcclusionBuffer buffer;
+	buffer.init();
+
+	OcclusionSelfTest total = {};
+	for (int scene = 0; scene < SCENES; scene++) {
+		for (int c = 0; c < SCENE_CHUNKS; c++) {
+			chunks[c].count = CHUNK_MAX_OCCLUDERS;
+			for (int i = 0; i < CHUNK_MAX_OCCLUDERS; i++)
+				chunks[c].quads[i] = randomQuad();
+			chunkPtrs[c] = &chunks[c];
+		}
+		for (int i = 0; i < SCENE_BOXES; i++) {
+			glm::vec3 min(rnd(-80, 80), rnd(-40, 40), rnd(10, 160));
+			float size = rnd(0.5f, 16);
+			boxes[i] = makeBox(min, min + glm::vec3(size));
+		}
+		glm::vec3 cameraPos(rnd(-4, 4), rnd(-4, 4), rnd(-4, 0));
+		glm::vec3 cameraDir(rnd(-0.4f, 0.4f), rnd(-0.3f, 0.3f), 1);
+		buffer.rasterize(cameraMatrix(cameraPos, cameraDir), cameraPos, chunkPtrs, SCENE_CHUNKS, SCENE_CHUNKS * CHUNK_MAX_OCCLUDERS);
+		addResult(total, occlusionSelfTest(buffer, boxes, SCENE_BOXES));
+	}
+	return total;
+}
+
+// стена с щелью шириной около двух пикселей, за щелью маленький бокс.
+// spoil - щель заливается глубиной стены, как сделал бы неверный растеризатор: эталон обязан это поймать
+static OcclusionSelfTest gapScene(bool spoil) {
+	ChunkOccluders wall;
+	wall.count = 2;
+	wall.quads[0] = makeBox(glm::vec3(-30, -20, 20), glm::vec3(-0.2f, 20, 20));
+	wall.quads[1] = makeBox(glm::vec3(0.2f, -20, 20), glm::vec3(30, 20, 20));
+	const ChunkOccluders* chunkPtrs[] = { &wall };
+	OcclusionBox box = makeBox(glm::vec3(-0.15f, -1, 40), glm::vec3(0.15f, 1, 41));
+
+	OcclusionBuffer buffer;
+	buffer.init();
+	buffer.rasterize(cameraMatrix(glm::vec3(0), glm::vec3(0, 0, 1)), glm::vec3(0), chunkPtrs, 1, 2);
+	if (spoil) {
+		float* depth = buffer.levels[0];
+		for (int y = 0; y < OCCLUSION_HEIGHT; y++) {
+			float* row = depth + y * OCCLUSION_WIDTH;
+			float wallDepth = std::min(row[0], row[OCCLUSION_WIDTH - 1]);
+			for (int x = 0; x < OCCLUSION_WIDTH; x++)
+				row[x] = std::min(row[x], wallDepth);
+		}
+		for (int l = 1; l < OCCLUSION_LEVELS; l++) {
+			int width = OCCLUSION_WIDTH >> l, height = OCCLUSION_HEIGHT >> l;
+			const float* src = buffer.levels[l - 1];
+			float* dst = buffer.levels[l];
+			for (int y = 0; y < height; y++) {
+				for (int x = 0; x < width; x++) {
+					const float* s = src + (y * 2) * (width * 2) + x * 2;
+					dst[y * width + x] = std::max(std::max(s[0], s[1]), std::max(s[width * 2], s[width * 2 + 1]));
+				}
+			}
+		}
+	}
+	return occlusionSelfTest(buffer, &box, 1);
+}
+
+// бокс целиком за сплошной стеной
+static OcclusionSelfTest wallScene() {
+	ChunkOccluders wall;
+	wall.count = 1;
+	wall.quads[0] = makeBox(glm::vec3(-30, -20, 20), glm::vec3(30, 20, 20));
+	const ChunkOccluders* chunkPtrs[] = { &wall };
+	OcclusionBox box = makeBox(glm::vec3(-2, -2, 40), glm::vec3(2, 2, 44));
+
+	OcclusionBuffer buffer;
+	buffer.init();
+	buffer.rasterize(cameraMatrix(glm::vec3(0), glm::vec3(0, 0, 1)), glm::vec3(0), chunkPtrs, 1, 1);
+	return occlusionSelfTest(buffer, &box, 1);
+}
+
+int main() {
+	bool ok = true;
+
+	OcclusionSelfTest r = wallScene();
+	printf("wall:   culled %d, reference %d\n", r.culled, r.referenceCulled);
+	ok &= r.culled == 1 && r.referenceCulled == 1;
+
+	r = gapScene(false);
+	printf("gap:    culled %d, reference %d, false %d\n", r.culled, r.referenceCulled, r.falseCulls);
+	ok &= r.culled == 0 && r.referenceCulled == 0;
+
+	r = gapScene(true);
+	printf("spoilt: culled %d, reference %d, false %d\n", r.culled, r.referenceCulled, r.falseCulls);
+	ok &= r.falseCulls == 1;
+
+	r = randomScenes();
+	printf("random: tested %d, culled %d, reference %d, false %d\n", r.tested, r.culled, r.referenceCulled, r.falseCulls);
+	ok &= r.falseCulls == 0 && r.culled > 0;
+
+	printf(ok ? "OK\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -5,15 +5,23 @@ out vec4 FragColor;
 in vec3 ourColor;
 in vec3 ourNormal;
 in vec2 ourUV;
+flat in vec2 ourAtlasOffset;
+flat in float ourAtlasScale;
 in vec3 FragPos;
 in vec4 FragPosLightSpace;
 
 uniform sampler2D texture1;
 uniform sampler2D shadowMap;
 
-uniform vec3 sunDir;
-uniform vec3 sunColor;
-uniform vec3 ambientColor;
+// общие данные кадра (FrameUniforms в Mesh.h)
+layout (std140) uniform FrameData {
+    mat4 projection;
+    mat4 view;
+    mat4 lightSpaceMatrix;
+    vec4 sunDir;
+    vec4 sunColor;
+    vec4 ambientColor;
+};
 
 float ShadowCalculation(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir)
 {
@@ -62,16 +70,16 @@ float ShadowCalculationSmooth(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir
 }  
 
 void main() {
-	vec4 texColor = texture(texture1, ourUV);
+	vec4 texColor = texture(texture1, ourAtlasOffset + fract(ourUV) * ourAtlasScale);
 
 	vec3 norm = normalize(ourNormal);
-	vec3 lightDir = normalize(sunDir);
+	vec3 lightDir = normalize(sunDir.xyz);
 	float diff = max(dot(norm, lightDir), 0.0);
-	vec3 diffuse = diff * sunColor;
+	vec3 diffuse = diff * sunColor.rgb;
 
-    //float shadow = ShadowCalculation(FragPosLightSpace, norm, sunDir);
-    float shadow = ShadowCalculationSmooth(FragPosLightSpace, norm, sunDir);
+    //float shadow = ShadowCalculation(FragPosLightSpace, norm, sunDir.xyz);
+    float shadow = ShadowCalculationSmooth(FragPosLightSpace, norm, sunDir.xyz);
 
-	vec3 result = (ambientColor + diffuse * (1.0 - shadow)) * vec3(texColor.r, texColor.g, texColor.b);
+	vec3 result = (ambientColor.rgb + diffuse * (1.0 - shadow)) * vec3(texColor.r, texColor.g, texColor.b);
 	FragColor = vec4(result, 1.0);
 }
\ No newline at end of file
@@ -4,39 +4,39 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in int instancePackedOffset;
 layout (location = 2) in int instanceFaceDirection;
 layout (location = 3) in int instanceTextureID;
+layout (location = 4) in ivec2 instanceSize; // размер полигона в блоках (greedy meshing)
+layout (location = 5) in ivec2 instanceChunk; // координаты чанка в чанках
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceMatrix;
+// общие данные кадра (FrameUniforms в Mesh.h)
+layout (std140) uniform FrameData {
+    mat4 projection;
+    mat4 view;
+    mat4 lightSpaceMatrix;
+    vec4 sunDir;
+    vec4 sunColor;
+    vec4 ambientColor;
+};
 
 uniform ivec2 atlasSize;
-uniform ivec2 chunkPos;
 
 out vec3 ourColor;
 out vec3 ourNormal;
-out vec2 ourUV;
+out vec2 ourUV; // координаты в тайлах, тайл повторяется по всему полигону
+flat out vec2 ourAtlasOffset;
+flat out float ourAtlasScale;
 out vec3 FragPos;
 out vec4 FragPosLightSpace;
 
-const vec2 uvs[4] = vec2[4](
-    vec2(0.0,  0.0),
-    vec2(0.0,  1.0),
-    vec2(1.0,  1.0),
-    vec2(1.0,  0.0)
-);
-
 void main() {
-    int CHUNK_SX = 16;
-    int CHUNK_SZ = 16;
-    int CHUNK_SY = 24;
-    vec3 pos = aPos;
+    vec3 pos = aPos * vec3(instanceSize.x, 1, instanceSize.y);
+    ourUV = pos.zx;
     
     int texSize = 16;
 
     // y+
     if (instanceFaceDirection == 0) {
-        pos.xz = pos.zx; //   (   FACE_CULL)
+        pos.xz = pos.zx; // переворачиваем полигон (для верной работы FACE_CULL)
         pos.y++;
         ourNormal = vec3(0,1,0);
     }
@@ -69,22 +69,18 @@ void main() {
         ourNormal = vec3(0,-1,0);        
     }
     
-    //  offset
+    // распаковываем offset
     vec3 offset = vec3(
 	    instancePackedOffset % CHUNK_SX,
 	    instancePackedOffset / (CHUNK_SX * CHUNK_SZ),
 	    instancePackedOffset / CHUNK_SX % CHUNK_SZ
     );
 
-    // todo:  uv  instanceTextureID  atlasSize
-    //float u = uvs[gl_VertexID].x / float(atlasSize.x) + float((instanceTextureID * texSize) % atlasSize.x) / float(atlasSize.x);
-    //float v = uvs[gl_VertexID].y / float(atlasSize.x) + float(instanceTextureID * texSize / atlasSize.x * texSize) / float(atlasSize.y);
     float uvSize = (float(atlasSize) / float(texSize));
-    float u = uvs[gl_VertexID].x / uvSize + (1.0 / uvSize) * float(instanceTextureID); // TODO:  (    )
-    float v = uvs[gl_VertexID].y / uvSize;
-    ourUV = vec2(u,v);
+    ourAtlasScale = 1.0 / uvSize;
+    ourAtlasOffset = vec2(ourAtlasScale * float(instanceTextureID), 0.0);
 
-    vec3 vertexPos = pos + offset + vec3(chunkPos.x, 0, chunkPos.y);
+    vec3 vertexPos = pos + offset + vec3(instanceChunk.x * CHUNK_SX, 0, instanceChunk.y * CHUNK_SZ);
     FragPos = vec3(model * vec4(vertexPos, 1.0));
 
     FragPosLightSpace = lightSpaceMatrix * vec4(FragPos, 1.0);
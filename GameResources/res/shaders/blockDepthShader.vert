@@ -4,21 +4,26 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in int instancePackedOffset;
 layout (location = 2) in int instanceFaceDirection;
 layout (location = 3) in int instanceTextureID;
+layout (location = 4) in ivec2 instanceSize;
+layout (location = 5) in ivec2 instanceChunk; // координаты чанка в чанках
 
-uniform mat4 model;
-uniform mat4 lightSpaceMatrix;
+// общие данные кадра (FrameUniforms в Mesh.h)
+layout (std140) uniform FrameData {
+    mat4 projection;
+    mat4 view;
+    mat4 lightSpaceMatrix;
+    vec4 sunDir;
+    vec4 sunColor;
+    vec4 ambientColor;
+};
 
-uniform ivec2 chunkPos;
 
 void main() {
-    int CHUNK_SX = 16;
-    int CHUNK_SZ = 16;
-    int CHUNK_SY = 24;
-    vec3 pos = aPos;
+    vec3 pos = aPos * vec3(instanceSize.x, 1, instanceSize.y);
     
     // y+
     if (instanceFaceDirection == 0) {
-        pos.xz = pos.zx; //   (   FACE_CULL)
+        pos.xz = pos.zx; // переворачиваем полигон (для верной работы FACE_CULL)
         pos.y++;
     }
     // x+
@@ -45,14 +50,14 @@ void main() {
     else {
     }
     
-    //  offset
+    // распаковываем offset
     vec3 offset = vec3(
 	    instancePackedOffset % CHUNK_SX,
 	    instancePackedOffset / (CHUNK_SX * CHUNK_SZ),
 	    instancePackedOffset / CHUNK_SX % CHUNK_SZ
     );
 
-    vec3 vertexPos = pos + offset + vec3(chunkPos.x, 0, chunkPos.y);
+    vec3 vertexPos = pos + offset + vec3(instanceChunk.x * CHUNK_SX, 0, instanceChunk.y * CHUNK_SZ);
 
-	gl_Position = lightSpaceMatrix * model * vec4(vertexPos, 1.0);
+	gl_Position = lightSpaceMatrix * vec4(vertexPos, 1.0);
 }
\ No newline at end of file
@@ -12,9 +12,15 @@ uniform sampler2D texture1;
 uniform sampler2D shadowMap;
 
 uniform float lightingFactor;
-uniform vec3 sunDir;
-uniform vec3 sunColor;
-uniform vec3 ambientColor;
+// общие данные кадра (FrameUniforms в Mesh.h)
+layout (std140) uniform FrameData {
+    mat4 projection;
+    mat4 view;
+    mat4 lightSpaceMatrix;
+    vec4 sunDir;
+    vec4 sunColor;
+    vec4 ambientColor;
+};
 
 float ShadowCalculation(vec4 fragPosLightSpace)
 {
@@ -37,12 +43,12 @@ float ShadowCalculation(vec4 fragPosLightSpace)
 void main()
 {
 	vec3 norm = normalize(ourNormal);
-	vec3 lightDir = normalize(sunDir);
+	vec3 lightDir = normalize(sunDir.xyz);
 	float diff = max(dot(norm, lightDir), 0.0);
-	vec3 diffuse = diff * sunColor;
+	vec3 diffuse = diff * sunColor.rgb;
 
 	vec4 texColor = texture(texture1, TexCoord);
 	float shadow = ShadowCalculation(FragPosLightSpace);
-	vec3 result = (ambientColor + diffuse * (1.0 - shadow)) * vec3(texColor.r, texColor.g, texColor.b);
+	vec3 result = (ambientColor.rgb + diffuse * (1.0 - shadow)) * vec3(texColor.r, texColor.g, texColor.b);
 	FragColor = vec4(result, 1.0);
 }
\ No newline at end of file
@@ -1,5 +1,5 @@
 #version 330 core
-// TDOO:  https://youtu.be/vtqCWvmnGTs?t=2276
+// TDOO: оптимизировать https://youtu.be/vtqCWvmnGTs?t=2276
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoord;
 layout (location = 2) in vec3 aColor;
@@ -13,9 +13,15 @@ out vec3 FragPos;
 out vec4 FragPosLightSpace;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceMatrix;
+// общие данные кадра (FrameUniforms в Mesh.h)
+layout (std140) uniform FrameData {
+    mat4 projection;
+    mat4 view;
+    mat4 lightSpaceMatrix;
+    vec4 sunDir;
+    vec4 sunColor;
+    vec4 ambientColor;
+};
 
 void main()
 {
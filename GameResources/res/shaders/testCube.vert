@@ -24,17 +24,17 @@ const vec3 vertices[8] = vec3[8](
 );
     
 const int indices[36] = int[36](
-    //  
+    // Передняя грань
     0, 1, 2, 2, 3, 0,
-    //  
+    // Правая грань
     1, 5, 6, 6, 2, 1,
-    //  
+    // Задняя грань
     7, 6, 5, 5, 4, 7,
-    //  
+    // Левая грань
     4, 0, 3, 3, 7, 4,
-    //  
+    // Нижняя грань
     4, 5, 1, 1, 0, 4,
-    //  
+    // Верхняя грань
     3, 2, 6, 6, 7, 3
 );
 
@@ -67,11 +67,11 @@ void main() {
     ourNormal = normals[faceID];
     FragPos = vec3(model * vec4(vertexPos, 1.0));
 
-    // ,     
+    // Проверяем, нужно ли отрисовывать эту грань
     bool shouldDraw = (faceMask & (1 << faceID)) != 0;
-    //     ,    
+    // Если грань не должна отрисовываться, помещаем вершину за камерой
     //if (!shouldDraw) {
-        //gl_Position = vec4(0.0, 0.0, -100.0, 1.0); //   
+        //gl_Position = vec4(0.0, 0.0, -100.0, 1.0); // Помещаем за камеру
         //return;
     //}
 